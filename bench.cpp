@@ -0,0 +1,1536 @@
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <regex>
+#include <sstream>
+#include <thread>
+
+#include <json/json.h>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#include "common.h"
+
+namespace fs = std::filesystem;
+
+using Clock = std::chrono::steady_clock;
+
+double secondsSince(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+namespace legacy {
+    /* The regex based parser that the import lexer replaced, kept as a baseline. */
+
+    string trim(const string& input) {
+        return regex_replace(input, std::regex(R"((^(^\s+|\s+$)|\r))"), "");
+    }
+
+    vector<string> getImportsFromLine(string line) {
+        vector<string> imports;
+        imports.reserve(16);
+
+        line = trim(line.erase(0, 6));
+
+        string import;
+        std::stringstream ss(line);
+
+        while(getline(ss, import, ',')) {
+            if(regex_match(import, std::regex("\\w+ as \\w+"))) {
+                import = regex_replace(import, std::regex(" as \\w+"), "");
+            }
+
+            import = trim(import);
+            imports.push_back(import);
+        }
+
+        return imports;
+    }
+
+    File* getImports(const string& file_path) {
+        File* script = new File();
+        script->file_path = Name(file_path);
+
+        std::ifstream in_stream(file_path);
+
+        string str;
+        string prev_import_line;
+        while(getline(in_stream, str)) {
+            string import_line = trim(str);
+
+            if (!prev_import_line.empty()) {
+                import_line = prev_import_line + import_line;
+                prev_import_line.clear();
+            }
+
+            if (endsWith(import_line, "\\")) {
+                prev_import_line = import_line.substr(0, import_line.find_last_of('\\'));
+                continue;
+            }
+
+            if(startsWith(import_line, "import ")) {
+                for(const string& fileImport: getImportsFromLine(import_line)) {
+                    Import* import = new Import();
+                    import->file_name = Name(fileImport);
+                    import->entire_file = true;
+
+                    script->imports.push_back(import);
+                }
+            } else if (startsWith(import_line, "from ")) {
+                string file = trim(import_line.erase(0, 4));
+                file = file.substr(0, file.find_first_of(" \t"));
+
+                Import* import = new Import();
+                import->file_name = Name(file);
+                import->entire_file = false;
+
+                import_line = trim(import_line);
+                import_line = import_line.substr(import_line.find_first_of(' ') + 1);
+                for(const string& imported_object: getImportsFromLine(import_line)) {
+                    import->imported_content.emplace_back(imported_object);
+                }
+
+                script->imports.push_back(import);
+            }
+        }
+
+        return script;
+    }
+
+    /* The jsoncpp settings reader and writer that the streaming ones replaced, also kept as a baseline. */
+
+    void saveSettings(const vector<File*>& files, const string& file_path) {
+        Json::Value data(Json::arrayValue);
+
+        for (const File* file: files) {
+            Json::Value file_data(Json::objectValue);
+            file_data["name"] = file->file_name.str();
+            file_data["path"] = file->file_path.str();
+            file_data["notes"] = file->notes;
+
+            Json::Value to_dos(Json::arrayValue);
+            for (const ToDo* to_do: file->to_dos) {
+                Json::Value to_do_data(Json::objectValue);
+                to_do_data["content"] = to_do->content;
+                to_do_data["done"] = to_do->done ? 1 : 0;
+                to_dos.append(to_do_data);
+            }
+            file_data["todos"] = to_dos;
+
+            data.append(file_data);
+        }
+
+        std::ofstream output_file_stream(file_path);
+        output_file_stream << data;
+    }
+
+    vector<File*> readSettings(const string& file_path, GraphArena& arena) {
+        std::ifstream input_file_stream(file_path);
+        std::stringstream buffer;
+        buffer << input_file_stream.rdbuf();
+        std::string json_string = buffer.str();
+
+        Json::Value data;
+        Json::CharReaderBuilder builder;
+        std::unique_ptr<Json::CharReader> reader(builder.newCharReader());
+        reader->parse(json_string.c_str(), json_string.c_str() + json_string.size(), &data, nullptr);
+
+        vector<File*> files;
+        for (const Json::Value& file_data: data) {
+            File* file = arena.files.create();
+            file->file_name = Name(file_data["name"].asString());
+            file->file_path = Name(file_data["path"].asString());
+            file->notes = file_data["notes"].asString();
+
+            for (const Json::Value& to_do_data: file_data["todos"]) {
+                ToDo* to_do = arena.to_dos.create();
+                to_do->content = to_do_data["content"].asString();
+                to_do->done = to_do_data["done"].asBool();
+                file->to_dos.push_back(to_do);
+            }
+
+            files.push_back(file);
+        }
+
+        return files;
+    }
+}
+
+struct ImportCase {
+    const char* source;
+    const char* expected;  // "module" for full imports, "module:a,b" for partial ones, separated by spaces.
+};
+
+const ImportCase import_corpus[] = {
+    {"import os", "os"},
+    {"import os, sys", "os sys"},
+    {"import os.path as osp, sys", "os.path sys"},
+    {"import   a . b", "a.b"},
+    {"from time import sleep, perf_counter", "time:sleep,perf_counter"},
+    {"from time import sleep as s, perf_counter as p", "time:sleep,perf_counter"},
+    {"from x import *", "x:*"},
+    {"from . import a", ".:a"},
+    {"from .import a", ".:a"},
+    {"from ..pkg.mod import b", "..pkg.mod:b"},
+    {"from x import (a,\n    b as c,  # comment\n    d,\n)", "x:a,b,d"},
+    {"import a, \\\n    b", "a b"},
+    {"from x \\\n    import y", "x:y"},
+    {"import a; import b", "a b"},
+    {"import a  # import b", "a"},
+    {"def f():\n    import a\n    return 1", "a"},
+    {"try: import a\nexcept ImportError: a = None", "a"},
+    {"'''\nimport a\n'''\nimport b", "b"},
+    {"x = \"import a\"\nimport b", "b"},
+    {"x = r'\\'' \nimport b", "b"},
+    {"s = \"unterminated\nimport b", "b"},
+    {"print(\n    'x',\n    import_me)\nimport b", "b"},
+    {"important = 1\nfromage = 2\nimport_a = 3", ""},
+    {"def g():\n    yield from x", ""},
+    {"x = (1,\n     2)\nfrom y import z", "y:z"},
+    {"import a\r\nimport b\r\n", "a b"},
+    {"from __future__ import annotations", "__future__:annotations"},
+};
+
+const ImportCase header_corpus[] = {  // ScanMode::Header, parsing stops at the first top level definition.
+    {"import a\ndef f():\n    import b\nimport c", "a"},
+    {"import a\n@decorator\ndef f(): pass\nimport b", "a"},
+    {"import a\nclass A:\n    import b", "a"},
+    {"import a\nasync def f(): pass\nimport b", "a"},
+    {"if x:\n    def f(): pass\nimport b", "b"},
+    {"x = [\n@y]\nimport b", "b"},
+    {"\"\"\"\ndef f(): pass\n\"\"\"\nimport b", "b"},
+    {"define = 1\nclassic = 2\nimport b", "b"},
+};
+
+const ImportCase symbol_corpus[] = {  // The top level definitions, then "__all__:" and what it lists if there is one.
+    {"def f(): pass\nclass A:\n    x = 1\nasync def g(): pass", "f A g"},
+    {"x = 1\ny: int = 2\na, b = 1, 2\nz == 3\nw += 1", "x y a b"},
+    {"x = 1; y = 2\nx = y = 3", "x y x"},
+    {"if x: y = 1\nelse: y = 2", "y y"},
+    {"def f(): x = 1\nclass B: y = 2\nz = 3", "f B z"},
+    {"obj.attr = 1\nd[k] = 2\nprint(x)\nfor i in range(3): pass", ""},
+    {"try:\n    import a\nexcept ImportError:\n    a = None", ""},
+    {"match = 1\ntype = 2\nr = 3", "match type r"},
+    {"f(a=1,\n  b=2)\nx = {\n  c: 1}", "x"},
+    {"__all__ = ['a', \"b\"]\n__all__ += ['c']", "__all__:a,b,c"},
+    {"__all__ = (\n    'a',  # comment\n    'b',\n)\nx = 1", "x __all__:a,b"},
+    {"__all__ = [name for name in dir()]\ny = 1", "y"},
+    {"__all__ = []", "__all__:"},
+};
+
+string describeImports(const File* file) {
+    string description;
+
+    for (const Import* import: file->imports) {
+        if (!description.empty()) description += ' ';
+        description += import->file_name.view();
+
+        if (!import->entire_file) {
+            description += ':';
+            for (size_t i = 0; i < import->imported_content.size(); i++) {
+                description += (i == 0 ? "" : ",") + import->imported_content[i].str();
+            }
+        }
+    }
+
+    return description;
+}
+
+string describeSymbols(const File* file) {
+    string description;
+
+    for (Name definition: file->symbols.definitions) {
+        description += (description.empty() ? "" : " ") + definition.str();
+    }
+
+    if (file->symbols.has_exports) {
+        description += (description.empty() ? "" : " ") + string("__all__:");
+        for (size_t i = 0; i < file->symbols.exports.size(); i++) {
+            description += (i == 0 ? "" : ",") + file->symbols.exports[i].str();
+        }
+    }
+
+    return description;
+}
+
+template<size_t N>
+bool checkImportCases(const ImportCase (&cases)[N], ScanMode mode, string (*describe)(const File*) = describeImports) {
+    bool passed = true;
+
+    for (const ImportCase& import_case: cases) {
+        GraphArena arena;
+        File file;
+        parseImports(import_case.source, &file, arena, mode);
+
+        string result = describe(&file);
+        if (result != import_case.expected) {
+            std::cout << "Import corpus mismatch for:\n" << import_case.source << "\n\texpected: '"
+                      << import_case.expected << "', got: '" << result << "'\n";
+            passed = false;
+        }
+    }
+
+    return passed;
+}
+
+bool checkImportCorpus() {
+    /* Runs the import lexer over a corpus of tricky import forms, returns whether all of them parse as expected. */
+
+    bool passed = checkImportCases(import_corpus, ScanMode::Full);
+    passed &= checkImportCases(header_corpus, ScanMode::Header);
+    passed &= checkImportCases(symbol_corpus, ScanMode::Full, describeSymbols);
+
+    std::cout << "Import corpus: " << (passed ? "passed" : "FAILED") << '\n';
+    return passed;
+}
+
+bool checkReopenedProject() {
+    /* Opens a small project, then reopens it from its JSON settings and from a snapshot. Returns whether every file
+     * comes back with the same imports and symbols either way. */
+
+    fs::path folder = fs::temp_directory_path() / "pypeline_reopen_check";
+    fs::remove_all(folder);
+    fs::create_directories(folder / "pkg");
+
+    std::ofstream(folder / "pkg" / "__init__.py") << "from .lib import *\n__all__ = ['f', 'C']\n";
+    std::ofstream(folder / "pkg" / "lib.py") << "import os\ndef f(): pass\nclass C:\n    x = 1\nY = 2\n";
+    std::ofstream(folder / "app.py") << "from pkg import *\nfrom pkg.lib import f, Y\nz = f()\n";
+
+    std::unique_ptr<Project> project = openNewProject(folder.generic_string(), 1);
+    ImportLayers layers = computeImportLevels(project->files);
+    for (File* file: project->files) {
+        if (file->file_name.view() == "app") file->notes = "Kept";
+    }
+
+    string json_path = (folder / "project.json").generic_string();
+    string snapshot_path = getSnapshotPath(folder.generic_string());
+    saveDataToJSON(project->files, json_path);
+    saveSnapshot(*project, layers, GraphLayout(), snapshot_path);
+
+    auto describe = [](const Project& opened) {
+        std::map<string, string> descriptions;  // By module.
+        for (const File* file: opened.files) {
+            descriptions[file->file_name.str()] = describeImports(file) + " | " + describeSymbols(file);
+        }
+        return descriptions;
+    };
+
+    std::map<string, string> expected = describe(*project);
+    bool passed = expected["app"] == "pkg:* pkg.lib:f,Y | z";
+    passed &= describe(*loadDataFromJSON(json_path, project->scan_mode)) == expected;
+    passed &= describe(*loadSnapshot(snapshot_path)) == expected;
+
+    std::ofstream(folder / "added.py") << "import app\n";  // Opening the folder again keeps its notes and rescans.
+    std::unique_ptr<Project> reopened = openProject(folder.generic_string());
+    for (const File* file: reopened->files) {
+        if (file->file_name.view() == "app") passed &= file->notes == "Kept";
+    }
+    passed &= reopened->files.size() == project->files.size() + 1;
+
+    fs::remove_all(folder);
+
+    std::cout << "Reopened projects: " << (passed ? "passed" : "FAILED") << '\n';
+    return passed;
+}
+
+bool checkJournalReplay() {
+    /* Two source roots with a module of the same name, an edit to the second one is recovered into that one.
+     * Returns whether it is, and whether reverting drops it again. */
+
+    fs::path folder = fs::temp_directory_path() / "pypeline_journal_check";
+    fs::remove_all(folder);
+    fs::create_directories(folder / "src");
+    fs::create_directories(folder / "tests");
+
+    std::ofstream(folder / "src" / "util.py") << "import os\n";
+    std::ofstream(folder / "tests" / "util.py") << "import sys\n";
+
+    string journal_path = getJournalPath(getSnapshotPath(folder.generic_string()));
+    auto findFile = [](const Project& project, const string& folder_name) -> File* {
+        for (File* file: project.files) {
+            if (file->file_path.str().find("/" + folder_name + "/") != string::npos) return file;
+        }
+        return nullptr;
+    };
+
+    std::unique_ptr<Project> project = openNewProject(folder.generic_string(), 1);
+    {
+        EditJournal journal(journal_path, project->path);
+        File* file = findFile(*project, "tests");
+        file->notes = "Recovered";
+        journal.recordNotes(*file);
+    }
+
+    std::unique_ptr<Project> reopened = openNewProject(folder.generic_string(), 1);
+    EditHistory history(*reopened);
+    vector<File*> recovered_files = replayJournal(*reopened, journal_path);
+    for (File* file: recovered_files) {
+        history.recordEdit(file, EditKind::ToDos);
+    }
+
+    bool passed = recovered_files.size() == 1 && findFile(*reopened, "tests")->notes == "Recovered" &&
+                  findFile(*reopened, "src")->notes.empty();
+    history.revertAll();
+    passed &= findFile(*reopened, "tests")->notes.empty();
+
+    fs::remove_all(folder);
+
+    std::cout << "Journal replay: " << (passed ? "passed" : "FAILED") << '\n';
+    return passed;
+}
+
+bool checkWatchedChanges() {
+    /* Files that show up in ignored places while a project is open, like a new virtual environment, stay out of it
+     * just like they would on a fresh open. Returns whether only the file that isn't ignored is added. */
+
+    fs::path folder = fs::temp_directory_path() / "pypeline_watch_check";
+    fs::remove_all(folder);
+    fs::create_directories(folder / "pkg");
+
+    std::ofstream(folder / ".gitignore") << "build/\nscratch.py\n";
+    std::ofstream(folder / "app.py") << "import pkg\n";
+    std::ofstream(folder / "pkg" / "__init__.py") << "";
+
+    std::unique_ptr<Project> project = openNewProject(folder.generic_string(), 1);
+    size_t file_count = project->files.size();
+
+    fs::create_directories(folder / "build" / "lib");
+    fs::create_directories(folder / "pkg" / "env" / "lib");
+    fs::create_directories(folder / "pkg" / "sub");
+    std::ofstream(folder / "build" / "lib" / "generated.py") << "import os\n";
+    std::ofstream(folder / "pkg" / "env" / "pyvenv.cfg") << "home = /usr/bin\n";
+    std::ofstream(folder / "pkg" / "env" / "lib" / "third_party.py") << "import os\n";
+    std::ofstream(folder / "pkg" / "sub" / "__init__.py") << "";
+    std::ofstream(folder / "scratch.py") << "import app\n";
+
+    vector<string> changed_paths;
+    for (const char* path: {"build", "pkg/env", "pkg/env/lib/third_party.py", "pkg/sub", "scratch.py"}) {
+        changed_paths.push_back((folder / path).generic_string());
+    }
+    updateProjectFiles(*project, changed_paths, 1);
+
+    bool passed = project->files.size() == file_count + 1 &&
+                  std::any_of(project->files.begin(), project->files.end(),
+                              [](const File* file) { return file->file_name.view() == "pkg.sub"; });
+
+    fs::remove_all(folder);
+
+    std::cout << "Watched changes: " << (passed ? "passed" : "FAILED") << '\n';
+    return passed;
+}
+
+bool checkReusedObjects() {
+    /* Updating a file, rescanning and undoing a todo edit over and over replaces the same imports and todos every
+     * time. Returns whether the arena of the project stops growing. */
+
+    fs::path folder = fs::temp_directory_path() / "pypeline_arena_check";
+    fs::remove_all(folder);
+    fs::create_directories(folder);
+
+    string app_path = (folder / "app.py").generic_string();
+    std::ofstream(app_path) << "import lib\n";
+    std::ofstream(folder / "lib.py") << "import os\n";
+
+    std::unique_ptr<Project> project = openNewProject(folder.generic_string(), 1);
+    EditHistory history(*project);
+
+    for (File* file: project->files) {
+        if (file->file_name.view() != "app") continue;
+
+        file->to_dos.push_back(project->arena.to_dos.create(ToDo{false, "Check"}));
+        history.recordEdit(file, EditKind::ToDos);
+    }
+
+    auto editAgain = [&](int round) {
+        std::ofstream(app_path) << "import lib, sys\nx = " << round << "\n";
+        updateProjectFiles(*project, {app_path}, 1);
+
+        std::ofstream(app_path) << "import lib\ny = " << round << "\n";
+        rescanProject(*project, 1);
+
+        history.undo();
+        history.redo();
+    };
+
+    auto getSizes = [&project]() {
+        const GraphArena& arena = project->arena;
+        return vector<size_t>{arena.files.size(), arena.imports.size(), arena.to_dos.size()};
+    };
+
+    editAgain(0);
+    vector<size_t> sizes = getSizes();
+    for (int round = 1; round < 50; round++) {
+        editAgain(round);
+    }
+    bool passed = getSizes() == sizes;
+
+    fs::remove_all(folder);
+
+    std::cout << "Reused objects: " << (passed ? "passed" : "FAILED") << '\n';
+    return passed;
+}
+
+string createSyntheticProject(int file_count) {
+    /* Writes a flat folder of python files that import each other, and returns its path.
+     * Every file has a handful of project and stdlib imports followed by some filler code. */
+
+    fs::path folder = fs::temp_directory_path() / ("pypeline_bench_" + std::to_string(file_count));
+    fs::remove_all(folder);
+    fs::create_directories(folder);
+
+    for (int i = 0; i < file_count; i++) {
+        std::ofstream out(folder / ("module" + std::to_string(i) + ".py"));
+
+        out << "import os, sys\n";
+        out << "from typing import List, Optional\n";
+        for (int j = 1; j <= 3 && i - j >= 0; j++) {
+            out << "import module" << i - j << "\n";
+        }
+        out << "from module" << i / 2 << " import a, b as c, \\\n    d\n\n";
+
+        for (int j = 0; j < 40; j++) {
+            out << "def function_" << j << "(x):\n";
+            out << "    return x * " << j << "  # Some filler code.\n\n";
+        }
+    }
+
+    return folder.generic_string();
+}
+
+void benchmarkScan(int file_count) {
+    string folder = createSyntheticProject(file_count);
+    vector<string> file_paths = getFilePaths(folder);
+
+    vector<unsigned> thread_counts = {1, 2, 4};
+    unsigned core_count = std::max(1u, std::thread::hardware_concurrency());
+    if (core_count != 1 && core_count != 2 && core_count != 4) {
+        thread_counts.push_back(core_count);
+    }
+
+    std::cout << "Scanning " << file_paths.size() << " files (" << core_count << " cores).\n";
+    for (unsigned thread_count: thread_counts) {
+        GraphArena arena;
+
+        Clock::time_point start = Clock::now();
+        vector<File*> files = scanFiles(folder, file_paths, arena, thread_count);
+        double seconds = secondsSince(start);
+
+        std::cout << '\t' << thread_count << " thread(s): " << (size_t) (files.size() / seconds) << " files/sec\n";
+    }
+
+    fs::remove_all(folder);
+}
+
+void benchmarkParser(int file_count) {
+    /* Compares the import lexer against the regex parser it replaced, on the same files. */
+
+    string folder = createSyntheticProject(file_count);
+    vector<string> file_paths = getFilePaths(folder);
+
+    Clock::time_point start = Clock::now();
+    for (const string& file_path: file_paths) {
+        legacy::getImports(file_path);
+    }
+    double regex_seconds = secondsSince(start);
+
+    GraphArena arena;
+
+    start = Clock::now();
+    for (const string& file_path: file_paths) {
+        getImports(file_path, arena);
+    }
+    double lexer_seconds = secondsSince(start);
+
+    std::cout << "Parsing " << file_paths.size() << " files:\n";
+    std::cout << "\tregex: " << (size_t) (file_paths.size() / regex_seconds) << " files/sec\n";
+    std::cout << "\tlexer: " << (size_t) (file_paths.size() / lexer_seconds) << " files/sec ("
+              << regex_seconds / lexer_seconds << "x)\n";
+
+    fs::remove_all(folder);
+}
+
+void benchmarkReader(int file_count) {
+    /* Reading through an ifstream versus into a reused buffer, and parsing whole files versus only their import header.
+     * The generated modules are long so that the body dominates, like most real code. */
+
+    fs::path folder = fs::temp_directory_path() / "pypeline_bench_reader";
+    fs::remove_all(folder);
+    fs::create_directories(folder);
+
+    for (int i = 0; i < file_count; i++) {
+        std::ofstream out(folder / ("module" + std::to_string(i) + ".py"));
+
+        out << "import os, sys\nfrom typing import List\nimport module" << (i + 1) % file_count << "\n\n";
+        for (int j = 0; j < 500; j++) {
+            out << "def function_" << j << "(x):\n    return x * " << j << "  # Filler filler filler filler.\n\n";
+        }
+    }
+
+    vector<string> file_paths = getFilePaths(folder.generic_string());
+
+    Clock::time_point start = Clock::now();
+    size_t copied_bytes = 0;
+    for (const string& file_path: file_paths) {
+        std::ifstream in_stream(file_path, std::ios::binary);
+        string source((std::istreambuf_iterator<char>(in_stream)), std::istreambuf_iterator<char>());
+        copied_bytes += source.size();
+
+        GraphArena arena;
+        File file;
+        parseImports(source, &file, arena, ScanMode::Full);
+    }
+    double copy_seconds = secondsSince(start);
+
+    std::cout << "Reading " << file_paths.size() << " files (" << copied_bytes / 1024 << " KiB):\n";
+    std::cout << "\tifstream, full: " << copy_seconds * 1000 << " ms\n";
+
+    for (ScanMode mode: {ScanMode::Full, ScanMode::Header}) {
+        GraphArena arena;
+
+        start = Clock::now();
+        for (const string& file_path: file_paths) {
+            getImports(file_path, arena, mode);
+        }
+        double seconds = secondsSince(start);
+
+        std::cout << "\tpread, " << (mode == ScanMode::Full ? "full: " : "header: ") << seconds * 1000 << " ms ("
+                  << copy_seconds / seconds << "x)\n";
+    }
+
+    fs::remove_all(folder);
+}
+
+vector<File*> createSyntheticModules(int module_count, int fan_out, GraphArena& arena, bool acyclic = false) {
+    /* In memory modules spread over packages of 100, each importing fan_out other modules and a few stdlib ones.
+     * Acyclic modules only import modules a little further down the list. */
+
+    vector<File*> files;
+    files.reserve(module_count);
+
+    for (int i = 0; i < module_count; i++) {
+        File* file = arena.files.create();
+        file->file_name = Name("package" + std::to_string(i / 100) + ".module" + std::to_string(i));
+
+        for (int j = 1; j <= fan_out; j++) {
+            int imported = (int) ((i * 7919LL + j * 104729LL) % module_count);
+            if (acyclic) {
+                int span = std::min(module_count - i - 1, 200);
+                if (span == 0) break;
+                imported = i + 1 + imported % span;
+            }
+
+            Import* import = arena.imports.create();
+            import->file_name = Name("package" + std::to_string(imported / 100) + ".module" + std::to_string(imported));
+            import->entire_file = true;
+            file->imports.push_back(import);
+        }
+
+        for (const char* stdlib: {"os", "sys", "typing"}) {
+            Import* import = arena.imports.create();
+            import->file_name = Name(stdlib);
+            import->entire_file = true;
+            file->imports.push_back(import);
+        }
+
+        files.push_back(file);
+    }
+
+    return files;
+}
+
+void benchmarkLinking() {
+    /* Time per import should stay flat as the project grows. */
+
+    std::cout << "Linking imports:\n";
+    for (int module_count: {1000, 10000, 100000}) {
+        GraphArena arena;
+        vector<File*> files = createSyntheticModules(module_count, 5, arena);
+
+        Clock::time_point start = Clock::now();
+        sortImports(files);
+        double seconds = secondsSince(start);
+
+        size_t import_count = module_count * 8;
+        std::cout << '\t' << module_count << " modules: " << seconds * 1000 << " ms, "
+                  << seconds * 1e9 / import_count << " ns/import\n";
+    }
+}
+
+void benchmarkNames() {
+    /* Module names held as a string each, as they used to be, against an id each plus one copy in the name table.
+     * Strings up to 15 characters fit in the string itself (libstdc++), longer ones take a heap block too. */
+
+    auto stringBytes = [](Name name) {
+        return sizeof(string) + (name.str().size() > 15 ? name.str().size() + 1 : 0);
+    };
+
+    std::cout << "Interned names:\n";
+    for (int module_count: {1000, 10000, 100000}) {
+        GraphArena arena;
+        vector<File*> files = createSyntheticModules(module_count, 5, arena);
+
+        size_t reference_count = 0, string_bytes = 0, table_bytes = 0;
+        std::unordered_set<Name> distinct_names;
+        auto count = [&](Name name) {
+            reference_count++;
+            string_bytes += stringBytes(name);
+            if (distinct_names.insert(name).second) {
+                table_bytes += stringBytes(name) + 48;  // About what the shard map needs per entry.
+            }
+        };
+        for (const File* file: files) {
+            count(file->file_name);
+            for (const Import* import: file->imports) count(import->file_name);
+        }
+
+        size_t name_bytes = reference_count * sizeof(Name) + table_bytes;
+        std::cout << '\t' << module_count << " modules: " << reference_count << " names, " << distinct_names.size()
+                  << " distinct, strings " << string_bytes / 1024 << " KiB, interned " << name_bytes / 1024
+                  << " KiB (" << (double) string_bytes / name_bytes << "x)\n";
+    }
+}
+
+void benchmarkLayering() {
+    std::cout << "Layering imports:\n";
+    for (int module_count: {1000, 10000, 100000}) {
+        GraphArena arena;
+        vector<File*> files = createSyntheticModules(module_count, 5, arena);
+        sortImports(files);
+
+        Clock::time_point start = Clock::now();
+        ImportLayers layers = computeImportLevels(files);
+        double seconds = secondsSince(start);
+
+        std::cout << '\t' << module_count << " modules: " << seconds * 1000 << " ms, "
+                  << layers.cycles.size() << " cycle(s)\n";
+    }
+}
+
+void benchmarkLayout() {
+    /* A full layout, then the layout after one file lost an import, which should only redo a few layers. */
+
+    std::cout << "Laying out imports:\n";
+    for (int module_count: {1000, 10000, 100000}) {
+        GraphArena arena;
+        vector<File*> files = createSyntheticModules(module_count, 5, arena, true);
+        sortImports(files);
+        LayoutGraph graph = getLayoutGraph(files, computeImportLevels(files));
+
+        LayeredLayout layered_layout;
+
+        Clock::time_point start = Clock::now();
+        GraphLayout layout = layered_layout.compute(graph);
+        double full_seconds = secondsSince(start);
+        size_t layer_count = layout.relaid_layers;
+
+        size_t edited = module_count / 2;
+        if (!graph.imports[edited].empty()) graph.imports[edited].pop_back();
+
+        start = Clock::now();
+        layout = layered_layout.compute(graph);
+        double incremental_seconds = secondsSince(start);
+
+        std::cout << '\t' << module_count << " modules: " << full_seconds * 1000 << " ms (" << layer_count
+                  << " layers), one edit: " << incremental_seconds * 1000 << " ms (" << layout.relaid_layers
+                  << " layers)\n";
+    }
+}
+
+void benchmarkForceLayout() {
+    std::cout << "Force directed layout:\n";
+    for (int module_count: {1000, 10000, 100000}) {
+        GraphArena arena;
+        vector<File*> files = createSyntheticModules(module_count, 5, arena);
+        sortImports(files);
+        LayoutGraph graph = getLayoutGraph(files, computeImportLevels(files));
+
+        ForceLayout force_layout(graph);
+        int steps = std::max(3, 100000 / module_count);
+
+        Clock::time_point start = Clock::now();
+        for (int i = 0; i < steps; i++) {
+            force_layout.step();
+        }
+        double seconds = secondsSince(start);
+
+        std::cout << '\t' << module_count << " modules: " << steps / seconds << " iterations/sec\n";
+    }
+}
+
+size_t getResidentMemory() {
+    /* In KiB, Linux only. */
+
+    std::ifstream statm("/proc/self/statm");
+    size_t total_pages = 0, resident_pages = 0;
+    statm >> total_pages >> resident_pages;
+
+    return resident_pages * 4;
+}
+
+void benchmarkReopen(int file_count) {
+    /* Memory should stay flat when the same project is opened over and over. */
+
+    string folder = createSyntheticProject(file_count);
+
+    std::unique_ptr<Project> project = openNewProject(folder);
+    size_t first_memory = getResidentMemory();
+
+    for (int i = 0; i < 100; i++) {
+        project = openNewProject(folder);
+    }
+
+    std::cout << "Reopening " << file_count << " files 100 times: " << first_memory << " KiB -> "
+              << getResidentMemory() << " KiB resident\n";
+
+    fs::remove_all(folder);
+}
+
+void benchmarkSnapshot(int file_count) {
+    /* Reopening a saved project from JSON (which looks every file up in the parse cache and relinks them) against
+     * mapping a snapshot, then snapshots of projects too big to keep on disk here. */
+
+    string folder = createSyntheticProject(file_count);
+    std::unique_ptr<Project> project = openNewProject(folder);
+    ImportLayers layers = computeImportLevels(project->files);
+
+    string json_path = (fs::path(folder) / "project.json").generic_string();
+    string snapshot_path = getSnapshotPath(folder);
+    saveDataToJSON(project->files, json_path);
+    saveSnapshot(*project, layers, GraphLayout(), snapshot_path);
+
+    Clock::time_point start = Clock::now();
+    std::unique_ptr<Project> reopened = loadDataFromJSON(json_path);
+    double json_seconds = secondsSince(start);
+
+    start = Clock::now();
+    reopened = loadSnapshot(snapshot_path);
+    double snapshot_seconds = secondsSince(start);
+
+    std::cout << "Reopening " << file_count << " files: JSON " << json_seconds * 1000 << " ms, snapshot "
+              << snapshot_seconds * 1000 << " ms\n";
+
+    fs::remove_all(folder);
+
+    std::cout << "Reopening snapshots:\n";
+    for (int module_count: {1000, 10000, 50000}) {
+        Project synthetic;
+        synthetic.files = createSyntheticModules(module_count, 5, synthetic.arena);
+        sortImports(synthetic.files);
+        ImportLayers synthetic_layers = computeImportLevels(synthetic.files);
+
+        string path = (fs::temp_directory_path() / "pypeline_bench.snapshot").generic_string();
+        saveSnapshot(synthetic, synthetic_layers, GraphLayout(), path);
+
+        start = Clock::now();
+        reopened = loadSnapshot(path);
+        double seconds = secondsSince(start);
+
+        std::cout << '\t' << module_count << " modules: " << seconds * 1000 << " ms, "
+                  << fs::file_size(path) / 1024 << " KiB\n";
+        fs::remove(path);
+    }
+}
+
+struct Measurement {
+    double seconds = 0;
+    long peak_memory = 0;  // KiB the peak resident memory grew by, 0 where it can't be measured.
+};
+
+template<class Run>
+Measurement measure(Run run) {
+    /* Runs in a child process of its own where there are any, so every run starts from the same peak memory. */
+
+#ifdef _WIN32
+    Clock::time_point start = Clock::now();
+    run();
+    return {secondsSince(start), 0};
+#else
+    int result_pipe[2];
+    if (pipe(result_pipe) != 0) return {};
+
+    pid_t child = fork();
+    if (child == 0) {
+        rusage usage{};
+        getrusage(RUSAGE_SELF, &usage);
+        long start_memory = usage.ru_maxrss;
+
+        Clock::time_point start = Clock::now();
+        run();
+
+        Measurement measurement;
+        measurement.seconds = secondsSince(start);
+        getrusage(RUSAGE_SELF, &usage);
+        measurement.peak_memory = usage.ru_maxrss - start_memory;
+
+        write(result_pipe[1], &measurement, sizeof(measurement));
+        _exit(0);
+    }
+
+    Measurement measurement;
+    close(result_pipe[1]);
+    if (read(result_pipe[0], &measurement, sizeof(measurement)) != sizeof(measurement)) measurement = {};
+    close(result_pipe[0]);
+    waitpid(child, nullptr, 0);
+
+    return measurement;
+#endif
+}
+
+void benchmarkSettings(int file_count) {
+    /* Settings with about 1 KiB of notes and two todos per file, 100 MB at 100k files. */
+
+    Project project;
+    for (int i = 0; i < file_count; i++) {
+        File* file = project.arena.files.create();
+        file->file_name = Name("package" + std::to_string(i / 100) + ".module" + std::to_string(i));
+        file->file_path = Name("/project/package" + std::to_string(i / 100) + "/module" + std::to_string(i) + ".py");
+        for (int j = 0; j < 16; j++) {
+            file->notes += "Line " + std::to_string(j) + " of the notes, with \"quotes\" and a tab\tin it.\n";
+        }
+        file->notes.resize(1000, '.');
+
+        for (bool done: {false, true}) {
+            ToDo* to_do = project.arena.to_dos.create();
+            to_do->content = "Something to do about module " + std::to_string(i);
+            to_do->done = done;
+            file->to_dos.push_back(to_do);
+        }
+
+        project.files.push_back(file);
+    }
+
+    string path = (fs::temp_directory_path() / "pypeline_bench_settings.json").generic_string();
+
+    Measurement streaming_save = measure([&]() { saveDataToJSON(project.files, path); });
+    Measurement streaming_load = measure([&]() {
+        GraphArena arena;
+        readSettings(path, arena);
+    });
+    size_t file_size = fs::file_size(path);
+
+    Measurement dom_save = measure([&]() { legacy::saveSettings(project.files, path); });
+    Measurement dom_load = measure([&]() {
+        GraphArena arena;
+        legacy::readSettings(path, arena);
+    });
+
+    auto print = [](const char* name, const Measurement& measurement) {
+        std::cout << '\t' << name << ": " << measurement.seconds * 1000 << " ms, peak memory +"
+                  << measurement.peak_memory / 1024 << " MiB\n";
+    };
+
+    std::cout << "Settings of " << file_count << " files (" << file_size / (1024 * 1024) << " MiB):\n";
+    print("Streaming save", streaming_save);
+    print("jsoncpp save  ", dom_save);
+    print("Streaming load", streaming_load);
+    print("jsoncpp load  ", dom_load);
+
+    fs::remove(path);
+}
+
+void benchmarkJournal() {
+    /* What an edit to the notes of one file costs, recorded in the journal (until it's synced to disk) against saving
+     * the whole project. Only the second should grow with the project. */
+
+    std::cout << "Saving an edit:\n";
+    for (int module_count: {1000, 10000, 100000}) {
+        Project project;
+        project.files = createSyntheticModules(module_count, 5, project.arena);
+        sortImports(project.files);
+        ImportLayers layers = computeImportLevels(project.files);
+
+        string snapshot_path = (fs::temp_directory_path() / "pypeline_bench.snapshot").generic_string();
+        string journal_path = getJournalPath(snapshot_path);
+        fs::remove(journal_path);
+
+        const int edit_count = 100;
+        File* file = project.files[module_count / 2];
+
+        Clock::time_point start = Clock::now();
+        {
+            EditJournal journal(journal_path);
+            for (int i = 0; i < edit_count; i++) {
+                file->notes += "A few more words. ";
+                journal.recordNotes(*file);
+            }
+        }
+        double journal_seconds = secondsSince(start) / edit_count;
+
+        start = Clock::now();
+        saveSnapshot(project, layers, GraphLayout(), snapshot_path);
+        double snapshot_seconds = secondsSince(start);
+
+        std::cout << '\t' << module_count << " modules: journal " << journal_seconds * 1000 << " ms/edit, snapshot "
+                  << snapshot_seconds * 1000 << " ms\n";
+
+        fs::remove(snapshot_path);
+        fs::remove(journal_path);
+    }
+}
+
+void benchmarkHistory() {
+    /* Every edit keeps a version of the whole project, what one costs shouldn't depend on the size of the project. */
+
+    std::cout << "Edit history:\n";
+    for (int module_count: {1000, 10000, 100000}) {
+        Project project;
+        project.files = createSyntheticModules(module_count, 5, project.arena);
+        EditHistory history(project);
+
+        const int edit_count = 10000;
+
+        Clock::time_point start = Clock::now();
+        for (int i = 0; i < edit_count; i++) {
+            File* file = project.files[(i * 7919LL) % module_count];
+            file->notes = "Edit " + std::to_string(i);
+            history.recordEdit(file, EditKind::ToDos);  // Not merged like typing into the notes would be.
+        }
+        double edit_seconds = secondsSince(start);
+
+        start = Clock::now();
+        size_t reverted_count = history.revertAll().size();
+        double revert_seconds = secondsSince(start);
+
+        std::cout << '\t' << module_count << " modules: " << edit_seconds * 1e6 / edit_count << " us/edit, revert all ("
+                  << reverted_count << " files) " << revert_seconds * 1000 << " ms\n";
+    }
+}
+
+void benchmarkQueries() {
+    /* The first question about a file walks what it reaches, asking again is a lookup. */
+
+    std::cout << "Dependency queries:\n";
+    for (int module_count: {1000, 10000, 50000}) {
+        GraphArena arena;
+        vector<File*> files = createSyntheticModules(module_count, 5, arena, true);
+        sortImports(files);
+
+        Clock::time_point start = Clock::now();
+        DependencyIndex index(files);
+        double index_seconds = secondsSince(start);
+
+        const int query_count = 1000;
+        size_t found_count = 0;
+
+        start = Clock::now();
+        for (int i = 0; i < query_count; i++) {
+            found_count += index.getDependents(files[(i * 7919LL) % module_count]).size();
+        }
+        double first_seconds = secondsSince(start);
+
+        start = Clock::now();
+        for (int i = 0; i < query_count; i++) {
+            const File* from = files[(i * 7919LL) % module_count];
+            const File* to = files[(i * 7919LL + 1000) % module_count];
+            found_count += index.dependsOn(from, to);
+        }
+        double depends_seconds = secondsSince(start);
+
+        start = Clock::now();
+        for (int i = 0; i < query_count; i++) {
+            const File* from = files[(i * 7919LL) % module_count];
+            const File* to = files[std::min((i * 7919LL) % module_count + 500, (long long) module_count - 1)];
+            found_count += index.getImportPath(from, to).size();
+        }
+        double path_seconds = secondsSince(start);
+
+        start = Clock::now();
+        for (int i = 0; i < query_count; i++) {
+            found_count += index.getDependents(files[(i % 100 * 7919LL) % module_count]).size();  // Cached.
+        }
+        double repeat_seconds = secondsSince(start);
+
+        std::cout << '\t' << module_count << " modules: index " << index_seconds * 1000 << " ms, dependents "
+                  << first_seconds * 1e6 / query_count << " us, depends on " << depends_seconds * 1e6 / query_count
+                  << " us, path " << path_seconds * 1e6 / query_count << " us, dependents again "
+                  << repeat_seconds * 1e6 / query_count << " us (" << found_count << " found)\n";
+    }
+}
+
+void benchmarkSymbols() {
+    /* Modules that define 20 names each and import 3 of them from each of 5 other modules, every 10th re-exports
+     * everything it imports with a star. The index should cost a fraction of what scanning the files did. */
+
+    std::cout << "Symbol index:\n";
+    for (int module_count: {1000, 10000, 100000}) {
+        GraphArena arena;
+        vector<File*> files = createSyntheticModules(module_count, 5, arena);
+
+        for (int i = 0; i < module_count; i++) {
+            File* file = files[i];
+            for (int d = 0; d < 20; d++) {
+                file->symbols.definitions.emplace_back("name" + std::to_string(d));
+            }
+
+            for (Import* import: file->imports) {
+                if (!startsWith(import->file_name.str(), "package")) continue;
+
+                import->entire_file = false;
+                if (i % 10 == 0) {
+                    import->imported_content = {Name("*")};
+                } else {
+                    for (int d = 0; d < 3; d++) {
+                        import->imported_content.emplace_back("name" + std::to_string((i + d) % 20));
+                    }
+                }
+            }
+        }
+        sortImports(files);
+
+        Clock::time_point start = Clock::now();
+        SymbolIndex index(files);
+        double seconds = secondsSince(start);
+
+        size_t symbol_count = 0;
+        for (const File* file: files) {
+            for (const Import* import: file->imports) symbol_count += index.getSymbols(import).size();
+        }
+
+        std::cout << '\t' << module_count << " modules: " << seconds * 1000 << " ms, " << module_count / seconds
+                  << " files/sec, " << symbol_count << " imported symbols\n";
+    }
+}
+
+void benchmarkProfiler(int file_count) {
+    /* What a ProfileScope costs with the profiler off and on, and a scan with it on against one without. */
+
+    const int scope_count = 1000000;
+
+    std::cout << "Profiler:\n";
+    for (bool enabled: {false, true}) {
+        setProfiling(enabled);
+
+        Clock::time_point start = Clock::now();
+        for (int i = 0; i < scope_count; i++) {
+            ProfileScope scope("bench scope");
+        }
+        double seconds = secondsSince(start);
+
+        std::cout << '\t' << (enabled ? "on " : "off") << ": " << seconds * 1e9 / scope_count << " ns/scope\n";
+    }
+    setProfiling(false);
+    clearProfile();
+
+    string folder = createSyntheticProject(file_count);
+    vector<string> file_paths = getFilePaths(folder);
+
+    double scan_seconds[2];
+    for (bool enabled: {false, true}) {
+        setProfiling(enabled);
+        GraphArena arena;
+
+        Clock::time_point start = Clock::now();
+        scanFiles(folder, file_paths, arena, 1);
+        scan_seconds[enabled] = secondsSince(start);
+    }
+    setProfiling(false);
+
+    ProfileSummary summary = getProfileSummary();
+    std::cout << "\tScanning " << file_paths.size() << " files: " << scan_seconds[0] * 1000 << " ms, profiled "
+              << scan_seconds[1] * 1000 << " ms (" << summary.counters[(size_t) ProfileCounter::Allocations]
+              << " allocations, " << summary.counters[(size_t) ProfileCounter::BytesRead] / 1024 << " KiB read)\n";
+
+    clearProfile();
+    fs::remove_all(folder);
+}
+
+class RepoShape {  // What generateRepo writes, all of it set from the command line.
+    public:
+        int file_count = 2000;  // Modules, the packages' __init__.py files come on top.
+        int fan_out = 5;  // Project imports per module.
+        double cycle_density = 0.02;  // Share of imports that go to a later module, which closes import loops.
+        int package_depth = 2;  // Packages nested down to the modules, 0 for one flat folder.
+        int line_length = 60;  // Of the code below the imports.
+        int body_lines = 100;
+        unsigned long long seed = 1;
+};
+
+class SplitMix {  // The same numbers everywhere, the <random> distributions differ between standard libraries.
+    public:
+        explicit SplitMix(unsigned long long seed) : state(seed) {}
+
+        unsigned long long next() {
+            unsigned long long z = (state += 0x9E3779B97F4A7C15ULL);
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+            return z ^ (z >> 31);
+        }
+
+        int below(int bound) {
+            return (int) (next() % (unsigned long long) bound);
+        }
+
+        double unit() {
+            return (double) (next() >> 11) / (double) (1ULL << 53);
+        }
+
+    private:
+        unsigned long long state;
+};
+
+string generateRepo(const RepoShape& shape, const fs::path& folder) {
+    /* Writes a python project of the given shape and returns its path. Modules sit 16 to a package, packages 8 to a
+     * parent. Modules mostly import ones shortly before them, in every import style the parser knows, so the graph
+     * is deep like a real one. The same shape and seed always give the same files. */
+
+    const int modules_per_package = 16;
+    const int packages_per_parent = 8;
+
+    fs::remove_all(folder);
+    fs::create_directories(folder);
+
+    SplitMix random(shape.seed);
+
+    auto getPackage = [&](int module) {
+        /* "p0.p3", the dotted package of a module. */
+
+        int package = module / modules_per_package;
+        string name;
+        for (int level = shape.package_depth - 1; level >= 0; level--) {
+            int divisor = 1;
+            for (int i = 0; i < level; i++) divisor *= packages_per_parent;
+
+            int digit = level == shape.package_depth - 1 ? package / divisor : package / divisor % packages_per_parent;
+            name += (name.empty() ? "p" : ".p") + std::to_string(digit);
+        }
+        return name;
+    };
+    auto getModule = [&](int module) {
+        string package = getPackage(module);
+        return (package.empty() ? "m" : package + ".m") + std::to_string(module);
+    };
+
+    string filler(std::max(shape.line_length - 20, 1), 'x');
+
+    for (int i = 0; i < shape.file_count; i++) {
+        string package = getPackage(i);
+        fs::path package_folder = folder;
+        for (size_t start = 0; !package.empty() && start <= package.size();) {
+            size_t end = std::min(package.find('.', start), package.size());
+            package_folder /= package.substr(start, end - start);
+            start = end + 1;
+
+            if (!fs::exists(package_folder / "__init__.py")) {
+                fs::create_directories(package_folder);
+                std::ofstream(package_folder / "__init__.py") << "\"\"\"Generated package.\"\"\"\n";
+            }
+        }
+
+        std::ofstream out(package_folder / ("m" + std::to_string(i) + ".py"));
+        out << "import os, sys\nfrom typing import List, Optional\n";
+
+        for (int j = 0; j < shape.fan_out; j++) {
+            int imported;
+            if (i + 1 < shape.file_count && random.unit() < shape.cycle_density) {
+                imported = i + 1 + random.below(shape.file_count - i - 1);
+            } else if (i > 0) {
+                imported = i - 1 - random.below(std::min(i, 200));
+            } else {
+                continue;
+            }
+
+            string imported_package = getPackage(imported);
+            string name = "m" + std::to_string(imported);
+            switch (random.below(4)) {
+                case 0:
+                    out << "import " << getModule(imported) << '\n';
+                    break;
+                case 1:
+                    if (imported_package.empty()) {
+                        out << "import " << name << '\n';
+                    } else {
+                        out << "from " << imported_package << " import " << name << '\n';
+                    }
+                    break;
+                case 2:
+                    out << "from " << getModule(imported) << " import f0, f1 as alias\n";
+                    break;
+                default:
+                    if (!package.empty() && imported_package == package) {
+                        out << "from ." << name << " import f0\n";
+                    } else {
+                        out << "from " << getModule(imported) << " import (\n    f0,\n    f1,\n)\n";
+                    }
+                    break;
+            }
+        }
+
+        for (int line = 0; line < shape.body_lines; line++) {
+            if (line % 4 == 0) {
+                out << "\ndef f" << line / 4 << "(value):\n";
+            } else {
+                out << "    value = value + \"" << filler << "\"\n";
+            }
+        }
+    }
+
+    return folder.generic_string();
+}
+
+class PipelineOptions {
+    public:
+        RepoShape shape;
+        int runs = 5;
+        unsigned thread_count = 1;  // One by default, so timings don't depend on the machine's core count.
+        ScanMode scan_mode = ScanMode::Header;
+        string json_path;  // "-" for stdout.
+        string baseline_path;
+        double tolerance = 0.2;  // A stage may be this much slower than in the baseline.
+        bool keep = false;
+};
+
+bool parsePipelineOptions(int argc, char** argv, PipelineOptions& options) {
+    /* argv[1] is "pipeline". */
+
+    try {
+        for (int i = 2; i < argc; i++) {
+            string argument = argv[i];
+            if (i + 1 >= argc && argument != "--full" && argument != "--keep") {
+                std::cerr << "Missing value for " << argument << '\n';
+                return false;
+            }
+
+            if (argument == "--files") {
+                options.shape.file_count = std::stoi(argv[++i]);
+            } else if (argument == "--fan-out") {
+                options.shape.fan_out = std::stoi(argv[++i]);
+            } else if (argument == "--cycles") {
+                options.shape.cycle_density = std::stod(argv[++i]);
+            } else if (argument == "--depth") {
+                options.shape.package_depth = std::stoi(argv[++i]);
+            } else if (argument == "--line-length") {
+                options.shape.line_length = std::stoi(argv[++i]);
+            } else if (argument == "--lines") {
+                options.shape.body_lines = std::stoi(argv[++i]);
+            } else if (argument == "--seed") {
+                options.shape.seed = std::stoull(argv[++i]);
+            } else if (argument == "--runs") {
+                options.runs = std::stoi(argv[++i]);
+            } else if (argument == "--threads") {
+                options.thread_count = (unsigned) std::stoul(argv[++i]);
+            } else if (argument == "--json") {
+                options.json_path = argv[++i];
+            } else if (argument == "--baseline") {
+                options.baseline_path = argv[++i];
+            } else if (argument == "--tolerance") {
+                options.tolerance = std::stod(argv[++i]);
+            } else if (argument == "--full") {
+                options.scan_mode = ScanMode::Full;
+            } else if (argument == "--keep") {
+                options.keep = true;
+            } else {
+                std::cerr << "Unknown argument: " << argument << '\n';
+                return false;
+            }
+        }
+    } catch (const std::logic_error&) {  // From stoi and friends.
+        std::cerr << "Invalid number\n";
+        return false;
+    }
+
+    const RepoShape& shape = options.shape;
+    return shape.file_count > 0 && shape.fan_out >= 0 && shape.cycle_density >= 0.0 && shape.cycle_density <= 1.0 &&
+           shape.package_depth >= 0 && shape.package_depth <= 8 && shape.line_length > 0 && shape.body_lines >= 0 &&
+           options.runs > 0;
+}
+
+Json::Value getShapeJSON(const RepoShape& shape) {
+    Json::Value json(Json::objectValue);
+    json["files"] = shape.file_count;
+    json["fan_out"] = shape.fan_out;
+    json["cycle_density"] = shape.cycle_density;
+    json["package_depth"] = shape.package_depth;
+    json["line_length"] = shape.line_length;
+    json["lines"] = shape.body_lines;
+    json["seed"] = (Json::UInt64) shape.seed;
+    return json;
+}
+
+int checkBaseline(const Json::Value& result, const string& baseline_path, double tolerance) {
+    /* 0 if no stage got slower than the baseline allows, 2 if one did. Stages under a millisecond in the baseline are
+     * left out, they're mostly noise. */
+
+    std::ifstream input_file_stream(baseline_path);
+    Json::Value baseline;
+    Json::CharReaderBuilder builder;
+    string errors;
+    if (!input_file_stream.is_open() || !Json::parseFromStream(builder, input_file_stream, &baseline, &errors)) {
+        throw std::runtime_error("Failed to read baseline " + baseline_path);
+    }
+
+    // As text, a number read back from the file can have another type than the same one written to it.
+    auto getConfiguration = [](const Json::Value& json) {
+        return json["shape"].toStyledString() + json["threads"].toStyledString() + json["full_scan"].toStyledString();
+    };
+    if (getConfiguration(baseline) != getConfiguration(result)) {
+        throw std::runtime_error("The baseline ran on another shape or configuration: " + baseline_path);
+    }
+
+    int exit_code = 0;
+    std::cout << "Against " << baseline_path << ":\n";
+    for (const string& stage: result["stages"].getMemberNames()) {
+        double baseline_milliseconds = baseline["stages"][stage]["median_ms"].asDouble();
+        double milliseconds = result["stages"][stage]["median_ms"].asDouble();
+        if (baseline_milliseconds < 1.0) continue;
+
+        double ratio = milliseconds / baseline_milliseconds;
+        bool regressed = ratio > 1.0 + tolerance;
+        std::cout << '\t' << stage << ": " << ratio << "x" << (regressed ? ", slower than allowed" : "") << '\n';
+        if (regressed) exit_code = 2;
+    }
+
+    return exit_code;
+}
+
+void printUsage() {
+    std::cerr << "Usage: CodeNoteBench [file count]\n"
+                 "       CodeNoteBench pipeline [--files n] [--fan-out n] [--cycles fraction] [--depth n]\n"
+                 "\t[--line-length n] [--lines n] [--seed n] [--runs n] [--threads n] [--full] [--keep]\n"
+                 "\t[--json file|-] [--baseline file] [--tolerance fraction]\n";
+}
+
+int benchmarkPipeline(int argc, char** argv) {
+    /* "CodeNoteBench pipeline [options]": every stage of opening a project on a generated one, a number of times.
+     * The median and fastest run of every stage go to stdout, and as JSON to --json. With --baseline, a JSON result
+     * of an earlier build, exits with 2 if a stage got slower than --tolerance allows. One run more than asked for
+     * is made first and left out, it warms the page cache and writes the parse cache the JSON load reads. */
+
+    PipelineOptions options;
+    if (!parsePipelineOptions(argc, argv, options)) {
+        printUsage();
+        return 1;
+    }
+
+    fs::path folder = fs::temp_directory_path() / ("pypeline_pipeline_" + std::to_string(options.shape.seed));
+    string project_path = generateRepo(options.shape, folder);
+    string json_path = (folder / "project.json").generic_string();
+
+    const vector<const char*> stages = {"crawl", "parse", "link", "layer", "save json", "load json"};
+    vector<vector<double>> milliseconds(stages.size());
+    size_t file_count = 0, import_count = 0, cycle_count = 0;
+
+    for (int run = 0; run <= options.runs; run++) {
+        vector<double> timings;
+        auto time = [&timings](auto stage) {
+            Clock::time_point start = Clock::now();
+            auto result = stage();
+            timings.push_back(secondsSince(start) * 1000);
+            return result;
+        };
+
+        GraphArena arena;
+        vector<string> file_paths = time([&]() { return getFilePaths(project_path); });
+        vector<File*> files = time([&]() {
+            return scanFiles(project_path, file_paths, arena, options.thread_count, options.scan_mode);
+        });
+        time([&]() { sortImports(files); return 0; });
+        ImportLayers layers = time([&]() { return computeImportLevels(files); });
+        time([&]() { saveDataToJSON(files, json_path); return 0; });
+        time([&]() { return loadDataFromJSON(json_path); });
+
+        if (run == 0) continue;
+        for (size_t i = 0; i < stages.size(); i++) {
+            milliseconds[i].push_back(timings[i]);
+        }
+
+        file_count = files.size();
+        import_count = 0;
+        for (const File* file: files) import_count += file->imports.size();
+        cycle_count = layers.cycles.size();
+    }
+
+    Json::Value result(Json::objectValue);
+    result["shape"] = getShapeJSON(options.shape);
+    result["threads"] = options.thread_count;
+    result["full_scan"] = options.scan_mode == ScanMode::Full;
+    result["runs"] = options.runs;
+    result["parsed_files"] = (Json::UInt64) file_count;
+    result["imports"] = (Json::UInt64) import_count;
+    result["cycles"] = (Json::UInt64) cycle_count;
+
+    std::cout << "Pipeline on " << file_count << " files, " << import_count << " imports, " << cycle_count
+              << " cycle(s), median of " << options.runs << " run(s):\n";
+
+    Json::Value& json_stages = result["stages"] = Json::Value(Json::objectValue);
+    for (size_t i = 0; i < stages.size(); i++) {
+        vector<double>& times = milliseconds[i];
+        std::sort(times.begin(), times.end());
+        double median = times.size() % 2 == 1 ? times[times.size() / 2]
+                                               : (times[times.size() / 2 - 1] + times[times.size() / 2]) / 2;
+
+        Json::Value& json_stage = json_stages[stages[i]];
+        json_stage["median_ms"] = median;
+        json_stage["min_ms"] = times.front();
+        json_stage["max_ms"] = times.back();
+
+        std::cout << '\t' << stages[i] << ": " << median << " ms (" << times.front() << " to " << times.back()
+                  << ")\n";
+    }
+
+    if (options.json_path == "-") {
+        std::cout << result << '\n';
+    } else if (!options.json_path.empty()) {
+        std::ofstream output_file_stream(options.json_path);
+        if (!output_file_stream.is_open()) {
+            throw std::runtime_error("Failed to open file (writing): " + options.json_path);
+        }
+        output_file_stream << result << '\n';
+    }
+
+    if (!options.keep) {
+        fs::remove_all(folder);
+    }
+
+    return options.baseline_path.empty() ? 0 : checkBaseline(result, options.baseline_path, options.tolerance);
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1 && string(argv[1]) == "pipeline") {
+        try {
+            return benchmarkPipeline(argc, argv);
+        } catch (const std::exception& error) {
+            std::cerr << error.what() << '\n';
+            return 1;
+        }
+    }
+
+    int file_count = 2000;
+    if (argc > 1) {
+        string argument = argv[1];
+        size_t parsed_length = 0;
+        try {
+            file_count = std::stoi(argument, &parsed_length);
+        } catch (const std::logic_error&) {}  // From stoi, checked below.
+
+        if (argc > 2 || parsed_length == 0 || parsed_length != argument.size() || file_count <= 0) {
+            printUsage();
+            return 1;
+        }
+    }
+
+    if (!checkImportCorpus() || !checkReopenedProject() || !checkJournalReplay() || !checkWatchedChanges() || !checkReusedObjects()) {
+        return 1;
+    }
+
+    benchmarkParser(std::min(file_count, 500));  // The regex parser is too slow for big projects.
+    benchmarkReader(std::min(file_count, 1000));
+    benchmarkScan(file_count);
+    benchmarkLinking();
+    benchmarkNames();
+    benchmarkLayering();
+    benchmarkLayout();
+    benchmarkForceLayout();
+    benchmarkReopen(std::min(file_count, 1000));
+    benchmarkSnapshot(file_count);
+    benchmarkSettings(100000);
+    benchmarkJournal();
+    benchmarkHistory();
+    benchmarkQueries();
+    benchmarkSymbols();
+    benchmarkProfiler(file_count);
+}
@@ -0,0 +1,481 @@
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <unordered_set>
+
+#include <json/json.h>
+
+#include "common.h"
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+
+    enum class GraphFormat {
+        JSON,
+        DOT,
+        Edges,
+    };
+
+    struct Options {
+        string project_path;
+        string output_path;  // Empty for stdout.
+        string trace_path;  // Empty for none.
+        GraphFormat format = GraphFormat::JSON;
+        ScanMode scan_mode = ScanMode::Header;
+        unsigned thread_count = 0;
+        bool timings = true;
+        bool fail_on_cycles = false;
+    };
+
+    struct StageTiming {
+        const char* stage;
+        double milliseconds;
+    };
+
+    void printUsage() {
+        std::cout << "Usage:\n"
+                     "\tCodeNote                         Open the GUI.\n"
+                     "\tCodeNote <project folder>        Open a project in the GUI.\n"
+                     "\tCodeNote analyze <project folder> [options]\n"
+                     "\tCodeNote query <project folder> <question> <module> [<module or name>] [--full]\n"
+                     "\n"
+                     "Analyze options:\n"
+                     "\t--format json|dot|edges   Output format of the import graph (default json).\n"
+                     "\t--output <file>           Write the graph to a file instead of stdout.\n"
+                     "\t--full                    Parse whole files, not just the import header. Finds imports\n"
+                     "\t                          below the first def or class, and adds where every imported\n"
+                     "\t                          name is defined to the JSON (it needs every definition).\n"
+                     "\t--threads <count>         Parser threads (default one per core).\n"
+                     "\t--no-timings              Don't print how long every stage took.\n"
+                     "\t--fail-on-cycles          Exit with 2 if any files import each other in a loop.\n"
+                     "\t--trace <file>            Profile the run and save it as a Chrome trace (chrome://tracing).\n"
+                     "\n"
+                     "Query questions, answered one module per line:\n"
+                     "\tdependencies <module>     Everything the module imports, directly or not.\n"
+                     "\tdependents <module>       Everything that imports the module, directly or not.\n"
+                     "\tpath <module> <module>    The shortest chain of imports from the first to the second.\n"
+                     "\tcycle <module>            The modules it imports in a loop with, itself included.\n"
+                     "\tsymbols <module>          The names it imports, as module.name of where they're defined.\n"
+                     "\tusers <module> <name>     The modules that import one of its names.\n"
+                     "\tsymbols and users always parse whole files, to find every definition.\n";
+    }
+
+    bool parseOptions(int argc, char** argv, Options& options) {
+        /* argv[1] is "analyze". Returns false on anything it doesn't understand. */
+
+        for (int i = 2; i < argc; i++) {
+            string argument = argv[i];
+            bool has_value = i + 1 < argc;
+
+            if (argument == "--format" && has_value) {
+                string format = argv[++i];
+                if (format == "json") {
+                    options.format = GraphFormat::JSON;
+                } else if (format == "dot") {
+                    options.format = GraphFormat::DOT;
+                } else if (format == "edges") {
+                    options.format = GraphFormat::Edges;
+                } else {
+                    std::cerr << "Unknown format: " << format << '\n';
+                    return false;
+                }
+            } else if (argument == "--output" && has_value) {
+                options.output_path = argv[++i];
+            } else if (argument == "--trace" && has_value) {
+                options.trace_path = argv[++i];
+            } else if (argument == "--threads" && has_value) {
+                string thread_count = argv[++i];
+                if (thread_count.empty() || thread_count.find_first_not_of("0123456789") != string::npos) {
+                    std::cerr << "Invalid thread count: " << thread_count << '\n';
+                    return false;
+                }
+                options.thread_count = (unsigned) std::stoul(thread_count);
+            } else if (argument == "--full") {
+                options.scan_mode = ScanMode::Full;
+            } else if (argument == "--no-timings") {
+                options.timings = false;
+            } else if (argument == "--fail-on-cycles") {
+                options.fail_on_cycles = true;
+            } else if (!startsWith(argument, "--") && options.project_path.empty()) {
+                options.project_path = argument;
+            } else {
+                std::cerr << "Unknown argument: " << argument << '\n';
+                return false;
+            }
+        }
+
+        return !options.project_path.empty();
+    }
+
+    double millisecondsSince(Clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    }
+
+    string quoteDOT(const string& text) {
+        string quoted = "\"";
+        for (char c: text) {
+            if (c == '"' || c == '\\') quoted += '\\';
+            quoted += c;
+        }
+        return quoted + '"';
+    }
+
+    string describeSymbol(const SymbolIndex& symbols, const SymbolIndex::Symbol& symbol) {
+        /* "module.name", or just "module" for the module itself. */
+
+        const File* file = symbols.getFile(symbol);
+        string description = file != nullptr ? file->file_name.str() : "?";
+        if (symbol.name != SymbolIndex::whole_module) {
+            description += '.';
+            description += symbol.name.view();
+        }
+        return description;
+    }
+
+    void writeJSON(std::ostream& out, const vector<File*>& files, const ImportLayers& layers,
+                   const SymbolIndex* symbols, const vector<StageTiming>& timings) {
+        /* Imports only list the "symbols" they bring in given a symbol index, which takes a full scan. */
+
+        Json::Value graph;
+
+        Json::Value& json_files = graph["files"] = Json::Value(Json::arrayValue);
+        for (size_t i = 0; i < files.size(); i++) {
+            Json::Value file;
+            file["name"] = files[i]->file_name.str();
+            file["path"] = files[i]->file_path.str();
+            file["level"] = layers.levels[i];
+
+            Json::Value& imports = file["imports"] = Json::Value(Json::arrayValue);
+            for (const Import* import: files[i]->imports) {
+                Json::Value json_import;
+                json_import["name"] = import->file_name.str();
+                json_import["file"] = import->file != nullptr ? Json::Value(import->file->file_name.str())
+                                                              : Json::Value();
+
+                if (!import->entire_file) {
+                    Json::Value& content = json_import["content"] = Json::Value(Json::arrayValue);
+                    for (Name imported: import->imported_content) {
+                        content.append(imported.str());
+                    }
+                }
+
+                // Where what it imports is defined, with star imports expanded.
+                if (symbols != nullptr) {
+                    Json::Value& json_symbols = json_import["symbols"] = Json::Value(Json::arrayValue);
+                    for (const SymbolIndex::Symbol& symbol: symbols->getSymbols(import)) {
+                        if (symbols->getFile(symbol) != nullptr) json_symbols.append(describeSymbol(*symbols, symbol));
+                    }
+                }
+                imports.append(json_import);
+            }
+
+            json_files.append(file);
+        }
+
+        Json::Value& cycles = graph["cycles"] = Json::Value(Json::arrayValue);
+        for (const vector<size_t>& cycle: layers.cycles) {
+            Json::Value json_cycle(Json::arrayValue);
+            for (size_t i: cycle) {
+                json_cycle.append(files[i]->file_name.str());
+            }
+            cycles.append(json_cycle);
+        }
+
+        Json::Value& json_timings = graph["timings"] = Json::Value(Json::objectValue);
+        for (const StageTiming& timing: timings) {
+            json_timings[timing.stage] = timing.milliseconds;
+        }
+
+        out << graph << '\n';
+    }
+
+    vector<const File*> getImportedFiles(const File* file) {
+        /* The project files a file imports, once each even if several of its imports resolve to the same file. */
+
+        vector<const File*> imported_files;
+        std::unordered_set<const File*> seen;
+
+        for (const Import* import: file->imports) {
+            if (import->file != nullptr && seen.insert(import->file).second) {
+                imported_files.push_back(import->file);
+            }
+        }
+
+        return imported_files;
+    }
+
+    void writeDOT(std::ostream& out, const vector<File*>& files, const ImportLayers& layers) {
+        /* Files on the same import level share a rank, so dot draws the layers the GUI shows. */
+
+        out << "digraph imports {\n";
+
+        int max_level = -1;
+        for (int level: layers.levels) max_level = std::max(max_level, level);
+
+        for (int level = 0; level <= max_level; level++) {
+            out << "\t{ rank=same;";
+            for (size_t i = 0; i < files.size(); i++) {
+                if (layers.levels[i] == level) out << ' ' << quoteDOT(files[i]->file_name.str()) << ';';
+            }
+            out << " }\n";
+        }
+
+        for (const File* file: files) {
+            for (const File* imported_file: getImportedFiles(file)) {
+                out << '\t' << quoteDOT(file->file_name.str()) << " -> " << quoteDOT(imported_file->file_name.str())
+                    << ";\n";
+            }
+        }
+
+        out << "}\n";
+    }
+
+    void writeEdges(std::ostream& out, const vector<File*>& files) {
+        /* "importer imported", one line per pair of project files. */
+
+        for (const File* file: files) {
+            for (const File* imported_file: getImportedFiles(file)) {
+                out << file->file_name << ' ' << imported_file->file_name << '\n';
+            }
+        }
+    }
+
+    int analyzeProject(const Options& options) {
+        /* The same pipeline openNewProject runs, a stage at a time so every stage can be timed.
+         * The parse cache is left alone, so the timings are those of a cold scan. */
+
+        if (!options.trace_path.empty()) {
+            setProfiling(true);
+        }
+
+        vector<StageTiming> timings;
+
+        Clock::time_point start = Clock::now();
+        vector<string> file_paths = getFilePaths(options.project_path);
+        timings.push_back({"crawl", millisecondsSince(start)});
+
+        GraphArena arena;
+
+        start = Clock::now();
+        vector<File*> files = scanFiles(options.project_path, file_paths, arena, options.thread_count,
+                                        options.scan_mode);
+        timings.push_back({"parse", millisecondsSince(start)});
+
+        start = Clock::now();
+        sortImports(files);
+        timings.push_back({"link", millisecondsSince(start)});
+
+        start = Clock::now();
+        ImportLayers layers = computeImportLevels(files);
+        timings.push_back({"layer", millisecondsSince(start)});
+
+        std::unique_ptr<SymbolIndex> symbols;
+        if (options.format == GraphFormat::JSON && options.scan_mode == ScanMode::Full) {
+            start = Clock::now();
+            symbols = std::make_unique<SymbolIndex>(files);
+            timings.push_back({"symbols", millisecondsSince(start)});
+        }
+
+        std::ofstream output_file;
+        if (!options.output_path.empty()) {
+            output_file.open(options.output_path);
+            if (!output_file.is_open()) {
+                throw std::runtime_error("Failed to open output file (writing): " + options.output_path);
+            }
+        }
+        std::ostream& out = options.output_path.empty() ? std::cout : output_file;
+
+        switch (options.format) {
+            case GraphFormat::JSON:
+                writeJSON(out, files, layers, symbols.get(), timings);
+                break;
+            case GraphFormat::DOT:
+                writeDOT(out, files, layers);
+                break;
+            case GraphFormat::Edges:
+                writeEdges(out, files);
+                break;
+        }
+
+        // On stderr, so they never end up in a graph piped to another tool.
+        if (options.timings) {
+            std::cerr << files.size() << " file(s):";
+            for (const StageTiming& timing: timings) {
+                std::cerr << ' ' << timing.stage << ' ' << timing.milliseconds << " ms,";
+            }
+            std::cerr << ' ' << layers.cycles.size() << " cycle(s)\n";
+        }
+
+        if (!options.trace_path.empty()) {
+            saveChromeTrace(options.trace_path);
+        }
+
+        for (const vector<size_t>& cycle: layers.cycles) {
+            std::cerr << "Import cycle:";
+            for (size_t i: cycle) {
+                std::cerr << ' ' << files[i]->file_name;
+            }
+            std::cerr << '\n';
+        }
+
+        return options.fail_on_cycles && !layers.cycles.empty() ? 2 : 0;
+    }
+
+    const File* findModule(const vector<File*>& files, const string& module_name) {
+        auto file = std::find_if(files.begin(), files.end(), [&](const File* file) {
+            return file->file_name == module_name;
+        });
+        if (file == files.end()) {
+            std::cerr << "Unknown module: " << module_name << '\n';
+            return nullptr;
+        }
+        return *file;
+    }
+
+    int querySymbols(const vector<string>& arguments) {
+        /* "<folder> symbols <module>" or "<folder> users <module> <name>". Always a full scan, a header one would
+         * miss every definition below the first def or class. */
+
+        bool users = arguments[1] == "users";
+        if (arguments.size() != (users ? 4 : 3)) {
+            printUsage();
+            return 1;
+        }
+
+        GraphArena arena;
+        vector<File*> files = scanFiles(arguments[0], getFilePaths(arguments[0]), arena, 0, ScanMode::Full);
+        sortImports(files);
+
+        const File* module = findModule(files, arguments[2]);
+        if (module == nullptr) return 1;
+
+        Clock::time_point start = Clock::now();
+        SymbolIndex symbols(files);
+        double index_milliseconds = millisecondsSince(start);
+
+        size_t answer_count = 0;
+        if (users) {
+            for (const File* file: symbols.getImporters(module, arguments[3])) {
+                std::cout << file->file_name << '\n';
+                answer_count++;
+            }
+        } else {
+            for (const Import* import: module->imports) {
+                for (const SymbolIndex::Symbol& symbol: symbols.getSymbols(import)) {
+                    if (symbols.getFile(symbol) == nullptr) continue;
+                    std::cout << describeSymbol(symbols, symbol) << '\n';
+                    answer_count++;
+                }
+            }
+        }
+
+        std::cerr << files.size() << " file(s): index " << index_milliseconds << " ms, " << answer_count
+                  << " answer(s)\n";
+        return 0;
+    }
+
+    int queryProject(int argc, char** argv) {
+        /* argv[1] is "query". Scans the project like analyze, then answers one question about it. */
+
+        vector<string> arguments;
+        ScanMode scan_mode = ScanMode::Header;
+        for (int i = 2; i < argc; i++) {
+            string argument = argv[i];
+            if (argument == "--full") {
+                scan_mode = ScanMode::Full;
+            } else {
+                arguments.push_back(argument);
+            }
+        }
+
+        if (arguments.size() < 3) {
+            printUsage();
+            return 1;
+        }
+        const string& question = arguments[1];
+        if (question == "symbols" || question == "users") {
+            return querySymbols(arguments);
+        }
+
+        size_t module_count = question == "path" ? 2 : 1;
+        if (arguments.size() != 2 + module_count ||
+            (question != "dependencies" && question != "dependents" && question != "path" && question != "cycle")) {
+            printUsage();
+            return 1;
+        }
+
+        GraphArena arena;
+        vector<File*> files = scanFiles(arguments[0], getFilePaths(arguments[0]), arena, 0, scan_mode);
+        sortImports(files);
+
+        vector<const File*> modules;
+        for (size_t i = 2; i < arguments.size(); i++) {
+            const File* module = findModule(files, arguments[i]);
+            if (module == nullptr) return 1;
+            modules.push_back(module);
+        }
+
+        Clock::time_point start = Clock::now();
+        DependencyIndex index(files);
+        double index_milliseconds = millisecondsSince(start);
+
+        start = Clock::now();
+        vector<const File*> answer;
+        if (question == "dependencies") {
+            answer = index.getDependencies(modules[0]);
+        } else if (question == "dependents") {
+            answer = index.getDependents(modules[0]);
+        } else if (question == "path") {
+            answer = index.getImportPath(modules[0], modules[1]);
+        } else {
+            answer = index.getCycle(modules[0]);
+        }
+        double query_milliseconds = millisecondsSince(start);
+
+        for (const File* file: answer) {
+            std::cout << file->file_name << '\n';
+        }
+
+        std::cerr << files.size() << " file(s): index " << index_milliseconds << " ms, query " << query_milliseconds
+                  << " ms, " << answer.size() << " module(s)\n";
+        return 0;
+    }
+}
+
+int runCommandLine(int argc, char** argv) {
+    /* Everything but the GUI. Returns the exit code. */
+
+    string command = argv[1];
+
+    if (command == "--help" || command == "-h") {
+        printUsage();
+        return 0;
+    }
+
+    if (command == "analyze") {
+        try {
+            Options options;
+            if (!parseOptions(argc, argv, options)) {
+                printUsage();
+                return 1;
+            }
+
+            return analyzeProject(options);
+        } catch (const std::exception& error) {
+            std::cerr << error.what() << '\n';
+            return 1;
+        }
+    }
+
+    if (command == "query") {
+        try {
+            return queryProject(argc, argv);
+        } catch (const std::exception& error) {
+            std::cerr << error.what() << '\n';
+            return 1;
+        }
+    }
+
+    printUsage();
+    return 1;
+}
@@ -1,21 +1,66 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 
 #include <iostream>
+#include <cstdint>
 #include <cstdio>
 
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <stdexcept>
 #include <vector>
 #include <unordered_map>
+#include <unordered_set>
 
 using std::string, std::vector;
 
 /*strman.cpp*/
 bool endsWith(string const & value, string const & ending);
 bool startsWith(string const & value, string const & ending);
-string getProjectPath(const string& file_path);
 
 string trim(const string& input);
+unsigned long long hashContent(std::string_view content);
+
+class Name {
+    /* An interned string. Every distinct string is stored once for the whole program (and never freed), a Name is
+     * just its 32 bit id, so copying and comparing one is an integer operation. Interning is thread safe. */
+
+    public:
+        Name() = default;  // ""
+        explicit Name(std::string_view text);
+
+        static bool find(std::string_view text, Name& name);  // Only if it was interned before, never interns it.
+        static size_t count();  // Distinct names so far, ids are below that.
+
+        const string& str() const;
+        std::string_view view() const { return str(); }
+        const char* c_str() const { return str().c_str(); }
+        bool empty() const { return id == 0; }
+        uint32_t getId() const { return id; }
+
+        bool operator==(Name other) const { return id == other.id; }
+        bool operator!=(Name other) const { return id != other.id; }
+        bool operator==(std::string_view text) const { return view() == text; }
+        bool operator!=(std::string_view text) const { return view() != text; }
+        bool operator<(Name other) const { return id < other.id; }  // In the order they were interned, for sorting.
+
+    private:
+        uint32_t id = 0;
+};
+
+std::ostream& operator<<(std::ostream& out, Name name);
+
+namespace std {
+    template<>
+    struct hash<Name> {
+        size_t operator()(Name name) const noexcept { return name.getId(); }
+    };
+}
 
 /*core.cpp*/
 class ToDo {
@@ -27,41 +72,714 @@ class ToDo {
 
 class Import;  // TODO: Clean this.
 
+class Symbols {  // The top level names of a file, as found by the parser.
+    public:
+        vector<Name> definitions;  // def, class and assigned names. With ScanMode::Header, those in the header.
+        vector<Name> exports;  // Listed in __all__.
+        bool has_exports = false;  // Without __all__, a star import gets every name not starting with "_".
+};
+
 class File {  // TODO: Change to structs?
     public:
-        string file_name;  // TODO: Set method.
-        string file_path;
-        bool non_project;  // TODO: Implement.
+        Name file_name;  // TODO: Set method.
+        Name file_path;
+        bool non_project = false;  // The "General" placeholder, which isn't a file of the project.
+        bool package = false;  // __init__.py, relative imports resolve from the package itself.
 
         string notes;
         vector<ToDo*> to_dos;
 
+        Symbols symbols;
         vector<Import*> imports;
         vector<File*> imported_by;
 };
 
 class Import {
     public:
-        string file_name;
+        Name file_name;
         File* file;
         bool entire_file;
-        vector<string> imported_content;  // TODO: Optional
+        vector<Name> imported_content;  // TODO: Optional
+};
+
+template<typename T>
+class Arena {  // Objects in contiguous chunks at stable addresses, freed with the arena or reused once destroyed.
+    public:
+        Arena() = default;
+        Arena(const Arena&) = delete;
+        Arena& operator=(const Arena&) = delete;
+        ~Arena() { clear(); }
+
+        template<typename... Args>
+        T* create(Args&&... args) {
+            if (!free_objects.empty()) {
+                T* object = free_objects.back();
+                free_objects.pop_back();
+
+                object->~T();
+                return new (object) T(std::forward<Args>(args)...);
+            }
+
+            if (chunks.empty() || chunks.back().used == chunk_size) {
+                chunks.push_back({static_cast<T*>(::operator new(sizeof(T) * chunk_size)), 0});
+            }
+
+            Chunk& chunk = chunks.back();
+            T* object = new (chunk.objects + chunk.used) T(std::forward<Args>(args)...);
+            chunk.used++;
+
+            return object;
+        }
+
+        void destroy(T* object) {
+            /* Frees what the object holds and keeps its slot for the next create, so replacing objects doesn't grow
+             * the arena. The slot is left default constructed, clear() destroys it like any other. Nothing may point
+             * to the object anymore. */
+
+            object->~T();
+            new (object) T();
+            free_objects.push_back(object);
+        }
+
+        void absorb(Arena& other) {
+            /* Takes over all objects of another arena, e.g. one that was filled on a worker thread. */
+
+            chunks.insert(chunks.end() - (chunks.empty() ? 0 : 1), other.chunks.begin(), other.chunks.end());
+            other.chunks.clear();
+            free_objects.insert(free_objects.end(), other.free_objects.begin(), other.free_objects.end());
+            other.free_objects.clear();
+        }
+
+        void clear() {
+            for (Chunk& chunk: chunks) {
+                for (size_t i = 0; i < chunk.used; i++) {
+                    chunk.objects[i].~T();
+                }
+                ::operator delete(chunk.objects);
+            }
+            chunks.clear();
+            free_objects.clear();
+        }
+
+        size_t size() const {  // Live objects, without the destroyed ones.
+            size_t count = 0;
+            for (const Chunk& chunk: chunks) count += chunk.used;
+            return count - free_objects.size();
+        }
+
+    private:
+        static constexpr size_t chunk_size = 256;
+
+        struct Chunk {
+            T* objects;
+            size_t used;
+        };
+
+        vector<Chunk> chunks;  // Only the last one is filled up further.
+        vector<T*> free_objects;  // Destroyed, reused first.
+};
+
+class GraphArena {  // Owns the files, imports and todos of a project.
+    public:
+        Arena<File> files;
+        Arena<Import> imports;
+        Arena<ToDo> to_dos;
+
+        void absorb(GraphArena& other) {
+            files.absorb(other.files);
+            imports.absorb(other.imports);
+            to_dos.absorb(other.to_dos);
+        }
+
+        void destroyImports(File* file) {  // Its imports, which must be unlinked already.
+            for (Import* import: file->imports) imports.destroy(import);
+            file->imports.clear();
+        }
+
+        void destroyToDos(File* file) {
+            for (ToDo* to_do: file->to_dos) to_dos.destroy(to_do);
+            file->to_dos.clear();
+        }
+};
+
+enum class ScanMode {
+    Header,  // Stop parsing at the first top level def, class or decorator.
+    Full,
+};
+
+class Project {  // An open project. Closing it (destroying it) frees its whole graph.
+    public:
+        string path;  // Empty for projects loaded from settings.
+        string save_path;  // Snapshot it was opened from or last saved to, empty until then.
+        vector<File*> files;  // "General" first.
+        ScanMode scan_mode = ScanMode::Header;
+
+        // Per file, as of the snapshot it was opened from, so it can be shown without laying it out. Empty otherwise.
+        vector<int> saved_levels;
+        vector<float> saved_x, saved_y;
+
+        GraphArena arena;
 };
 
-File* getImports(const string& file_path);
-vector<string> getImportsFromLine(string line);
+// Returns whether ScanMode::Header found the end of the import header, nothing after it is needed then.
+bool parseImports(std::string_view source, File* script, GraphArena& arena, ScanMode mode = ScanMode::Header);
+File* getImports(const string& file_path, GraphArena& arena, ScanMode mode = ScanMode::Header);
+
+Name resolveModuleName(const File& importer, Name import_name);
+
+class ModuleIndex {  // Project files by module name, for linking imports.
+    public:
+        explicit ModuleIndex(const vector<File*>& files);
 
+        File* find(const File& importer, Name module_name) const;
+        File* find(const File& importer, std::string_view module_name) const;  // Without interning the name.
+        File* resolve(const File& importer, const Import& import) const;
+
+    private:
+        std::unordered_map<Name, File*> files_by_name;
+        std::unordered_set<Name> packages;  // Names with submodules in the project, "pkg" for "pkg.mod".
+};
+
+void linkImports(File* file, const ModuleIndex& index);
+void unlinkImports(File* file);
 void sortImports(std::vector<File*>& files);
 bool isHeadFile(const File &file);
 
-vector<File*> openNewProject(const string& project_path);
+class ImportLayers {
+    public:
+        vector<int> levels;  // Per file, in the order they were passed in. -1 for "General".
+        vector<vector<size_t>> cycles;  // Indices of files that import each other in a loop, one entry per loop.
+};
+
+ImportLayers computeImportLevels(const vector<File*>& files);
+
+class ImportComponents {  // The import graph with every loop of files that import each other condensed into one node.
+    public:
+        vector<size_t> components;  // Per file, SIZE_MAX for "General". Imports only go to lower numbered components.
+        size_t component_count = 0;
+
+        // Imports between project files: the ones of file i are edges[edge_starts[i], edge_starts[i + 1]).
+        vector<size_t> edge_starts;
+        vector<size_t> edges;
+};
+
+ImportComponents findImportComponents(const vector<File*>& files);
+
+class ParseCache {  // The imports of every file as of its last parse, so unchanged files are never parsed again.
+    public:
+        class Entry {
+            public:
+                long long modified_time;
+                unsigned long long size;
+                unsigned long long content_hash;
+                ScanMode scan_mode;
+                vector<Import> imports;  // Unlinked, file is always nullptr.
+                Symbols symbols;
+
+                bool used = false;  // Looked up since the cache was loaded, unused entries aren't saved.
+        };
+
+        std::unordered_map<string, Entry> entries;  // By file path.
+        bool changed = false;
+
+        // Thread safe, as long as the arenas differ.
+        File* getImports(const string& file_path, GraphArena& arena, ScanMode mode = ScanMode::Header);
+        bool isUpToDate(const string& file_path, ScanMode mode = ScanMode::Header);
+
+    private:
+        std::mutex mutex;
+};
+
+class LoadCancelled : public std::runtime_error {
+    public:
+        LoadCancelled() : std::runtime_error("Loading cancelled.") {}
+};
+
+class LoadProgress {  // Shared by a project that's loading and whoever is waiting for it, on another thread.
+    public:
+        std::atomic<size_t> found_files = 0;  // So far, while crawling.
+        std::atomic<size_t> parsed_files = 0;
+        std::atomic<bool> cancelled = false;
+
+        void addParsedFile(const string& module_name);
+        void takeParsedFiles(vector<string>& module_names);  // Appends the files parsed since the last call.
+        void checkCancelled() const;  // Throws LoadCancelled.
+
+    private:
+        std::mutex mutex;
+        vector<string> parsed_names;
+};
+
+// 0 threads: one per core.
+vector<File*> scanFiles(const string& project_path, const vector<string>& file_paths, GraphArena& arena,
+                        unsigned thread_count = 0, ScanMode mode = ScanMode::Header);
+
+void addGeneral(Project& project);
+std::unique_ptr<Project> openNewProject(const string& project_path, unsigned thread_count = 0,
+                                        ScanMode mode = ScanMode::Header, LoadProgress* progress = nullptr);
+
+class ProjectRescan {  // What changed on disk since a project was scanned, found on any thread and applied on its own.
+    public:
+        explicit ProjectRescan(const Project& project);  // Takes the files to compare with, on the project's thread.
+
+        void scan(unsigned thread_count = 0, LoadProgress* progress = nullptr);  // Throws LoadCancelled.
+        size_t apply(Project& project);  // Once scanned. Returns the number of files that were parsed.
+
+    private:
+        struct OpenFile {
+            File* file;
+            Name module_name;
+        };
+
+        string path;
+        ScanMode scan_mode;
+        std::unordered_map<std::string_view, OpenFile> open_files;  // By path, views into File::file_path.
+
+        vector<File*> rescanned_files;  // In crawl order after "General", null where a new file goes.
+        size_t general_count = 0;
+        vector<size_t> queued_slots;  // Where each parsed file goes in rescanned_files.
+        vector<File*> parsed_files;
+        GraphArena arena;  // Of the parsed files, until they're applied.
+        bool structure_changed = false;  // Files were added, removed or renamed.
+};
+
+size_t rescanProject(Project& project, unsigned thread_count = 0, LoadProgress* progress = nullptr);
+size_t updateProjectFiles(Project& project, const vector<string>& changed_paths, unsigned thread_count = 0);
 
 /*io.cpp*/
+using FileCallback = std::function<void(const string& file_path, const string& module_name)>;
+using FolderCallback = std::function<void(const string& folder_path)>;
+
+void crawlProject(const string& folder_path, const FileCallback& on_file, const FolderCallback& on_folder = nullptr);
+bool crawlProjectFolder(const string& project_path, const string& folder_path, const FileCallback& on_file,
+                        const FolderCallback& on_folder = nullptr);
+bool isProjectFile(const string& project_path, const string& file_path);
 vector<string> getFilePaths(const string& folder_path);
 string getFileName(const string& file_path);
+string getModuleName(const string& project_path, const string& file_path);
+
+// Whether the start of a source is all that's needed, e.g. its whole import header.
+using SourceCheck = std::function<bool(std::string_view source)>;
+
+// Reads a source file into buffer, which is reused from file to file, and returns what was read (empty if it couldn't
+// be). A file that's truncated while it's read just comes back short. With enough, it's read a chunk at a time and
+// enough is called with everything read so far after every chunk, the last time with all of it. Reading stops as
+// soon as enough returns true.
+std::string_view readSource(const string& file_path, string& buffer, const SourceCheck& enough = nullptr);
+
+class MappedFile {  // A whole file, read only and memory mapped. Only for the files we write, never for sources.
+    public:
+        explicit MappedFile(const string& file_path);
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+        ~MappedFile();
+
+        std::string_view content() const { return {data, size}; }  // Empty if the file couldn't be read.
+
+    private:
+        const char* data = nullptr;
+        size_t size = 0;
+};
+
+// Through a temporary file that's synced and renamed over the old one, a crash leaves either the old or the new file.
+void writeFileAtomically(const string& file_path, const std::function<void(std::ostream& out)>& write);
+
+string getParseCachePath(const string& folder_path);
+void loadParseCache(ParseCache& cache, const string& file_path);
+void saveParseCache(const ParseCache& cache, const string& file_path);
 
 void saveDataToJSON(const vector<File*>& files, const std::string& file_path);
-vector<File*> loadDataFromJSON(const string& file_path);
+vector<File*> readSettings(const string& file_path, GraphArena& arena, LoadProgress* progress = nullptr);  // No imports.
+std::unique_ptr<Project> loadDataFromJSON(const string& file_path, ScanMode mode = ScanMode::Header,
+                                          LoadProgress* progress = nullptr);
+
+/*watcher.cpp*/
+class ProjectWatcher {  // Watches a project for changed python files. Linux (inotify) only, elsewhere it never reports changes.
+    public:
+        explicit ProjectWatcher(const string& project_path);
+        ProjectWatcher(const ProjectWatcher&) = delete;
+        ProjectWatcher& operator=(const ProjectWatcher&) = delete;
+        ~ProjectWatcher();
+
+        bool takeChanges(vector<string>& changed_paths);
+
+    private:
+        class Implementation;
+        Implementation* implementation;
+};
+
+/*layout.cpp*/
+class LayoutGraph {  // What a layout needs of the import graph, copied so it can be laid out while the project changes.
+    public:
+        vector<const File*> files;  // Only used to recognise files between layouts, never dereferenced.
+        vector<int> levels;  // Import levels, -1 for "General".
+        vector<vector<size_t>> imports;  // Per file, indices of the files it imports.
+};
+
+LayoutGraph getLayoutGraph(const vector<File*>& files, const ImportLayers& layers);
+
+class GraphLayout {
+    public:
+        unsigned long long version = 0;  // Of the graph it was requested for.
+        vector<float> x, y;  // Per file of the LayoutGraph, center on the grid.
+        size_t relaid_layers = 0;
+        bool settled = true;  // False for the snapshots of a force directed layout that is still moving.
+};
+
+enum class LayoutMode {
+    Layered,
+    Force,  // Starts from the layered layout. For cyclic or flat projects, where levels say little.
+};
+
+class LayeredLayout {  // Remembers the last layout, so the next one only redoes the layers that changed.
+    public:
+        explicit LayeredLayout(float layer_spacing = 200.0f, float node_spacing = 130.0f);
+
+        GraphLayout compute(const LayoutGraph& graph);
+        void clear();
+
+    private:
+        struct Placement {
+            int level;
+            float y;
+            vector<const File*> imported_files;
+            unsigned generation = 0;  // Of the last layout the file was in.
+        };
+
+        float layer_spacing;
+        float node_spacing;
+        std::unordered_map<const File*, Placement> placements;
+        unsigned generation = 0;
+};
+
+class ForceLayout {  // Force directed layout, one step at a time.
+    public:
+        explicit ForceLayout(const LayoutGraph& graph, float edge_length = 200.0f);
+
+        float step();  // Returns the largest distance a file moved.
+        void getPositions(GraphLayout& layout) const;
+
+    private:
+        struct QuadNode {
+            float min_x = 0, min_y = 0, size = 0;
+            float mass = 0, sum_x = 0, sum_y = 0;  // Of the bodies below.
+            int children[4] = {-1, -1, -1, -1};
+            int body = -1;  // For leaves.
+        };
+
+        static constexpr float cooling = 0.995f;
+
+        float edge_length;
+        float temperature;  // Furthest a file may move in one step.
+        vector<size_t> bodies;  // Index in the LayoutGraph of every body.
+
+        // Structure of arrays, by body.
+        vector<float> x, y;
+        vector<float> velocity_x, velocity_y;
+        vector<float> force_x, force_y;
+
+        vector<unsigned> edge_from, edge_to;
+        vector<float> edge_force_x, edge_force_y;
+
+        vector<QuadNode> tree;
+
+        void buildTree();
+        void addRepulsion();
+        void addSprings();
+        void integrate();
+};
+
+class LayoutEngine {  // Lays graphs out on a background thread.
+    public:
+        explicit LayoutEngine(std::function<void()> on_layout = nullptr);  // Called on the layout thread.
+        LayoutEngine(const LayoutEngine&) = delete;
+        LayoutEngine& operator=(const LayoutEngine&) = delete;
+        ~LayoutEngine();
+
+        void request(LayoutGraph graph, unsigned long long version, LayoutMode mode = LayoutMode::Layered);
+        bool takeLayout(GraphLayout& layout);  // Non blocking, true once a requested layout is done or moved on.
+        void reset();  // Forget the last layout, for a different project.
+
+    private:
+        class Implementation;
+        Implementation* implementation;
+};
+
+/*snapshot.cpp*/
+// Binary and memory mapped, much faster to reopen than JSON. JSON stays the format to export to.
+void saveSnapshot(const Project& project, const ImportLayers& layers, const GraphLayout& layout, const string& file_path);
+std::unique_ptr<Project> loadSnapshot(const string& file_path, LoadProgress* progress = nullptr);
+string getSnapshotPath(const string& folder_path);
+std::unique_ptr<Project> openProject(const string& project_path, ScanMode mode = ScanMode::Header,
+                                     LoadProgress* progress = nullptr);
+
+/*journal.cpp*/
+class EditJournal {  // Append only log of notes and todo edits, so they survive a crash between saves.
+    public:
+        // Edits are recorded by file path, relative to the project folder if there is one.
+        explicit EditJournal(const string& file_path, const string& project_path = "");
+        EditJournal(const EditJournal&) = delete;
+        EditJournal& operator=(const EditJournal&) = delete;
+        ~EditJournal();
+
+        // Returns right away, the edit is written and synced to disk on a background thread.
+        void recordNotes(const File& file);
+        void recordToDos(const File& file);
+
+        size_t size() const;  // Bytes, to know when to compact it into the saved project.
+        void clear();  // Once the edits are saved elsewhere.
+
+    private:
+        class Implementation;
+        string project_path;
+        Implementation* implementation;
+};
+
+vector<File*> replayJournal(Project& project, const string& file_path);
+string getJournalPath(const string& save_path);
+
+/*history.cpp*/
+class FileState {  // What was written about a file at one point.
+    public:
+        string notes;
+        vector<ToDo> to_dos;
+};
+
+class DocumentVersion {
+    /* The state of every file at one point, by slot. Immutable: set returns a new version that shares everything but
+     * the path to the changed slot (a 32 way trie), so copying one is O(1) and an edit is O(log n). */
+
+    public:
+        class Node;
+
+        size_t size() const { return count; }
+        const std::shared_ptr<const FileState>& get(size_t slot) const;  // Null past the end.
+        DocumentVersion set(size_t slot, std::shared_ptr<const FileState> state) const;
+
+        // Slots with a different state in the other version, without looking at the parts both share.
+        void forEachDifference(const DocumentVersion& other, const std::function<void(size_t slot)>& on_difference) const;
+
+    private:
+        std::shared_ptr<const Node> root;
+        size_t count = 0;
+        unsigned shift = 0;  // Bits of the slot below the root.
+};
+
+enum class EditKind {
+    Notes,
+    ToDos,
+    Revert,
+};
+
+class EditHistory {  // Undo, redo and revert of the notes and todos of a project. Files are changed in place.
+    public:
+        explicit EditHistory(Project& project);  // Starts out saved.
+
+        void addFiles(const vector<File*>& files);  // New files of the project, the ones it already has are skipped.
+        void recordEdit(File* file, EditKind kind);  // After the file was edited.
+
+        // The files that changed.
+        vector<File*> undo();
+        vector<File*> redo();
+        bool canUndo() const;
+        bool canRedo() const;
+
+        void markSaved();
+        bool revertFile(File* file);  // To the last save. False if there was nothing to revert.
+        vector<File*> revertAll();
+
+    private:
+        static constexpr size_t max_versions = 1000;
+
+        Project& project;
+
+        vector<DocumentVersion> versions;  // Oldest first, the ones after current can be redone.
+        size_t current = 0;
+        DocumentVersion saved;
+
+        std::unordered_map<const File*, size_t> slots;
+        vector<File*> files_by_slot;
+
+        EditKind last_kind = EditKind::Revert;
+        size_t last_slot = 0;
+        long long last_edit_time = 0;  // Steady clock ticks.
+
+        vector<File*> moveTo(size_t version_index);
+        void pushVersion(const DocumentVersion& version);
+        std::shared_ptr<const FileState> getState(const File& file) const;
+        void setState(File& file, const FileState& state);
+};
+
+/*query.cpp*/
+class DependencyIndex {
+    /* Transitive questions about the imports of a project, on the loops condensed graph. What a file reaches is worked
+     * out on first use and kept (up to a few hundred files), so asking about the selected file again is a lookup.
+     * Built for one state of the project, rebuild it once its imports change. Not thread safe, queries fill the
+     * cache. */
+
+    public:
+        explicit DependencyIndex(const vector<File*>& files);
+
+        bool dependsOn(const File* importer, const File* imported) const;  // Imports it, directly or not.
+        vector<const File*> getDependencies(const File* file) const;  // Everything it imports, directly or not.
+        vector<const File*> getDependents(const File* file) const;  // Everything that imports it, what a change breaks.
+        vector<const File*> getImportPath(const File* from, const File* to) const;  // Shortest, both ends included.
+        vector<const File*> getCycle(const File* file) const;  // The loop it's in, itself included. Empty if none.
+
+    private:
+        vector<const File*> files;
+        std::unordered_map<const File*, size_t> file_indices;  // Project files only.
+        ImportComponents graph;
+
+        // Flat adjacency lists per component, like the edges of ImportComponents.
+        vector<size_t> member_starts, members;
+        vector<size_t> import_starts, component_imports;
+        vector<size_t> imported_by_starts, component_imported_by;
+
+        // Per component, a bit for every component it reaches.
+        mutable std::unordered_map<size_t, vector<uint64_t>> reachable, reverse_reachable;
+
+        size_t getComponent(const File* file) const;
+        bool isInCycle(size_t component) const;
+        const vector<uint64_t>& getReachable(size_t component, bool reverse) const;
+        vector<const File*> getFiles(const vector<uint64_t>& components, size_t own_component) const;
+};
+
+/*symbols.cpp*/
+class SymbolIndex {
+    /* Which top level names every import brings in, and where they're defined: re-exports ("from .mod import name" in
+     * a package) and star imports are followed to the file that defines the name. Flat arrays by file and by import.
+     * Built for one state of the project, the files must outlive it. Only complete for files parsed with
+     * ScanMode::Full, a header scan misses every definition below the first def or class. */
+
+    public:
+        static constexpr Name whole_module{};  // The name of a module itself, for "import a" or a submodule.
+
+        class Symbol {
+            public:
+                uint32_t file;  // Defined there, or imported from there if it couldn't be found.
+                Name name;
+        };
+
+        explicit SymbolIndex(const vector<File*>& files);
+
+        const File* getFile(const Symbol& symbol) const;  // Null if it's from outside the project.
+
+        vector<Symbol> getSymbols(const Import* import) const;  // Stars expanded.
+        vector<Symbol> getDefinitions(const File* file) const;
+        vector<const File*> getImporters(const File* file, std::string_view name) const;  // Of one of its names.
+
+    private:
+        class ImportName {
+            public:
+                Name name;
+                uint32_t submodule;  // The project file module.name, if there is one.
+        };
+
+        class Importer {
+            public:
+                Name name;
+                uint32_t file;
+        };
+
+        vector<const File*> files;
+        std::unordered_map<const File*, uint32_t> file_indices;
+        std::unordered_map<const Import*, uint32_t> import_indices;
+
+        Name star_name;
+
+        // Per file, sorted.
+        vector<uint32_t> definition_starts;
+        vector<Name> definitions;
+        vector<uint32_t> export_starts;
+        vector<Name> exports;
+
+        // Per file, then per import of it.
+        vector<uint32_t> import_starts;
+        vector<uint32_t> import_sources;  // The file it imports from.
+        vector<uint32_t> import_name_starts;
+        vector<ImportName> import_names;
+        vector<uint32_t> import_symbol_starts;
+        vector<Symbol> import_symbols;
+
+        // Per file, who imports its names, sorted by name.
+        vector<uint32_t> importer_starts;
+        vector<Importer> importers;
+
+        // While resolving.
+        std::unordered_map<uint64_t, Symbol> resolved;  // By file and name.
+        vector<uint32_t> star_starts, star_counts;  // Per file.
+        vector<Symbol> star_symbols;
+        vector<uint32_t> seen_names;  // Per name, the last star_pass that had it.
+        uint32_t star_pass = 0;
+
+        bool defines(uint32_t file, Name name) const;
+        bool isStarImport(uint32_t import) const;
+        Name getStarName(const Symbol& symbol) const;
+        Symbol resolve(uint32_t file, Name name, size_t depth);
+        const Symbol* getStarSymbols(uint32_t file, size_t depth);
+        void appendImportedSymbols(uint32_t import, vector<Symbol>& imported, size_t depth);
+};
+
+/*profiler.cpp*/
+enum class ProfileCounter {
+    FilesParsed,
+    BytesRead,  // Of every source read, in ScanMode::Header only up to the end of the import header.
+    Allocations,  // Through operator new.
+    DrawVertices,
+};
+
+constexpr size_t profile_counter_count = 4;
+
+class ProfileScope {
+    /* Times the scope it's in as one event of a stage: ProfileScope scope("link"). The name is kept, so it has to be a
+     * string literal. While the profiler is off, all it does is check that it is. */
+
+    public:
+        explicit ProfileScope(const char* name);
+        ProfileScope(const ProfileScope&) = delete;
+        ProfileScope& operator=(const ProfileScope&) = delete;
+        ~ProfileScope();
+
+    private:
+        const char* name;
+        long long start = -1;  // Nanoseconds, -1 if the profiler was off.
+};
+
+class StageProfile {
+    public:
+        const char* name;
+        size_t calls = 0;
+        double total_milliseconds = 0.0;
+        double max_milliseconds = 0.0;
+};
+
+class ProfileSummary {  // What the profiler found since it was last cleared.
+    public:
+        vector<StageProfile> stages;  // Longest total first. Nested stages count in their parents too.
+        long long counters[profile_counter_count] = {};
+        long long frame_counters[profile_counter_count] = {};  // In the last frame.
+        vector<float> frame_milliseconds;  // The last frames, oldest first.
+        size_t event_count = 0;
+        size_t dropped_event_count = 0;  // Past the limit per thread, still in the stages but not in a trace.
+};
+
+void setProfiling(bool enabled);
+bool isProfiling();
+void clearProfile();
+
+void countProfile(ProfileCounter counter, long long amount = 1);
+const char* getCounterName(ProfileCounter counter);
+
+// Around everything a GUI frame does, the time in between is spent waiting for input.
+void beginProfileFrame();
+void endProfileFrame();
+
+ProfileSummary getProfileSummary();
+void saveChromeTrace(const string& file_path);  // Trace event JSON, for chrome://tracing or Perfetto.
+
+/*cli.cpp*/
+int runCommandLine(int argc, char** argv);  // "CodeNote analyze|query <project folder> ...", runs without a display.
 
 /*gui.cpp*/
-void createWindow(vector<File*>& original_files);
+void createWindow(std::unique_ptr<Project> project);
@@ -1,122 +1,673 @@
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
 #include <fstream>
-#include <regex>
-#include <sstream>
+#include <mutex>
+#include <string_view>
+#include <thread>
 
 #include "common.h"
 
-using std::stringstream, std::ifstream, std::regex;
+using std::ifstream;
 
-vector<string> getImportsFromLine(string line) {
-    /* Returns a vector containing all imports on a given line.
-     * "import time" -> ["time],
-     * "import time, sys" -> ["time", "sys"] */
+namespace {
+    /* Single pass tokenizer over a python source buffer that only understands as much of the grammar as it needs
+     * to find import statements: comments, string literals, brackets, line continuations and statement starts.
+     * Top level statements are also checked for the names they define, for the symbols of the file. */
+    class ImportLexer {
+        public:
+            ImportLexer(std::string_view source, File* script, GraphArena& arena, ScanMode mode)
+                : pos(source.data()), end(source.data() + source.size()), script(script), arena(arena), mode(mode) {}
 
-    vector<string> imports;
-    imports.reserve(16);
+            bool run() {
+                /* Returns true once ScanMode::Header is past the import header, false at the end of the source. */
 
-    line = trim(line.erase(0, 6));  // Remove 'import' and trim again.
+                bool statement_start = true;
+                bool line_start = true;  // Nothing but whitespace on this line so far.
+                bool indented = false;
+                bool in_body = false;  // Of a one line def or class, nothing after it is top level.
+                int bracket_depth = 0;
 
-    string import;
-    stringstream ss(line);
+                while (pos < end) {
+                    char c = *pos;
 
-    while(getline(ss, import, ',')) {
-        if(regex_match(import, regex("\\w+ as \\w+"))) {
-            import = regex_replace(import, regex(" as \\w+"), "");
-        }
+                    if (c == ' ' || c == '\t' || c == '\r' || c == '\f') {
+                        pos++;
+                        indented |= line_start;
+                    } else if (c == '\n') {
+                        pos++;
+                        statement_start = bracket_depth == 0;
+                        line_start = statement_start;
+                        indented = false;
+                        in_body &= !statement_start;
+                    } else if (mode == ScanMode::Header && line_start && !indented && c == '@') {
+                        return true;  // Decorator, the import header is over.
+                    } else if (c == '#') {
+                        skipComment();
+                    } else if (c == '\\') {  // Line continuation, the statement goes on.
+                        pos++;
+                        line_start = false;
+                        if (pos < end && *pos == '\r') pos++;
+                        if (pos < end && *pos == '\n') pos++;
+                    } else if (c == ';' || (c == ':' && bracket_depth == 0)) {  // "import a; import b", "try: import a"
+                        pos++;
+                        statement_start = bracket_depth == 0;
+                        line_start = false;
+                    } else if (c == '\'' || c == '"') {
+                        skipString();
+                        statement_start = false;
+                        line_start = false;
+                    } else if (isIdentifierChar(c)) {
+                        std::string_view word = readWord();
 
-        import = trim(import);
-        imports.push_back(import);
-    }
+                        if (mode == ScanMode::Header && line_start && !indented &&
+                            (word == "def" || word == "class" || word == "async")) {
+                            // The first top level definition ends the import header. Unless the word is cut off
+                            // at the end of what was read so far, it may go on in the next chunk.
+                            return pos < end;
+                        }
+
+                        if (isQuote() && isStringPrefix(word)) {
+                            skipString();
+                        } else if (statement_start && word == "import") {
+                            parseImport();
+                        } else if (statement_start && word == "from") {
+                            parseFromImport();
+                        } else if (statement_start && !indented && !in_body) {
+                            in_body = parseDefinition(word);
+                        }
+
+                        statement_start = false;
+                        line_start = false;
+                    } else {
+                        if (c == '(' || c == '[' || c == '{') {
+                            bracket_depth++;
+                        } else if ((c == ')' || c == ']' || c == '}') && bracket_depth > 0) {
+                            bracket_depth--;
+                        }
+
+                        pos++;
+                        statement_start = false;
+                        line_start = false;
+                    }
+                }
+
+                return false;
+            }
+
+        private:
+            const char* pos;
+            const char* end;
+            File* script;
+            GraphArena& arena;
+            ScanMode mode;
+
+            static bool isIdentifierChar(char c) {
+                return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' ||
+                       (unsigned char) c >= 0x80;  // Non-ASCII identifiers.
+            }
+
+            static bool isKeyword(std::string_view word) {
+                static const std::string_view keywords[] = {
+                    "False", "None", "True", "and", "as", "assert", "async", "await", "break", "class", "continue",
+                    "def", "del", "elif", "else", "except", "finally", "for", "from", "global", "if", "import", "in",
+                    "is", "lambda", "nonlocal", "not", "or", "pass", "raise", "return", "try", "while", "with", "yield",
+                };
+                return std::find(std::begin(keywords), std::end(keywords), word) != std::end(keywords);
+            }
+
+            static bool isStringPrefix(std::string_view word) {
+                if (word.size() > 2) return false;
+
+                for (char c: word) {
+                    c = (char) tolower(c);
+                    if (c != 'r' && c != 'b' && c != 'u' && c != 'f') return false;
+                }
+                return true;
+            }
+
+            bool isQuote() const {
+                return pos < end && (*pos == '\'' || *pos == '"');
+            }
+
+            std::string_view readWord() {
+                const char* start = pos;
+                while (pos < end && isIdentifierChar(*pos)) pos++;
+
+                return {start, (size_t) (pos - start)};
+            }
+
+            void skipComment() {
+                while (pos < end && *pos != '\n') pos++;
+            }
+
+            void skipString() {
+                char quote = *pos;
+                bool triple = end - pos >= 3 && pos[1] == quote && pos[2] == quote;
+                pos += triple ? 3 : 1;
+
+                while (pos < end) {
+                    char c = *pos;
+
+                    if (c == '\\') {
+                        pos += std::min<ptrdiff_t>(2, end - pos);  // A backslash at the very end escapes nothing.
+                    } else if (c == quote && (!triple || (end - pos >= 3 && pos[1] == quote && pos[2] == quote))) {
+                        pos += triple ? 3 : 1;
+                        return;
+                    } else if (c == '\n' && !triple) {
+                        return;  // Unterminated string, don't let it swallow the rest of the file.
+                    } else {
+                        pos++;
+                    }
+                }
+            }
+
+            void skipBrackets() {
+                /* Up to and past the bracket that closes one that was already opened. */
+
+                int depth = 1;
+                while (pos < end && depth > 0) {
+                    char c = *pos;
+
+                    if (c == '\'' || c == '"') {
+                        skipString();
+                    } else if (c == '#') {
+                        skipComment();
+                    } else {
+                        if (c == '(' || c == '[' || c == '{') depth++;
+                        if (c == ')' || c == ']' || c == '}') depth--;
+                        pos++;
+                    }
+                }
+            }
+
+            void skipSpace(bool in_brackets) {
+                /* Skips whitespace inside an import statement. Newlines only count as whitespace inside brackets
+                 * or after a line continuation, elsewhere they end the statement. */
+
+                while (pos < end) {
+                    char c = *pos;
+
+                    if (c == ' ' || c == '\t' || c == '\r' || c == '\f') {
+                        pos++;
+                    } else if (c == '\\' && pos + 1 < end && (pos[1] == '\n' || pos[1] == '\r')) {
+                        pos++;
+                        while (pos < end && *pos != '\n') pos++;
+                        if (pos < end) pos++;  // A continuation on a lone "\r" can run into the end of the file.
+                    } else if (in_brackets && c == '\n') {
+                        pos++;
+                    } else if (in_brackets && c == '#') {
+                        skipComment();
+                    } else {
+                        return;
+                    }
+                }
+            }
+
+            bool accept(char c, bool in_brackets) {
+                skipSpace(in_brackets);
+                if (pos < end && *pos == c) {
+                    pos++;
+                    return true;
+                }
+                return false;
+            }
+
+            string readDottedName(bool in_brackets) {
+                /* "a.b . c" -> "a.b.c". Leading dots of relative imports are kept: ". .foo" -> "..foo". */
+
+                string name;
+
+                skipSpace(in_brackets);
+                while (pos < end) {
+                    if (*pos == '.') {
+                        name += '.';
+                        pos++;
+                    } else if (isIdentifierChar(*pos) && (name.empty() || name.back() == '.')) {
+                        const char* start = pos;
+                        std::string_view word = readWord();
+
+                        if (word == "import") {  // "from . import a", a keyword is never part of the name.
+                            pos = start;
+                            break;
+                        }
+                        name += word;
+                    } else {
+                        break;
+                    }
+                    skipSpace(in_brackets);
+                }
+
+                return name;
+            }
+
+            void skipAlias(bool in_brackets) {
+                /* Skips an optional "as name". */
+
+                skipSpace(in_brackets);
+                const char* start = pos;
+                if (readWord() == "as") {
+                    skipSpace(in_brackets);
+                    readWord();
+                } else {
+                    pos = start;
+                }
+            }
+
+            void parseImport() {
+                /* "import a.b as c, d" -> [a.b, d] */
 
-    return imports;
+                do {
+                    string name = readDottedName(false);
+                    if (name.empty()) return;
+
+                    skipAlias(false);
+
+                    Import* import = arena.imports.create();
+                    import->file_name = Name(name);
+                    import->entire_file = true;
+
+                    script->imports.push_back(import);
+                } while (accept(',', false));
+            }
+
+            bool parseDefinition(std::string_view word) {
+                /* A top level statement starting with word: "def a", "class a", "a = ...", "a: int", "a, b = ...".
+                 * Returns true for def and class, the rest of the line is then their body. */
+
+                if (word == "async") {
+                    skipSpace(false);
+                    word = readWord();
+                }
+
+                if (word == "def" || word == "class") {
+                    skipSpace(false);
+                    std::string_view name = readWord();
+                    if (!name.empty()) script->symbols.definitions.emplace_back(name);
+                    return true;
+                }
+
+                if (word == "__all__") {
+                    parseAll();
+                    return false;
+                }
+
+                if (isKeyword(word)) return false;
+
+                vector<std::string_view> targets = {word};
+                while (accept(',', false)) {
+                    skipSpace(false);
+                    std::string_view target = readWord();
+                    if (target.empty()) return false;  // "a, *b = ...", not worth it.
+                    targets.push_back(target);
+                }
+
+                skipSpace(false);
+                if (pos >= end) return false;
+
+                bool assigned = *pos == '=' && (end - pos < 2 || pos[1] != '=');
+                bool annotated = *pos == ':' && targets.size() == 1;
+                if (!assigned && !annotated) return false;
+
+                if (annotated) pos++;  // Otherwise the annotation would look like the start of a statement.
+
+                for (std::string_view target: targets) {
+                    script->symbols.definitions.emplace_back(target);
+                }
+                return false;
+            }
+
+            void parseAll() {
+                /* "__all__ = ['a', 'b']", or a tuple, or "+=". A computed __all__ isn't understood. */
+
+                bool extended = accept('+', false);
+                if (!accept('=', false) || (pos < end && *pos == '=')) return;
+                if (!accept('[', false) && !accept('(', false)) return;
+
+                vector<Name> names;
+                do {
+                    skipSpace(true);
+                    if (!isQuote()) break;
+
+                    const char* start = pos;
+                    bool triple = end - pos >= 3 && pos[1] == *pos && pos[2] == *pos;
+                    skipString();
+                    if (!triple && pos - start >= 2 && pos[-1] == *start) {
+                        names.emplace_back(std::string_view(start + 1, (size_t) (pos - start - 2)));
+                    }
+                } while (accept(',', true));
+
+                skipSpace(true);
+                bool plain = pos < end && (*pos == ']' || *pos == ')');
+                skipBrackets();
+                if (!plain) return;
+
+                Symbols& symbols = script->symbols;
+                if (!extended) symbols.exports.clear();
+                symbols.exports.insert(symbols.exports.end(), names.begin(), names.end());
+                symbols.has_exports = true;
+            }
+
+            void parseFromImport() {
+                /* "from a import (b as c, d)" -> a: [b, d] */
+
+                string module = readDottedName(false);
+                if (module.empty()) return;
+
+                skipSpace(false);
+                if (readWord() != "import") return;
+
+                bool in_brackets = accept('(', false);
+
+                Import* import = arena.imports.create();
+                import->file_name = Name(module);
+                import->entire_file = false;
+
+                do {
+                    skipSpace(in_brackets);
+                    if (pos < end && *pos == '*') {
+                        pos++;
+                        import->imported_content.emplace_back("*");
+                        continue;
+                    }
+
+                    std::string_view name = readWord();
+                    if (name.empty()) break;  // Trailing comma, or the end of the statement.
+
+                    import->imported_content.emplace_back(name);
+                    skipAlias(in_brackets);
+                } while (accept(',', in_brackets));
+
+                if (in_brackets) accept(')', true);
+
+                script->imports.push_back(import);
+            }
+    };
 }
 
-File* getImports(const string& file_path) {  // TODO (V2): Rewrite to take in File and change said File. Add different function for filepath -> file.
+bool parseImports(std::string_view source, File* script, GraphArena& arena, ScanMode mode) {
+    /* ScanMode::Header stops at the first top level def, class or decorator. Imports below that (in functions,
+     * or at the bottom of the module) are only found with ScanMode::Full. */
+
+    return ImportLexer(source, script, arena, mode).run();
+}
+
+File* getImports(const string& file_path, GraphArena& arena, ScanMode mode) {  // TODO (V2): Rewrite to take in File and change said File. Add different function for filepath -> file.
     /* Returns a File object containing all imports in a given file.
      * "import time \n import sys" -> {"time": ["file"], "sys": ["file"]},
      * "from time import sleep, perf_counter \n import sys" -> {"time: ["sleep", "perf_counter"], "sys": ["file"]},
      * "from time import *" -> {"time": ["*"]} */
 
-    File* script = new File();
-    script->file_path = file_path;
+    ProfileScope scope("parse file");
+    countProfile(ProfileCounter::FilesParsed);
 
-    ifstream in_stream;
-    in_stream.open(file_path);
+    File* script = arena.files.create();
+    script->file_path = Name(file_path);
+    script->package = getFileName(file_path) == "__init__.py";
 
-    string str;
-    string prev_import_line;
-    while(getline(in_stream, str)) {
-        string import_line = trim(str);
+    thread_local string buffer;  // One per scanning thread.
+    if (mode == ScanMode::Full) {
+        parseImports(readSource(file_path, buffer), script, arena, mode);
+    } else {
+        readSource(file_path, buffer, [script, &arena, mode](std::string_view source) {  // Up to the header's end.
+            arena.destroyImports(script);  // Of the shorter read before.
+            script->symbols = Symbols();
+            return parseImports(source, script, arena, mode);
+        });
+    }
 
-        /* Multi-import_line import merging */ {
-            if (!prev_import_line.empty()) {  // "import a, \ \n b, c" -> "import a, b, c"
-                import_line = prev_import_line + import_line;
-                prev_import_line.clear();
-            }
+    return script;
+}
 
-            if (endsWith(import_line, "\\")) {  // "import a, b, \\ \n c"
-                prev_import_line = import_line.substr(0, import_line.find_last_of('\\'));  // Merging with next import_line to get full command
-                continue;
-            }
+namespace {
+    bool getFileStatus(const string& file_path, long long& modified_time, unsigned long long& size) {
+        std::error_code error;
+
+        modified_time = std::filesystem::last_write_time(file_path, error).time_since_epoch().count();
+        if (error) return false;
+
+        size = std::filesystem::file_size(file_path, error);
+        return !error;
+    }
+
+    File* createFile(const string& file_path, const vector<Import>& imports, GraphArena& arena) {
+        File* script = arena.files.create();
+        script->file_path = Name(file_path);
+        script->package = getFileName(file_path) == "__init__.py";
+
+        script->imports.reserve(imports.size());
+        for (const Import& import: imports) {
+            script->imports.push_back(arena.imports.create(import));
         }
 
-        if(startsWith(import_line, "import ")) { // Full import
-            for(const string& fileImport: getImportsFromLine(import_line)) {
-                Import* import = new Import();
-                import->file_name = fileImport;
-                import->entire_file = true;
+        return script;
+    }
 
-                script->imports.push_back(import);
-            }
-        } else if (startsWith(import_line, "from ")) {  // Partial import
-            string file = trim(import_line.erase(0, 4));   // Remove 'from' from import_line and trim again
-            file = file.substr(0, file.find_first_of(" \t"));
+    File* createFile(const string& file_path, const ParseCache::Entry& entry, GraphArena& arena) {
+        File* script = createFile(file_path, entry.imports, arena);
+        script->symbols = entry.symbols;
+        return script;
+    }
+}
 
-            Import* import = new Import();
-            import->file_name = file;
-            import->entire_file = false;
+bool ParseCache::isUpToDate(const string& file_path, ScanMode mode) {
+    /* Cheap check through the file's size and modification time, without reading it. */
 
-            import_line = trim(import_line);
-            import_line = import_line.substr(import_line.find_first_of(' ') + 1);
-            for(const string& imported_object: getImportsFromLine(import_line)) {
-                import->imported_content.push_back(imported_object);
-            }
+    long long modified_time;
+    unsigned long long size;
+    if (!getFileStatus(file_path, modified_time, size)) return false;
 
-            script->imports.push_back(import);
-        } else {
-            // TODO: File issue warning.
+    std::lock_guard<std::mutex> lock(mutex);
+    auto entry = entries.find(file_path);
+    if (entry == entries.end() || entry->second.modified_time != modified_time || entry->second.size != size ||
+        entry->second.scan_mode != mode) {
+        return false;
+    }
+
+    entry->second.used = true;
+    return true;
+}
+
+File* ParseCache::getImports(const string& file_path, GraphArena& arena, ScanMode mode) {
+    /* Same as ::getImports, but only parses the file if it changed since it was cached.
+     * Files whose size and modification time match aren't even read. Touched files are read and hashed,
+     * and still reuse the cached imports if their content didn't actually change. */
+
+    long long modified_time;
+    unsigned long long size;
+    if (!getFileStatus(file_path, modified_time, size)) {
+        return ::getImports(file_path, arena, mode);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto entry = entries.find(file_path);
+
+        if (entry != entries.end() && entry->second.modified_time == modified_time && entry->second.size == size &&
+            entry->second.scan_mode == mode) {
+            entry->second.used = true;
+            return createFile(file_path, entry->second, arena);
+        }
+    }
+
+    thread_local string buffer;
+    std::string_view source = readSource(file_path, buffer);
+    unsigned long long content_hash = hashContent(source);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto entry = entries.find(file_path);
+
+        if (entry != entries.end() && entry->second.content_hash == content_hash && entry->second.size == source.size() &&
+            entry->second.scan_mode == mode) {
+            entry->second.modified_time = modified_time;  // Touched, but the content is the same.
+            entry->second.used = true;
+            changed = true;
+            return createFile(file_path, entry->second, arena);
         }
     }
 
+    File* script = createFile(file_path, vector<Import>(), arena);
+    parseImports(source, script, arena, mode);
+
+    Entry parsed;
+    parsed.modified_time = modified_time;
+    parsed.size = source.size();
+    parsed.content_hash = content_hash;
+    parsed.scan_mode = mode;
+    parsed.used = true;
+    for (const Import* import: script->imports) {
+        parsed.imports.push_back(*import);
+    }
+    parsed.symbols = script->symbols;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    entries[file_path] = std::move(parsed);
+    changed = true;
+
     return script;
 }
 
-void sortImports(vector<File*>& files) {
+Name resolveModuleName(const File& importer, Name import_name) {
+    /* Turns a relative import into an absolute module name, as seen from the importing file.
+     * In "pkg.mod": ".foo" -> "pkg.foo", "..foo" -> "foo" (one level up per extra dot), "." -> "pkg".
+     * In the package itself ("pkg/__init__.py"), "." refers to "pkg". */
+
+    std::string_view import_text = import_name.view();
+    if (import_text.empty() || import_text[0] != '.') {
+        return import_name;
+    }
+
+    size_t dot_count = import_text.find_first_not_of('.');
+    if (dot_count == string::npos) dot_count = import_text.size();
+
+    std::string_view base = importer.file_name.view();
+    size_t levels_up = importer.package ? dot_count - 1 : dot_count;
+    for (size_t i = 0; i < levels_up && !base.empty(); i++) {
+        size_t last_dot = base.find_last_of('.');
+        base = last_dot == string::npos ? std::string_view() : base.substr(0, last_dot);
+    }
+
+    std::string_view rest = import_text.substr(dot_count);
+    if (base.empty()) return Name(rest);
+    if (rest.empty()) return Name(base);
+    return Name(string(base) + "." + string(rest));
+}
+
+ModuleIndex::ModuleIndex(const vector<File*>& files) {
+    files_by_name.reserve(files.size());
+
     for (File* file: files) {
-        for (Import* import: file->imports) {
-            // Find the corresponding file based on file_name
-            auto matching_file_iterator = std::find_if(files.begin(), files.end(),
-                                              [&import](const File* f) { return f->file_name == import->file_name; });
-            File* matching_file = (matching_file_iterator != files.end()) ? *matching_file_iterator : nullptr;
+        files_by_name.emplace(file->file_name, file);  // The first file wins if two share a module name.
+    }
 
-            if (matching_file != nullptr) {
-                // Assign the corresponding file to the import
-                import->file = matching_file;
-                matching_file->imported_by.push_back(file);
+    for (File* file: files) {
+        size_t last_dot = file->file_name.view().find_last_of('.');
+        if (last_dot != string::npos) packages.insert(Name(file->file_name.view().substr(0, last_dot)));
+    }
+}
+
+File* ModuleIndex::find(const File& importer, Name module_name) const {
+    /* Files never import themselves, "from . import a" in pkg/__init__.py is about pkg.a. */
+
+    auto matching_file_iterator = files_by_name.find(module_name);
+    if (matching_file_iterator == files_by_name.end() || matching_file_iterator->second == &importer) {
+        return nullptr;
+    }
+
+    return matching_file_iterator->second;
+}
+
+File* ModuleIndex::find(const File& importer, std::string_view module_name) const {
+    Name name;
+    return Name::find(module_name, name) ? find(importer, name) : nullptr;
+}
+
+File* ModuleIndex::resolve(const File& importer, const Import& import) const {
+    /* "from pkg import mod" links to the submodule pkg.mod if there is one, otherwise to pkg.
+     * "import a.b" links to a.b, or to package a if a.b isn't a project file. */
+
+    Name module_name = resolveModuleName(importer, import.file_name);
+    if (module_name.empty()) return nullptr;
+
+    if (!import.entire_file && packages.count(module_name)) {
+        for (Name imported_object: import.imported_content) {
+            if (File* file = find(importer, module_name.str() + "." + imported_object.str())) {
+                return file;
             }
         }
     }
+
+    if (File* file = find(importer, module_name)) {
+        return file;
+    }
+
+    std::string_view module_text = module_name.view();
+    for (size_t last_dot = module_text.find_last_of('.'); last_dot != string::npos;
+         last_dot = module_text.find_last_of('.', last_dot - 1)) {
+        if (File* file = find(importer, module_text.substr(0, last_dot))) {
+            return file;
+        }
+        if (last_dot == 0) break;
+    }
+
+    return nullptr;
 }
 
-void addGeneral(vector<File*>& files) {
-    File* placeholder_general = new File();
-    placeholder_general->file_name = "General";
+void linkImports(File* file, const ModuleIndex& index) {
+    /* Links the imports of one file and registers it in imported_by of everything it imports. */
+
+    for (Import* import: file->imports) {
+        File* matching_file = index.resolve(*file, *import);
+        import->file = matching_file;
 
-    files.insert(files.begin(), placeholder_general);
+        // A file's imports are linked together, so a repeated import can only follow its own earlier entry.
+        if (matching_file != nullptr &&
+            (matching_file->imported_by.empty() || matching_file->imported_by.back() != file)) {
+            matching_file->imported_by.push_back(file);
+        }
+    }
+}
+
+void unlinkImports(File* file) {
+    /* Removes a file from imported_by of everything it imports, before its imports are replaced. */
+
+    for (Import* import: file->imports) {
+        if (import->file == nullptr) continue;
+
+        vector<File*>& imported_by = import->file->imported_by;
+        imported_by.erase(std::remove(imported_by.begin(), imported_by.end(), file), imported_by.end());
+        import->file = nullptr;
+    }
+}
+
+void sortImports(vector<File*>& files) {
+    /* Links every import to the project file it refers to, and fills in imported_by. */
+
+    ProfileScope scope("link");
+
+    ModuleIndex index(files);
+
+    for (File* file: files) {
+        file->imported_by.clear();
+    }
+
+    for (File* file: files) {
+        linkImports(file, index);
+    }
+}
+
+void addGeneral(Project& project) {
+    File* placeholder_general = project.arena.files.create();
+    placeholder_general->file_name = Name("General");
+    placeholder_general->non_project = true;
+
+    project.files.insert(project.files.begin(), placeholder_general);
 }
 
 bool isHeadFile(const File& file) {
-    return file.imported_by.empty() && file.file_name != "General";
+    return file.imported_by.empty() && !file.non_project;
 }
 
 /* vector<File&> getHeadFiles(const vector<File>& files) {
@@ -139,22 +690,580 @@ bool isHeadFile(const File& file) {
     return head_files;
 } */
 
-vector<File*> openNewProject(const string& project_path) {
-    vector<string> file_paths = getFilePaths(project_path);
-    vector<File*> files;
+namespace {
+    struct QueuedPath {
+        size_t index;
+        string file_path;
+        string module_name;
+    };
+
+    class PathQueue {
+        /* Paths waiting to be parsed. The crawler pushes while the workers are already popping. */
 
-    for(string file_path: file_paths) {
-        string moduleName = getFileName(file_path);
-        moduleName = moduleName.substr(0, moduleName.find_last_of('.'));
+        public:
+            void push(const string& file_path, const string& module_name) {
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    paths.push_back({pushed++, file_path, module_name});
+                }
+                path_added.notify_one();
+            }
+
+            void close() {
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    closed = true;
+                }
+                path_added.notify_all();
+            }
 
-        File* file = getImports(file_path);
-        file->file_name = moduleName;
+            bool pop(QueuedPath& path) {
+                /* Blocks until a path is available, returns false once the queue is closed and empty. */
 
-        files.push_back(file);
+                std::unique_lock<std::mutex> lock(mutex);
+                path_added.wait(lock, [this]() { return !paths.empty() || closed; });
+
+                if (paths.empty()) return false;
+
+                path = std::move(paths.front());
+                paths.pop_front();
+                return true;
+            }
+
+            size_t size() {
+                std::lock_guard<std::mutex> lock(mutex);
+                return pushed;
+            }
+
+        private:
+            std::mutex mutex;
+            std::condition_variable path_added;
+            std::deque<QueuedPath> paths;
+            size_t pushed = 0;
+            bool closed = false;
+    };
+
+    unsigned getThreadCount(unsigned thread_count) {
+        return thread_count != 0 ? thread_count : std::max(1u, std::thread::hardware_concurrency());
     }
 
-    sortImports(files);
-    addGeneral(files);
+    vector<File*> parseQueue(PathQueue& queue, GraphArena& arena, unsigned thread_count, ScanMode mode,
+                             ParseCache* cache = nullptr, LoadProgress* progress = nullptr) {
+        /* Parses everything pushed to the queue on a pool of worker threads, until the queue is closed.
+         * Every worker keeps its own results and arena, they are merged afterwards in the order the paths were
+         * pushed, so the result doesn't depend on how the work was scheduled. Once cancelled, the workers stop
+         * taking paths and LoadCancelled is thrown after they're done. */
+
+        vector<vector<std::pair<size_t, File*>>> results(thread_count);
+        vector<GraphArena> worker_arenas(thread_count);
 
-    return files;
-}
\ No newline at end of file
+        auto worker = [&queue, cache, mode, progress](vector<std::pair<size_t, File*>>& parsed,
+                                                      GraphArena& worker_arena) {
+            ProfileScope scope("parse worker");
+
+            QueuedPath path;
+            while ((progress == nullptr || !progress->cancelled) && queue.pop(path)) {
+                File* file = cache != nullptr ? cache->getImports(path.file_path, worker_arena, mode)
+                                              : getImports(path.file_path, worker_arena, mode);
+                file->file_name = Name(path.module_name);
+
+                parsed.emplace_back(path.index, file);
+
+                if (progress != nullptr) {
+                    progress->addParsedFile(path.module_name);
+                }
+            }
+        };
+
+        vector<std::thread> workers;
+        workers.reserve(thread_count - 1);
+        for (unsigned i = 1; i < thread_count; i++) {
+            workers.emplace_back(worker, std::ref(results[i]), std::ref(worker_arenas[i]));
+        }
+
+        worker(results[0], worker_arenas[0]);  // The calling thread takes part as well.
+
+        for (std::thread& thread: workers) {
+            thread.join();
+        }
+
+        if (progress != nullptr) {
+            progress->checkCancelled();
+        }
+
+        vector<File*> files(queue.size(), nullptr);
+        for (unsigned i = 0; i < thread_count; i++) {
+            for (const auto& [index, file]: results[i]) {
+                files[index] = file;
+            }
+            arena.absorb(worker_arenas[i]);
+        }
+
+        return files;
+    }
+
+    void saveParseCacheIfChanged(const ParseCache& cache, const string& cache_path) {
+        bool stale = cache.changed || std::any_of(cache.entries.begin(), cache.entries.end(),
+                                                  [](const auto& entry) { return !entry.second.used; });
+        if (stale) {
+            saveParseCache(cache, cache_path);
+        }
+    }
+}
+
+void LoadProgress::addParsedFile(const string& module_name) {
+    parsed_files++;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    parsed_names.push_back(module_name);
+}
+
+void LoadProgress::takeParsedFiles(vector<string>& module_names) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    module_names.insert(module_names.end(), std::make_move_iterator(parsed_names.begin()),
+                        std::make_move_iterator(parsed_names.end()));
+    parsed_names.clear();
+}
+
+void LoadProgress::checkCancelled() const {
+    if (cancelled) {
+        throw LoadCancelled();
+    }
+}
+
+vector<File*> scanFiles(const string& project_path, const vector<string>& file_paths, GraphArena& arena,
+                        unsigned thread_count, ScanMode mode) {
+    /* Parses the given files of a project on a pool of worker threads, returns them in the order of file_paths.
+     * Modules are named relative to the project folder, like crawlProject names them. */
+
+    PathQueue queue;
+    for (const string& file_path: file_paths) {
+        queue.push(file_path, getModuleName(project_path, file_path));
+    }
+    queue.close();
+
+    return parseQueue(queue, arena, getThreadCount(thread_count), mode);
+}
+
+std::unique_ptr<Project> openNewProject(const string& project_path, unsigned thread_count, ScanMode mode,
+                                        LoadProgress* progress) {
+    /* Crawls the project on its own thread and streams every python file it finds straight to the parsers.
+     * Files that didn't change since the project was last opened come out of the parse cache instead.
+     * With progress, reports every file found and parsed, and throws LoadCancelled once it's cancelled. */
+
+    ProfileScope scope("open project");
+
+    ParseCache cache;
+    string cache_path = getParseCachePath(project_path);
+    loadParseCache(cache, cache_path);
+
+    PathQueue queue;
+    std::exception_ptr crawl_error;
+
+    std::thread crawler([&]() {
+        try {
+            crawlProject(project_path, [&queue, progress](const string& file_path, const string& module_name) {
+                if (progress != nullptr) {
+                    progress->checkCancelled();
+                    progress->found_files++;
+                }
+                queue.push(file_path, module_name);
+            }, [progress](const string&) {
+                if (progress != nullptr) {
+                    progress->checkCancelled();  // Folders without python files can take a while as well.
+                }
+            });
+        } catch (...) {
+            crawl_error = std::current_exception();
+        }
+        queue.close();
+    });
+
+    auto project = std::make_unique<Project>();
+    project->path = project_path;
+    project->scan_mode = mode;
+    try {
+        project->files = parseQueue(queue, project->arena, getThreadCount(thread_count), mode, &cache, progress);
+    } catch (...) {
+        queue.close();  // The crawler may still be pushing, but nobody is taking anymore.
+        crawler.join();
+        throw;
+    }
+    crawler.join();
+
+    if (crawl_error) {
+        std::rethrow_exception(crawl_error);
+    }
+
+    saveParseCacheIfChanged(cache, cache_path);
+
+    sortImports(project->files);
+    addGeneral(*project);
+
+    return project;
+}
+
+ProjectRescan::ProjectRescan(const Project& project) : path(project.path), scan_mode(project.scan_mode) {
+    for (File* file: project.files) {
+        if (file->non_project) {
+            rescanned_files.push_back(file);  // "General"
+        } else {
+            open_files.emplace(file->file_path.view(), OpenFile{file, file->file_name});
+        }
+    }
+    general_count = rescanned_files.size();
+}
+
+void ProjectRescan::scan(unsigned thread_count, LoadProgress* progress) {
+    /* Only files that changed since they were last parsed are parsed again, into an arena of its own. Nothing of the
+     * project is touched, it can be shown and edited in the meantime. */
+
+    ProfileScope scope("rescan");
+
+    ParseCache cache;
+    string cache_path = getParseCachePath(path);
+    loadParseCache(cache, cache_path);
+
+    PathQueue queue;
+    size_t kept_count = 0;
+
+    auto checkCancelled = [progress](const string&) {
+        if (progress != nullptr) progress->checkCancelled();
+    };
+
+    crawlProject(path, [&](const string& file_path, const string& module_name) {
+        checkCancelled(file_path);
+
+        auto open_file = open_files.find(file_path);
+        bool known = open_file != open_files.end() && open_file->second.module_name == module_name;
+
+        if (known && cache.isUpToDate(file_path, scan_mode)) {
+            rescanned_files.push_back(open_file->second.file);
+        } else {
+            queue.push(file_path, module_name);
+            queued_slots.push_back(rescanned_files.size());
+            rescanned_files.push_back(known ? open_file->second.file : nullptr);
+
+            if (progress != nullptr) progress->found_files++;
+        }
+
+        kept_count += known;
+        structure_changed |= !known;
+    }, checkCancelled);
+    queue.close();
+
+    structure_changed |= kept_count != open_files.size();  // Removed files.
+
+    parsed_files = parseQueue(queue, arena, getThreadCount(thread_count), scan_mode, &cache, progress);
+
+    saveParseCacheIfChanged(cache, cache_path);
+}
+
+size_t ProjectRescan::apply(Project& project) {
+    /* If only files changed, only their own imports are relinked. Added, removed or renamed files change what every
+     * import resolves to, so those relink the whole project. */
+
+    project.arena.absorb(arena);
+    vector<File*> changed_files;
+
+    for (size_t i = 0; i < parsed_files.size(); i++) {
+        File*& slot = rescanned_files[queued_slots[i]];
+
+        if (slot == nullptr) {
+            slot = parsed_files[i];
+        } else {
+            unlinkImports(slot);
+            project.arena.destroyImports(slot);
+            slot->imports = std::move(parsed_files[i]->imports);
+            slot->symbols = std::move(parsed_files[i]->symbols);
+            project.arena.files.destroy(parsed_files[i]);  // Only parsed to take its imports.
+
+            changed_files.push_back(slot);
+        }
+    }
+
+    vector<File*> project_files(rescanned_files.begin() + (long) general_count, rescanned_files.end());
+    if (structure_changed) {
+        sortImports(project_files);
+    } else {
+        ModuleIndex index(project_files);
+        for (File* file: changed_files) {
+            linkImports(file, index);
+        }
+    }
+
+    project.files = rescanned_files;
+
+    return parsed_files.size();
+}
+
+size_t rescanProject(Project& project, unsigned thread_count, LoadProgress* progress) {
+    /* Brings an open project up to date with the files on disk, keeping the notes and todos of every file.
+     * Returns the number of files that were parsed. */
+
+    ProjectRescan rescan(project);
+    rescan.scan(thread_count, progress);
+    return rescan.apply(project);
+}
+
+size_t updateProjectFiles(Project& project, const vector<string>& changed_paths, unsigned thread_count) {
+    /* Patches an open project after the given paths changed on disk, e.g. as reported by a ProjectWatcher.
+     * Existing python files are parsed again, missing ones and those the crawler would skip are removed. Folders are crawled for their files, and
+     * open files that used to be in them but no longer are get removed as well. Like rescanProject, only the edges
+     * of changed files are relinked unless files were added or removed. Returns the number of parsed files. */
+
+    ProfileScope scope("update files");
+
+    namespace fs = std::filesystem;
+
+    vector<File*>& files = project.files;
+
+    std::unordered_map<std::string_view, File*> open_files;  // By path, views into File::file_path.
+    for (File* file: files) {
+        if (!file->non_project) {
+            open_files.emplace(file->file_path.view(), file);
+        }
+    }
+
+    vector<string> parse_paths;
+    std::unordered_map<const File*, bool> removed_files;
+
+    auto removeFilesUnder = [&](const string& path) {
+        if (open_files.count(path)) {
+            removed_files[open_files[path]] = true;
+        }
+        if (endsWith(path, ".py")) return;  // Only folders need the full search.
+
+        for (const auto& [file_path, file]: open_files) {
+            if (startsWith(file->file_path.str(), path + "/")) {
+                removed_files[file] = true;
+            }
+        }
+    };
+
+    for (const string& path: changed_paths) {
+        std::error_code error;
+
+        if (fs::is_directory(path, error)) {
+            removeFilesUnder(path);  // Whatever is still there is found again below.
+            try {  // With the ignore rules of the folders above it, an ignored folder adds nothing.
+                crawlProjectFolder(project.path, path, [&](const string& file_path, const string&) {
+                    parse_paths.push_back(file_path);
+                });
+            } catch (const std::exception&) {}
+        } else if (fs::is_regular_file(path, error) && isProjectFile(project.path, path)) {
+            parse_paths.push_back(path);
+        } else {
+            removeFilesUnder(path);
+        }
+    }
+
+    std::sort(parse_paths.begin(), parse_paths.end());
+    parse_paths.erase(std::unique(parse_paths.begin(), parse_paths.end()), parse_paths.end());
+
+    vector<File*> parsed_files = scanFiles(project.path, parse_paths, project.arena, thread_count, project.scan_mode);
+    vector<File*> changed_files;
+    bool structure_changed = false;
+
+    for (File* parsed_file: parsed_files) {
+        auto open_file = open_files.find(parsed_file->file_path.view());
+
+        if (open_file != open_files.end() && open_file->second->file_name == parsed_file->file_name) {
+            File* file = open_file->second;
+            removed_files.erase(file);
+
+            unlinkImports(file);
+            project.arena.destroyImports(file);
+            file->imports = std::move(parsed_file->imports);
+            file->symbols = std::move(parsed_file->symbols);
+            project.arena.files.destroy(parsed_file);
+
+            changed_files.push_back(file);
+        } else {
+            if (open_file != open_files.end()) {
+                removed_files[open_file->second] = true;  // Renamed module, e.g. an __init__.py was added.
+            }
+
+            files.push_back(parsed_file);
+            structure_changed = true;
+        }
+    }
+
+    if (!removed_files.empty()) {
+        files.erase(std::remove_if(files.begin(), files.end(),
+                                   [&removed_files](const File* file) { return removed_files.count(file) != 0; }),
+                    files.end());
+        structure_changed = true;
+    }
+
+    vector<File*> project_files;
+    for (File* file: files) {
+        if (!file->non_project) project_files.push_back(file);  // Not "General"
+    }
+
+    if (structure_changed) {
+        sortImports(project_files);
+    } else {
+        ModuleIndex index(project_files);
+        for (File* file: changed_files) {
+            linkImports(file, index);
+        }
+    }
+
+    return parsed_files.size();
+}
+
+ImportComponents findImportComponents(const vector<File*>& files) {
+    /* Tarjan, iterative so deep import chains can't overflow the stack. Components are numbered as they're popped,
+     * which is after everything they import, so imports always point to a lower number. O(files + imports). */
+
+    ImportComponents graph;
+    const size_t unvisited = SIZE_MAX;
+
+    std::unordered_map<const File*, size_t> file_indices;
+    file_indices.reserve(files.size());
+    for (size_t i = 0; i < files.size(); i++) {
+        if (!files[i]->non_project) {
+            file_indices.emplace(files[i], i);
+        }
+    }
+
+    vector<size_t>& edge_starts = graph.edge_starts;
+    vector<size_t>& edges = graph.edges;
+    edge_starts.assign(files.size() + 1, 0);
+    for (size_t i = 0; i < files.size(); i++) {
+        edge_starts[i] = edges.size();
+        if (file_indices.count(files[i]) == 0) continue;
+
+        for (const Import* import: files[i]->imports) {
+            auto imported = import->file != nullptr ? file_indices.find(import->file) : file_indices.end();
+            if (imported != file_indices.end()) {
+                edges.push_back(imported->second);
+            }
+        }
+    }
+    edge_starts[files.size()] = edges.size();
+
+    vector<size_t>& components = graph.components;
+    components.assign(files.size(), unvisited);
+
+    vector<size_t> discovery(files.size(), unvisited), low_link(files.size(), 0);
+    vector<size_t> scc_stack, call_stack, next_edge(files.size(), 0);
+    vector<bool> on_stack(files.size(), false);
+    size_t discovered = 0;
+
+    for (size_t root = 0; root < files.size(); root++) {
+        if (discovery[root] != unvisited || file_indices.count(files[root]) == 0) continue;
+
+        call_stack.push_back(root);
+        while (!call_stack.empty()) {
+            size_t node = call_stack.back();
+
+            if (discovery[node] == unvisited) {
+                discovery[node] = low_link[node] = discovered++;
+                next_edge[node] = edge_starts[node];
+                scc_stack.push_back(node);
+                on_stack[node] = true;
+            }
+
+            if (next_edge[node] < edge_starts[node + 1]) {
+                size_t imported = edges[next_edge[node]++];
+
+                if (discovery[imported] == unvisited) {
+                    call_stack.push_back(imported);
+                } else if (on_stack[imported]) {
+                    low_link[node] = std::min(low_link[node], discovery[imported]);
+                }
+                continue;
+            }
+
+            call_stack.pop_back();
+            if (!call_stack.empty()) {
+                low_link[call_stack.back()] = std::min(low_link[call_stack.back()], low_link[node]);
+            }
+
+            if (low_link[node] == discovery[node]) {  // Root of a component, pop it off.
+                size_t member;
+                do {
+                    member = scc_stack.back();
+                    scc_stack.pop_back();
+                    on_stack[member] = false;
+
+                    components[member] = graph.component_count;
+                } while (member != node);
+
+                graph.component_count++;
+            }
+        }
+    }
+
+    return graph;
+}
+
+ImportLayers computeImportLevels(const vector<File*>& files) {
+    /* Assigns every file its import level: files nobody imports are level 0, anything they import sits at least
+     * one level below them. Levels are longest paths, so every import points down.
+     * Files that import each other in a loop are condensed into one group first (Tarjan) and share a level,
+     * the groups are then layered in topological order (Kahn). O(files + imports). */
+
+    ProfileScope scope("layer");
+
+    ImportLayers layers;
+    layers.levels.assign(files.size(), -1);
+
+    const size_t unvisited = SIZE_MAX;
+    ImportComponents graph = findImportComponents(files);
+    const vector<size_t>& components = graph.components;
+    const vector<size_t>& edge_starts = graph.edge_starts;
+    const vector<size_t>& edges = graph.edges;
+    size_t component_count = graph.component_count;
+
+    // Groups of more than one file are loops, in the order they were found, members sorted.
+    vector<vector<size_t>> groups(component_count);
+    for (size_t i = 0; i < files.size(); i++) {
+        if (components[i] != unvisited) groups[components[i]].push_back(i);
+    }
+    for (vector<size_t>& group: groups) {
+        if (group.size() > 1) layers.cycles.push_back(std::move(group));
+    }
+
+    /* Kahn over the condensed graph, levels are the longest path from a group nobody imports. */
+    vector<size_t> import_counts(component_count, 0);  // Incoming edges per group.
+    vector<vector<size_t>> component_edges(component_count);
+    for (size_t i = 0; i < files.size(); i++) {
+        for (size_t e = edge_starts[i]; e < edge_starts[i + 1]; e++) {
+            if (components[i] != components[edges[e]]) {
+                component_edges[components[i]].push_back(components[edges[e]]);
+                import_counts[components[edges[e]]]++;
+            }
+        }
+    }
+
+    vector<int> component_levels(component_count, 0);
+    std::deque<size_t> queue;
+    for (size_t c = 0; c < component_count; c++) {
+        if (import_counts[c] == 0) queue.push_back(c);
+    }
+
+    while (!queue.empty()) {
+        size_t component = queue.front();
+        queue.pop_front();
+
+        for (size_t imported: component_edges[component]) {
+            component_levels[imported] = std::max(component_levels[imported], component_levels[component] + 1);
+
+            if (--import_counts[imported] == 0) {
+                queue.push_back(imported);
+            }
+        }
+    }
+
+    for (size_t i = 0; i < files.size(); i++) {
+        if (components[i] != unvisited) {
+            layers.levels[i] = component_levels[components[i]];
+        }
+    }
+
+    return layers;
+}
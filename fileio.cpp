@@ -1,4 +1,8 @@
+#include <algorithm>
 #include <any>
+#include <cctype>
+#include <cerrno>
+#include <cstring>
 #include <filesystem>
 #include <map>
 #include <regex>
@@ -8,17 +12,292 @@
 
 #include "common.h"
 
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+namespace {
+    struct IgnoreRule {
+        string pattern;
+        bool negate;          // "!pattern", re-includes what an earlier rule ignored.
+        bool directory_only;  // "pattern/"
+        bool anchored;        // Contains a '/', matched against the path relative to the .gitignore's folder.
+    };
+
+    struct IgnoreFile {
+        string base;  // Folder of the .gitignore, relative to the project root ("" or "pkg/sub/").
+        vector<IgnoreRule> rules;
+    };
+
+    bool globMatch(const char* pattern, const char* text) {
+        /* .gitignore style glob: '*' and '?' stop at '/', "**" matches across folders. */
+
+        while (*pattern) {
+            if (pattern[0] == '*' && pattern[1] == '*') {
+                pattern += 2;
+                if (*pattern == '/') pattern++;  // "**/a" also matches "a".
+
+                for (const char* rest = text; ; rest++) {
+                    if (globMatch(pattern, rest)) return true;
+                    if (!*rest) return false;
+                }
+            }
+
+            if (*pattern == '*') {
+                pattern++;
+                for (const char* rest = text; ; rest++) {
+                    if (globMatch(pattern, rest)) return true;
+                    if (!*rest || *rest == '/') return false;
+                }
+            }
+
+            if (!*text || (*pattern != '?' && *pattern != *text) || (*pattern == '?' && *text == '/')) {
+                return false;
+            }
+
+            pattern++;
+            text++;
+        }
+
+        return !*text;
+    }
+
+    vector<IgnoreRule> readIgnoreFile(const fs::path& path) {
+        vector<IgnoreRule> rules;
+
+        std::ifstream in_stream(path);
+        string line;
+        while (getline(in_stream, line)) {
+            line = trim(line);
+            if (line.empty() || line[0] == '#') continue;
+
+            IgnoreRule rule{};
+            if (line[0] == '!') {
+                rule.negate = true;
+                line.erase(0, 1);
+            }
+            if (endsWith(line, "/")) {
+                rule.directory_only = true;
+                line.pop_back();
+            }
+            rule.anchored = line.find('/') != string::npos;
+            if (startsWith(line, "/")) line.erase(0, 1);
+
+            if (!line.empty()) {
+                rule.pattern = line;
+                rules.push_back(rule);
+            }
+        }
+
+        return rules;
+    }
+
+    bool isIgnored(const vector<IgnoreFile>& ignore_files, const string& relative_path, bool is_directory) {
+        /* The last matching rule wins, deeper .gitignore files are checked after the ones above them. */
+
+        bool ignored = false;
+        string file_name = getFileName(relative_path);
+
+        for (const IgnoreFile& ignore_file: ignore_files) {
+            string path = relative_path.substr(ignore_file.base.size());
+
+            for (const IgnoreRule& rule: ignore_file.rules) {
+                if (rule.directory_only && !is_directory) continue;
+
+                const string& subject = rule.anchored ? path : file_name;
+                if (globMatch(rule.pattern.c_str(), subject.c_str())) {
+                    ignored = !rule.negate;
+                }
+            }
+        }
+
+        return ignored;
+    }
+
+    bool isIgnoredFolder(const fs::path& folder, const string& folder_name) {
+        /* Folders that never contain project code, whether or not a .gitignore mentions them. */
+
+        if (folder_name == "__pycache__" || folder_name == "node_modules" || folder_name == "site-packages" ||
+            startsWith(folder_name, ".")) {  // .git, .venv, .tox, .mypy_cache, ...
+            return true;
+        }
+
+        std::error_code error;
+        return fs::exists(folder / "pyvenv.cfg", error);  // Virtual environments, whatever they are called.
+    }
+
+    void crawlFolder(const fs::path& folder, const string& relative_folder, const string& module_prefix,
+                     vector<IgnoreFile>& ignore_files, const FileCallback& on_file, const FolderCallback& on_folder) {
+        std::error_code error;
+
+        if (on_folder) {
+            on_folder(folder.generic_string());
+        }
+
+        bool has_ignore_file = fs::exists(folder / ".gitignore", error);
+        if (has_ignore_file) {
+            ignore_files.push_back({relative_folder, readIgnoreFile(folder / ".gitignore")});
+        }
+
+        // Sorted, so the crawl order doesn't depend on the file system.
+        vector<fs::directory_entry> entries;
+        for (const fs::directory_entry& entry: fs::directory_iterator(folder, error)) {
+            entries.push_back(entry);
+        }
+        std::sort(entries.begin(), entries.end());
+
+        for (const fs::directory_entry& entry: entries) {
+            string name = entry.path().filename().generic_string();
+            string relative_path = relative_folder + name;
+
+            if (entry.is_directory(error) && !entry.is_symlink(error)) {
+                if (isIgnoredFolder(entry.path(), name) || isIgnored(ignore_files, relative_path, true)) continue;
+
+                bool package = fs::exists(entry.path() / "__init__.py", error);
+                crawlFolder(entry.path(), relative_path + "/", package ? module_prefix + name + "." : "",
+                            ignore_files, on_file, on_folder);
+            } else if (endsWith(name, ".py") && entry.is_regular_file(error) &&
+                       !isIgnored(ignore_files, relative_path, false)) {
+                string module_name = module_prefix + name.substr(0, name.size() - 3);
+                if (name == "__init__.py") {
+                    module_name = module_prefix.substr(0, module_prefix.size() - 1);  // "pkg.__init__" -> "pkg"
+                }
+
+                on_file(entry.path().generic_string(), module_name);
+            }
+        }
+
+        if (has_ignore_file) {
+            ignore_files.pop_back();
+        }
+    }
+
+    string getRootPrefix(const fs::path& root) {
+        /* "root." if the project folder is a package itself, its parent folders never count. */
+
+        if (!fs::exists(root / "__init__.py")) return "";
+
+        fs::path normal_root = fs::absolute(root).lexically_normal();
+        if (!normal_root.has_filename()) normal_root = normal_root.parent_path();  // Trailing separator.
+
+        return normal_root.filename().generic_string() + ".";
+    }
+
+    fs::path getProjectRelativePath(const string& project_path, const string& path) {
+        /* "." for the project folder itself, empty if the path isn't inside it. */
+
+        fs::path root(project_path);
+        if (!root.has_filename()) root = root.parent_path();  // Trailing separator.
+
+        fs::path relative = fs::path(path).lexically_relative(root);
+        if (relative.empty() || *relative.begin() == "..") return {};
+        return relative;
+    }
+
+    bool walkToFolder(const fs::path& root, const fs::path& relative_folder, vector<IgnoreFile>& ignore_files,
+                      string& relative_path, string& module_prefix) {
+        /* Goes from the project root down to one of its folders the way crawlFolder does, collecting the .gitignore
+         * files above it, its path relative to the root and its module prefix. The folder's own .gitignore is left
+         * to crawlFolder. False if the crawler skips the folder or one above it. */
+
+        std::error_code error;
+        fs::path folder = root;
+        relative_path = "";
+        module_prefix = getRootPrefix(root);
+
+        for (const fs::path& part: relative_folder) {
+            if (part == ".") continue;  // The root itself.
+
+            if (fs::exists(folder / ".gitignore", error)) {
+                ignore_files.push_back({relative_path, readIgnoreFile(folder / ".gitignore")});
+            }
+
+            string name = part.generic_string();
+            folder /= part;
+            if (isIgnoredFolder(folder, name) || isIgnored(ignore_files, relative_path + name, true)) return false;
+
+            module_prefix = fs::exists(folder / "__init__.py", error) ? module_prefix + name + "." : "";
+            relative_path += name + "/";
+        }
+
+        return true;
+    }
+}
+
+void crawlProject(const string& folder_path, const FileCallback& on_file, const FolderCallback& on_folder) {
+    /* Calls on_file for every python file under the given folder, as soon as it's found, and on_folder (if given)
+     * for every folder that is crawled.
+     * Skips caches, virtual environments, hidden folders and anything the project's .gitignore files exclude.
+     * Module names follow python's package rules: "pkg/sub/mod.py" -> "pkg.sub.mod" if pkg and sub have an
+     * __init__.py, otherwise the file's folder is treated as a source root. */
+
+    fs::path root = fs::path(folder_path);
+    if (!fs::is_directory(root)) {
+        throw std::runtime_error("Project folder not found: " + folder_path);
+    }
+
+    vector<IgnoreFile> ignore_files;
+    crawlFolder(root, "", getRootPrefix(root), ignore_files, on_file, on_folder);
+}
+
+bool crawlProjectFolder(const string& project_path, const string& folder_path, const FileCallback& on_file,
+                        const FolderCallback& on_folder) {
+    /* Crawls a folder of a project as crawlProject(project_path) would get to it: with the .gitignore files above it
+     * and the module names of the whole project. Returns false, without crawling, if the crawler skips the folder
+     * or it isn't in the project. */
+
+    fs::path relative = getProjectRelativePath(project_path, folder_path);
+    std::error_code error;
+    if (relative.empty() || !fs::is_directory(folder_path, error)) return false;
+
+    fs::path root(project_path);
+    vector<IgnoreFile> ignore_files;
+    string relative_path, module_prefix;
+    if (!walkToFolder(root, relative, ignore_files, relative_path, module_prefix)) return false;
+
+    crawlFolder(fs::path(folder_path), relative_path, module_prefix, ignore_files, on_file, on_folder);
+    return true;
+}
+
+bool isProjectFile(const string& project_path, const string& file_path) {
+    /* Whether crawlProject(project_path) finds the file: a python file in the project that isn't ignored. */
+
+    fs::path relative = getProjectRelativePath(project_path, file_path);
+    if (relative.empty() || !endsWith(file_path, ".py")) return false;
+
+    fs::path root(project_path);
+    vector<IgnoreFile> ignore_files;
+    string relative_path, module_prefix;
+    if (!walkToFolder(root, relative.parent_path(), ignore_files, relative_path, module_prefix)) return false;
+
+    std::error_code error;
+    fs::path folder = root / relative.parent_path();
+    if (fs::exists(folder / ".gitignore", error)) {
+        ignore_files.push_back({relative_path, readIgnoreFile(folder / ".gitignore")});
+    }
+    return !isIgnored(ignore_files, relative_path + relative.filename().generic_string(), false);
+}
+
 vector<string> getFilePaths(const string& folder_path) {
-    /* Returns the filepaths of all python files in the given folder. */
+    /* Returns the filepaths of all python files in the given folder and its subfolders. */
+
+    ProfileScope scope("crawl");
 
     vector<string> files;
     files.reserve(64);  // TODO: Reserve everywhere.
 
-    for (const auto &entry: std::filesystem::directory_iterator(folder_path)) {
-        if (endsWith(entry.path().generic_string(), ".py")) {
-            files.push_back(entry.path().generic_string());
-        }
-    }
+    crawlProject(folder_path, [&files](const string& file_path, const string&) {
+        files.push_back(file_path);
+    });
+
     return files;
 }
 
@@ -28,112 +307,696 @@ string getFileName(const string& file_path) {
     return file_path.substr(file_path.find_last_of("/\\") + 1);
 }
 
-Json::Value serializeFile(const File* file) {
-    // Create an empty Json::Value object named 'data' with type 'objectValue'
-    Json::Value data(Json::objectValue);
+string getModuleName(const string& project_path, const string& file_path) {
+    /* Returns the dotted module name of a python file in the given project, the same one crawlProject gives it.
+     * "pkg/sub/mod.py" -> "pkg.sub.mod", "pkg/__init__.py" -> "pkg". Packages above the project folder don't count,
+     * a file outside of it is named as if its own folder was the project. */
 
-    data["name"] = file->file_name;
-    data["path"] = file->file_path;
-    data["notes"] = file->notes;
+    fs::path path(file_path);
+    fs::path root(project_path);
+    if (!root.has_filename()) root = root.parent_path();  // Trailing separator.
 
-    Json::Value to_dos(Json::arrayValue);
-    for (const ToDo* to_do : file->to_dos) {
-        Json::Value to_do_data(Json::objectValue);
+    fs::path relative = path.lexically_relative(root);
+    if (relative.empty() || *relative.begin() == "..") {
+        return getModuleName(path.parent_path().generic_string(), file_path);
+    }
 
-        to_do_data["content"] = to_do->content;
-        to_do_data["done"] = to_do->done ? 1 : 0;
+    std::error_code error;
+    string prefix = getRootPrefix(root);
+    fs::path folder = root;
+    for (auto part = relative.begin(); std::next(part) != relative.end(); ++part) {
+        folder /= *part;
+        prefix = fs::exists(folder / "__init__.py", error) ? prefix + part->generic_string() + "." : "";
+    }
 
-        to_dos.append(to_do_data);
+    string name = path.stem().generic_string();
+    if (name == "__init__") {
+        return prefix.substr(0, prefix.size() - (prefix.empty() ? 0 : 1));  // "pkg.__init__" -> "pkg"
     }
-    data["todos"] = to_dos;
+    return prefix + name;
+}
+
+std::string_view readSource(const string& file_path, string& buffer, const SourceCheck& enough) {
+    /* Sources are copied rather than mapped: an editor saving a file while it's parsed can truncate it, and reading
+     * a mapping past the new end of the file kills the process with SIGBUS. A short read is just a short file.
+     * With enough, the first chunk is 16 KiB and every next one doubles what was read, so checking everything read
+     * so far after each chunk costs at most about twice a single pass. */
+
+    const size_t first_chunk_size = 16 * 1024;
+
+#ifdef _WIN32
+    HANDLE file = CreateFileA(file_path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                              nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE) return {};
+
+    LARGE_INTEGER size_info;
+    size_t file_size = GetFileSizeEx(file, &size_info) && size_info.QuadPart > 0 ? (size_t) size_info.QuadPart : 0;
+
+    auto readNext = [file](char* data, size_t length) -> long long {  // Sequential, from where the last read ended.
+        DWORD read_size;
+        if (!ReadFile(file, data, (DWORD) std::min<size_t>(length, 1 << 30), &read_size, nullptr)) return -1;
+        return read_size;
+    };
+#else
+    int file = open(file_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (file < 0) return {};
+
+    struct stat status{};
+    size_t file_size = fstat(file, &status) == 0 && status.st_size > 0 ? (size_t) status.st_size : 0;
+
+    size_t offset = 0;
+    auto readNext = [file, &offset](char* data, size_t length) -> long long {
+        ssize_t read_size;
+        do {
+            read_size = pread(file, data, length, (off_t) offset);
+        } while (read_size < 0 && errno == EINTR);
+
+        offset += read_size > 0 ? (size_t) read_size : 0;
+        return read_size;
+    };
+#endif
+
+    if (buffer.size() < file_size) buffer.resize(file_size);
+
+    size_t size = 0;
+    size_t chunk_end = enough ? std::min(file_size, first_chunk_size) : file_size;
+    bool done = false;
+
+    while (!done && size < chunk_end) {
+        long long read_size = readNext(&buffer[size], chunk_end - size);
+        if (read_size <= 0) break;  // Truncated since its size was taken, or unreadable.
+        size += (size_t) read_size;
+
+        if (size == chunk_end && chunk_end < file_size) {
+            done = enough({buffer.data(), size});
+            chunk_end = std::min(file_size, size * 2);
+        }
+    }
+
+#ifdef _WIN32
+    CloseHandle(file);
+#else
+    close(file);
+#endif
 
-    return data;
+    if (enough && !done && size > 0) {
+        enough({buffer.data(), size});  // All of it.
+    }
+
+    countProfile(ProfileCounter::BytesRead, (long long) size);
+    return {buffer.data(), size};
 }
 
-void saveJSONToFile(const Json::Value& jsonValue, const string& file_path) {
-    std::ofstream output_file_stream(file_path); // Open the output file stream
-    if (!output_file_stream.is_open()) { // Check if the file was opened successfully
-        throw std::runtime_error("Failed to open JSON file (writing): " + file_path);
+MappedFile::MappedFile(const string& file_path) {
+    /* One open and one mmap per file, read straight from the page cache. */
+
+#ifdef _WIN32
+    HANDLE file = CreateFileA(file_path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+                              OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE) return;
+
+    LARGE_INTEGER file_size;
+    if (GetFileSizeEx(file, &file_size) && file_size.QuadPart > 0) {
+        HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mapping != nullptr) {
+            data = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+            size = data != nullptr ? (size_t) file_size.QuadPart : 0;
+            CloseHandle(mapping);  // The view keeps the mapping alive.
+        }
+    }
+    CloseHandle(file);
+#else
+    int file = open(file_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (file < 0) return;
+
+    struct stat status{};
+    if (fstat(file, &status) == 0 && status.st_size > 0) {
+        void* mapping = mmap(nullptr, (size_t) status.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+        if (mapping != MAP_FAILED) {
+            madvise(mapping, (size_t) status.st_size, MADV_SEQUENTIAL);
+
+            data = static_cast<const char*>(mapping);
+            size = (size_t) status.st_size;
+        }
     }
+    close(file);  // The mapping stays valid.
+#endif
 
-    output_file_stream << jsonValue; // Write the JSON value to the output file stream
-    output_file_stream.close(); // Close the output file stream
-    std::cout << "Saved JSON to file: " << file_path << '\n';
+    countProfile(ProfileCounter::BytesRead, (long long) size);
 }
 
-void saveDataToJSON(const vector<File*>& files, const string& file_path) {
-    Json::Value data(Json::arrayValue);
+MappedFile::~MappedFile() {
+    if (data == nullptr) return;
+
+#ifdef _WIN32
+    UnmapViewOfFile(data);
+#else
+    munmap(const_cast<char*>(data), size);
+#endif
+}
+
+void writeFileAtomically(const string& file_path, const std::function<void(std::ostream& out)>& write) {
+    string temp_path = file_path + ".tmp";
+
+    {
+        std::ofstream output_file_stream(temp_path, std::ios::binary);
+        if (!output_file_stream.is_open()) {
+            throw std::runtime_error("Failed to open file (writing): " + temp_path);
+        }
+
+        write(output_file_stream);
+        output_file_stream.flush();
+
+        if (!output_file_stream.good()) {
+            output_file_stream.close();
+            fs::remove(temp_path);
+            throw std::runtime_error("Failed to write file: " + temp_path);
+        }
+    }
 
-    for (const File* file : files) {
-        std::cout << file->notes << '\n';
-        data.append(serializeFile(file));
+    // On disk before the rename, or a crash right after it could leave an empty file under the old name.
+#ifdef _WIN32
+    HANDLE file = CreateFileA(temp_path.c_str(), GENERIC_WRITE, 0, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file != INVALID_HANDLE_VALUE) {
+        FlushFileBuffers(file);
+        CloseHandle(file);
     }
+#else
+    int file = open(temp_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (file >= 0) {
+        fsync(file);
+        close(file);
+    }
+#endif
 
-    // std::cout << data.toStyledString() << '\n';
+    std::error_code error;
+    fs::rename(temp_path, file_path, error);  // Replaces the old file in one step.
+    if (error) {
+        fs::remove(temp_path, error);
+        throw std::runtime_error("Failed to replace " + file_path + ": " + error.message());
+    }
 
-    saveJSONToFile(data, file_path);
+#ifndef _WIN32
+    // And the rename itself.
+    string folder_path = fs::path(file_path).parent_path().generic_string();
+    int folder = open(folder_path.empty() ? "." : folder_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (folder >= 0) {
+        fsync(folder);
+        close(folder);
+    }
+#endif
 }
 
-File* deserializeFile(const Json::Value& json_data) {
-    File* file = new File();
+string getParseCachePath(const string& folder_path) {
+    return (fs::path(folder_path) / ".pypeline_cache.json").generic_string();
+}
 
-    file->file_name = json_data["name"].asString();
-    file->file_path = json_data["path"].asString();
+void loadParseCache(ParseCache& cache, const string& file_path) {
+    /* A missing or unreadable cache just means everything gets parsed. */
 
-    file->notes = json_data["notes"].asString();
+    ProfileScope scope("load parse cache");
 
-    vector<ToDo*> to_dos;
-    for (const Json::Value& to_do_data : json_data["todos"]) {
-        ToDo* to_do = new ToDo();
+    std::ifstream input_file_stream(file_path);
+    if (!input_file_stream.is_open()) return;
+
+    Json::Value data;
+    Json::CharReaderBuilder builder;
+    string error_msg;
+    if (!Json::parseFromStream(builder, input_file_stream, &data, &error_msg) || data["version"].asInt() != 2) {
+        std::cout << "Ignoring parse cache " << file_path << ": " << error_msg << '\n';
+        return;
+    }
+
+    const Json::Value& files = data["files"];
+    for (auto file_data = files.begin(); file_data != files.end(); file_data++) {
+        ParseCache::Entry entry;
+        entry.modified_time = (*file_data)["modified"].asInt64();
+        entry.size = (*file_data)["size"].asUInt64();
+        entry.content_hash = (*file_data)["hash"].asUInt64();
+        entry.scan_mode = (*file_data)["full_scan"].asBool() ? ScanMode::Full : ScanMode::Header;
+
+        for (const Json::Value& import_data: (*file_data)["imports"]) {
+            Import import{};
+            import.file_name = Name(import_data["name"].asString());
+            import.entire_file = import_data["entire_file"].asBool();
+            for (const Json::Value& imported_object: import_data["content"]) {
+                import.imported_content.emplace_back(imported_object.asString());
+            }
+
+            entry.imports.push_back(import);
+        }
+
+        for (const Json::Value& definition: (*file_data)["definitions"]) {
+            entry.symbols.definitions.emplace_back(definition.asString());
+        }
+        const Json::Value& exports = (*file_data)["exports"];
+        entry.symbols.has_exports = exports.isArray();
+        for (const Json::Value& exported: exports) {
+            entry.symbols.exports.emplace_back(exported.asString());
+        }
+
+        cache.entries.emplace(file_data.name(), std::move(entry));
+    }
+}
+
+void saveParseCache(const ParseCache& cache, const string& file_path) {
+    /* Only saves the entries that were used, so deleted files drop out of the cache. */
+
+    ProfileScope scope("save parse cache");
+
+    Json::Value files(Json::objectValue);
+    for (const auto& [path, entry]: cache.entries) {
+        if (!entry.used) continue;
+
+        Json::Value file_data(Json::objectValue);
+        file_data["modified"] = (Json::Int64) entry.modified_time;
+        file_data["size"] = (Json::UInt64) entry.size;
+        file_data["hash"] = (Json::UInt64) entry.content_hash;
+        file_data["full_scan"] = entry.scan_mode == ScanMode::Full;
+
+        Json::Value imports(Json::arrayValue);
+        for (const Import& import: entry.imports) {
+            Json::Value import_data(Json::objectValue);
+            import_data["name"] = import.file_name.str();
+            import_data["entire_file"] = import.entire_file;
+
+            Json::Value content(Json::arrayValue);
+            for (Name imported_object: import.imported_content) {
+                content.append(imported_object.str());
+            }
+            import_data["content"] = content;
+
+            imports.append(import_data);
+        }
+        file_data["imports"] = imports;
 
-        to_do->content = to_do_data["content"].asString();
-        to_do->done = to_do_data["done"].asBool();
+        Json::Value definitions(Json::arrayValue);
+        for (Name definition: entry.symbols.definitions) {
+            definitions.append(definition.str());
+        }
+        file_data["definitions"] = definitions;
+
+        if (entry.symbols.has_exports) {
+            Json::Value exports(Json::arrayValue);
+            for (Name exported: entry.symbols.exports) {
+                exports.append(exported.str());
+            }
+            file_data["exports"] = exports;
+        }
 
-        to_dos.push_back(to_do);
+        files[path] = file_data;
     }
 
-    file->to_dos = to_dos;
+    Json::Value data(Json::objectValue);
+    data["version"] = 2;  // 2 added the symbols.
+    data["files"] = files;
+
+    Json::StreamWriterBuilder writer;
+    writer["indentation"] = "";
+
+    try {
+        writeFileAtomically(file_path, [&](std::ostream& out) {
+            out << Json::writeString(writer, data);
+        });
+    } catch (const std::runtime_error&) {  // Read only project, it will just be parsed again next time.
+        std::cout << "Failed to save parse cache: " << file_path << '\n';
+    }
+}
 
-    return file;
+namespace {
+    class JSONReader {
+        /* Pulls values out of JSON text one at a time, without building a tree. Only what the settings need: objects,
+         * arrays, strings, numbers and booleans, everything else is skipped. */
+
+        public:
+            explicit JSONReader(std::string_view text) : text(text) {}
+
+            template<class OnElement>
+            void readArray(OnElement on_element) {
+                expect('[');
+                if (consume(']')) return;
+                do {
+                    on_element();
+                } while (consume(','));
+                expect(']');
+            }
+
+            template<class OnMember>
+            void readObject(OnMember on_member) {
+                /* on_member(key) has to read (or skip) the value. */
+
+                expect('{');
+                if (consume('}')) return;
+                do {
+                    readString(key);
+                    expect(':');
+                    on_member(std::string_view(key));
+                } while (consume(','));
+                expect('}');
+            }
+
+            void readString(string& value) {
+                expect('"');
+                value.clear();
+
+                while (true) {
+                    // Plain runs are copied in one go.
+                    size_t run_end = position;
+                    while (run_end < text.size() && text[run_end] != '"' && text[run_end] != '\\') run_end++;
+                    if (run_end == text.size()) fail("unterminated string");
+                    value.append(text.data() + position, run_end - position);
+                    position = run_end + 1;
+
+                    if (text[run_end] == '"') return;
+                    if (position >= text.size()) fail("unterminated string");
+
+                    char escaped = text[position++];
+                    switch (escaped) {
+                        case 'n': value += '\n'; break;
+                        case 't': value += '\t'; break;
+                        case 'r': value += '\r'; break;
+                        case 'b': value += '\b'; break;
+                        case 'f': value += '\f'; break;
+                        case 'u': appendUTF8(value, readCodePoint()); break;
+                        default: value += escaped; break;  // '"', '\\' and '/'.
+                    }
+                }
+            }
+
+            void readName(Name& value) {
+                readString(skipped);
+                value = Name(skipped);
+            }
+
+            bool readBool() {
+                /* true/false, or a number like the 0 and 1 older settings use. */
+
+                skipWhitespace();
+                if (text.compare(position, 4, "true") == 0) {
+                    position += 4;
+                    return true;
+                }
+                if (text.compare(position, 5, "false") == 0) {
+                    position += 5;
+                    return false;
+                }
+
+                size_t number_start = position;
+                skipNumber();
+                return text.find_first_not_of("-+0.eE", number_start) < position;
+            }
+
+            void skipValue() {
+                skipWhitespace();
+                if (position >= text.size()) fail("unexpected end");
+
+                switch (text[position]) {
+                    case '{': readObject([this](std::string_view) { skipValue(); }); break;
+                    case '[': readArray([this]() { skipValue(); }); break;
+                    case '"': readString(skipped); break;
+                    case 't': case 'f': readBool(); break;
+                    case 'n':
+                        if (text.compare(position, 4, "null") != 0) fail("unexpected value");
+                        position += 4;
+                        break;
+                    default: skipNumber(); break;
+                }
+            }
+
+            void expectEnd() {
+                skipWhitespace();
+                if (position != text.size()) fail("trailing characters");
+            }
+
+        private:
+            std::string_view text;
+            size_t position = 0;
+            string key, skipped;  // Reused, so reading doesn't allocate for every key.
+
+            [[noreturn]] void fail(const char* reason) const {
+                throw std::runtime_error("Invalid JSON at byte " + std::to_string(position) + ": " + reason);
+            }
+
+            void skipWhitespace() {
+                while (position < text.size() && (text[position] == ' ' || text[position] == '\n' ||
+                                                  text[position] == '\r' || text[position] == '\t')) {
+                    position++;
+                }
+            }
+
+            bool consume(char c) {
+                skipWhitespace();
+                if (position < text.size() && text[position] == c) {
+                    position++;
+                    return true;
+                }
+                return false;
+            }
+
+            void expect(char c) {
+                if (!consume(c)) fail(c == '"' ? "expected a string" : "unexpected character");
+            }
+
+            void skipNumber() {
+                size_t start = position;
+                while (position < text.size() && (isdigit((unsigned char) text[position]) ||
+                                                  strchr("-+.eE", text[position]) != nullptr)) {
+                    position++;
+                }
+                if (position == start) fail("unexpected value");
+            }
+
+            unsigned readHex4() {
+                if (position + 4 > text.size()) fail("bad \\u escape");
+
+                unsigned value = 0;
+                for (int i = 0; i < 4; i++) {
+                    char c = text[position++];
+                    value <<= 4;
+                    if (c >= '0' && c <= '9') value |= c - '0';
+                    else if (c >= 'a' && c <= 'f') value |= c - 'a' + 10;
+                    else if (c >= 'A' && c <= 'F') value |= c - 'A' + 10;
+                    else fail("bad \\u escape");
+                }
+                return value;
+            }
+
+            unsigned readCodePoint() {
+                /* After "\u", joins surrogate pairs. */
+
+                unsigned code_point = readHex4();
+                if (code_point >= 0xD800 && code_point < 0xDC00 && text.compare(position, 2, "\\u") == 0) {
+                    position += 2;
+                    unsigned low = readHex4();
+                    code_point = 0x10000 + ((code_point - 0xD800) << 10) + (low - 0xDC00);
+                }
+                return code_point;
+            }
+
+            static void appendUTF8(string& value, unsigned code_point) {
+                if (code_point < 0x80) {
+                    value += (char) code_point;
+                } else if (code_point < 0x800) {
+                    value += (char) (0xC0 | (code_point >> 6));
+                    value += (char) (0x80 | (code_point & 0x3F));
+                } else if (code_point < 0x10000) {
+                    value += (char) (0xE0 | (code_point >> 12));
+                    value += (char) (0x80 | ((code_point >> 6) & 0x3F));
+                    value += (char) (0x80 | (code_point & 0x3F));
+                } else {
+                    value += (char) (0xF0 | (code_point >> 18));
+                    value += (char) (0x80 | ((code_point >> 12) & 0x3F));
+                    value += (char) (0x80 | ((code_point >> 6) & 0x3F));
+                    value += (char) (0x80 | (code_point & 0x3F));
+                }
+            }
+    };
+
+    class JSONWriter {  // Writes JSON text straight to a file, through a buffer of its own.
+        public:
+            explicit JSONWriter(std::ostream& output_file_stream) : output_file_stream(output_file_stream) {}
+            ~JSONWriter() { flush(); }
+
+            JSONWriter& raw(std::string_view text) {
+                buffer.append(text);
+                if (buffer.size() >= buffer_size) flush();
+                return *this;
+            }
+
+            JSONWriter& quoted(std::string_view value) {
+                /* As a JSON string. UTF-8 is passed through as is. */
+
+                buffer += '"';
+                size_t run_start = 0;
+                for (size_t i = 0; i < value.size(); i++) {
+                    unsigned char c = value[i];
+                    if (c >= 0x20 && c != '"' && c != '\\') continue;
+
+                    buffer.append(value.data() + run_start, i - run_start);
+                    run_start = i + 1;
+
+                    switch (c) {
+                        case '"': buffer += "\\\""; break;
+                        case '\\': buffer += "\\\\"; break;
+                        case '\n': buffer += "\\n"; break;
+                        case '\t': buffer += "\\t"; break;
+                        case '\r': buffer += "\\r"; break;
+                        default: {
+                            char escaped[8];
+                            snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                            buffer += escaped;
+                        }
+                    }
+                }
+                buffer.append(value.data() + run_start, value.size() - run_start);
+                return raw("\"");
+            }
+
+            void flush() {
+                output_file_stream.write(buffer.data(), (std::streamsize) buffer.size());
+                buffer.clear();
+            }
+
+        private:
+            static constexpr size_t buffer_size = 1 << 16;
+
+            std::ostream& output_file_stream;
+            string buffer;
+    };
 }
 
-vector<File*> loadDataFromJSON(const string& file_path) {
-    vector<File*> files;
+void saveDataToJSON(const vector<File*>& files, const string& file_path) {
+    /* One file per line. Written as it goes, nothing but a small buffer is held in memory. */
 
-    std::ifstream input_file_stream(file_path);
+    ProfileScope scope("save json");
+
+    writeFileAtomically(file_path, [&files](std::ostream& out) {
+        JSONWriter writer(out);
+        writer.raw("[");
+
+        for (size_t i = 0; i < files.size(); i++) {
+            const File* file = files[i];
 
-    if (!input_file_stream.is_open()) { // Check if the file was opened successfully
+            writer.raw(i == 0 ? "\n\t{\"name\": " : ",\n\t{\"name\": ").quoted(file->file_name.view());
+            writer.raw(", \"path\": ").quoted(file->file_path.view());
+            writer.raw(", \"notes\": ").quoted(file->notes);
+
+            writer.raw(", \"todos\": [");
+            for (size_t j = 0; j < file->to_dos.size(); j++) {
+                const ToDo* to_do = file->to_dos[j];
+
+                writer.raw(j == 0 ? "{\"content\": " : ", {\"content\": ").quoted(to_do->content);
+                writer.raw(to_do->done ? ", \"done\": 1}" : ", \"done\": 0}");  // Numbers, as older versions wrote.
+            }
+            writer.raw("]}");
+        }
+
+        writer.raw("\n]\n");
+    });
+}
+
+vector<File*> readSettings(const string& file_path, GraphArena& arena, LoadProgress* progress) {
+    /* Files and todos are created as their JSON is read, the text is read straight from the mapping. */
+
+    MappedFile mapped_file(file_path);
+    if (mapped_file.content().empty()) {
         throw std::runtime_error("Failed to open JSON file (reading): " + file_path);
     }
 
-    // Read the file contents into a string
-    std::stringstream buffer;
-    buffer << input_file_stream.rdbuf();
-    std::string json_string = buffer.str();
+    JSONReader reader(mapped_file.content());
+    vector<File*> files;
 
-    // Parse the string as JSON using JsonCPP
-    Json::Value data(Json::objectValue);
-    Json::CharReaderBuilder builder;
-    std::string error_msg;
-    std::unique_ptr<Json::CharReader> reader(builder.newCharReader());
+    reader.readArray([&]() {
+        if (progress != nullptr && files.size() % 1024 == 0) {
+            progress->checkCancelled();
+        }
+
+        File* file = arena.files.create();
+
+        reader.readObject([&](std::string_view key) {
+            if (key == "name") {
+                reader.readName(file->file_name);
+            } else if (key == "path") {
+                reader.readName(file->file_path);
+            } else if (key == "notes") {
+                reader.readString(file->notes);
+            } else if (key == "todos") {
+                reader.readArray([&]() {
+                    ToDo* to_do = arena.to_dos.create();
+                    to_do->done = false;
+
+                    reader.readObject([&](std::string_view to_do_key) {
+                        if (to_do_key == "content") {
+                            reader.readString(to_do->content);
+                        } else if (to_do_key == "done") {
+                            to_do->done = reader.readBool();
+                        } else {
+                            reader.skipValue();
+                        }
+                    });
+
+                    file->to_dos.push_back(to_do);
+                });
+            } else {
+                reader.skipValue();
+            }
+        });
+        file->non_project = file->file_path.empty();  // Only "General" has no path.
+
+        files.push_back(file);
+    });
+    reader.expectEnd();
+
+    return files;
+}
+
+std::unique_ptr<Project> loadDataFromJSON(const string& file_path, ScanMode mode, LoadProgress* progress) {
+    ProfileScope scope("load json");
 
-    if (!reader->parse(json_string.c_str(), json_string.c_str() + json_string.size(), &data, &error_msg)) {
-        throw std::runtime_error("Failed to parse JSON file: " + error_msg);
+    auto project = std::make_unique<Project>();
+    project->scan_mode = mode;
+    vector<File*>& files = project->files;
+
+    try {
+        files = readSettings(file_path, project->arena, progress);
+    } catch (const LoadCancelled&) {
+        throw;
+    } catch (const std::runtime_error& error) {
+        throw std::runtime_error("Failed to parse JSON file " + file_path + ": " + error.what());
     }
 
-    // Process
+    ParseCache cache;
+    string cache_path = getParseCachePath(fs::path(file_path).parent_path().generic_string());
+    loadParseCache(cache, cache_path);
 
-    for(const Json::Value& fileData: data) {  // TODO: Create func for this in core.cpp.
-        File* file = deserializeFile(fileData);
-        File* imports = getImports(file->file_path);
+    if (progress != nullptr) {
+        progress->found_files = files.size();
+    }
+
+    for (File* file: files) {  // TODO: Create func for this in core.cpp.
+        if (progress != nullptr) {
+            progress->checkCancelled();
+        }
+
+        File* imports = cache.getImports(file->file_path.str(), project->arena, project->scan_mode);
 
         file->imports = imports->imports;
         file->imported_by = imports->imported_by;
+        file->package = imports->package;
+        file->symbols = std::move(imports->symbols);
+        imports->imports.clear();  // Moved to file.
+        project->arena.files.destroy(imports);
 
-        files.push_back(file);
+        if (progress != nullptr) {
+            progress->addParsedFile(file->file_name.str());
+        }
+    }
+
+    if (cache.changed) {
+        saveParseCache(cache, cache_path);
     }
 
     sortImports(files);
 
-    return files;
-}
\ No newline at end of file
+    return project;
+}
@@ -1,6 +1,11 @@
 #include <algorithm>
+#include <cmath>
+#include <filesystem>
 #include <iostream>
-#include <queue>
+#include <memory>
+#include <optional>
+#include <thread>
+#include <unordered_set>
 
 #include <glad/glad.h>
 #include "imgui.h"
@@ -26,90 +31,642 @@ void printPos(string name, ImVec2 pos) {
     std::cout << name << " x: " << pos.x << ", y:" << pos.y << "\n";
 }
 
+ImVec2 projectPosFromGrid(const ImVec2& pos_on_grid, const ImVec2& grid_pos, const ImVec2& grid_min_pos, float zoom_level);
+
 class CodeBlock {
     public:
         File* file;
 
         int import_level = -1;
 
-        ImVec2 relative_pos = ImVec2(0, 0);
+        ImVec2 relative_pos = ImVec2(0, 0);  // Center of the block on the grid.
         ImVec2 size = ImVec2(120, 90);
         ImU32 color = IM_COL32(3, 83, 164, 255);
 
-        void drawBlock(ImDrawList* draw_list, ImVec2& grid_pos, float zoom_level) {
-            ImVec2 min_pos = ImVec2(relative_pos.x - (size.x / 2),
-                                    relative_pos.y - (size.y / 2));
-            ImVec2 max_pos = ImVec2(relative_pos.x + (size.x / 2),
-                                    relative_pos.y + (size.y / 2));
+        int drawn_frame = -1;  // Last frame the block was in view.
+
+        void drawBlock(ImDrawList* draw_list, const ImVec2& grid_pos, const ImVec2& grid_min_pos, float zoom_level,
+                       bool draw_name) {
+            ImVec2 min_pos = projectPosFromGrid(ImVec2(relative_pos.x - (size.x / 2), relative_pos.y - (size.y / 2)),
+                                               grid_pos, grid_min_pos, zoom_level);
+            ImVec2 max_pos = projectPosFromGrid(ImVec2(relative_pos.x + (size.x / 2), relative_pos.y + (size.y / 2)),
+                                               grid_pos, grid_min_pos, zoom_level);
 
             draw_list->AddRectFilled(min_pos, max_pos, color);
+
+            if (draw_name) {
+                ImVec4 clip_rect = ImVec4(min_pos.x, min_pos.y, max_pos.x, max_pos.y);
+                draw_list->AddText(ImGui::GetFont(), ImGui::GetFontSize(), ImVec2(min_pos.x + 4, min_pos.y + 4),
+                                   IM_COL32(255, 255, 255, 255), file->file_name.c_str(), nullptr, 0.0f, &clip_rect);
+            }
+        }
+};
+
+class PackageCluster {  // All blocks of one package, drawn as a single box when zoomed out.
+    public:
+        Name package;
+        ImVec2 min_pos;  // Bounds on the grid.
+        ImVec2 max_pos;
+        size_t block_count = 0;
+};
+
+class BlockIndex {
+    /* Uniform grid over the code blocks, so a frame only looks at the blocks near the view. Every block is filed under
+     * the cell of its center, queries are widened by the largest block to catch the ones poking in from outside.
+     * Also keeps what's needed to draw the package clusters. Rebuild it whenever blocks move. */
+
+    public:
+        vector<PackageCluster> clusters;
+        vector<std::pair<size_t, size_t>> cluster_edges;  // Importing cluster, imported cluster.
+
+        void rebuild(const vector<CodeBlock*>& code_blocks) {
+            cells.clear();
+            blocks_by_file.clear();
+            clusters.clear();
+            cluster_edges.clear();
+            max_half_size = ImVec2(0, 0);
+
+            std::unordered_map<Name, size_t> cluster_indices;
+            std::unordered_map<const CodeBlock*, size_t> block_clusters;
+
+            for (CodeBlock* code_block: code_blocks) {
+                cells[getCellKey(getCell(code_block->relative_pos.x), getCell(code_block->relative_pos.y))]
+                    .push_back(code_block);
+                blocks_by_file[code_block->file] = code_block;
+
+                max_half_size.x = std::max(max_half_size.x, code_block->size.x / 2);
+                max_half_size.y = std::max(max_half_size.y, code_block->size.y / 2);
+
+                ImVec2 min_pos = ImVec2(code_block->relative_pos.x - code_block->size.x / 2,
+                                        code_block->relative_pos.y - code_block->size.y / 2);
+                ImVec2 max_pos = ImVec2(code_block->relative_pos.x + code_block->size.x / 2,
+                                        code_block->relative_pos.y + code_block->size.y / 2);
+
+                Name package = getPackage(*code_block->file);
+                auto [cluster_index, added] = cluster_indices.emplace(package, clusters.size());
+                if (added) {
+                    clusters.push_back({package, min_pos, max_pos, 0});
+                }
+
+                PackageCluster& cluster = clusters[cluster_index->second];
+                cluster.min_pos = ImVec2(std::min(cluster.min_pos.x, min_pos.x), std::min(cluster.min_pos.y, min_pos.y));
+                cluster.max_pos = ImVec2(std::max(cluster.max_pos.x, max_pos.x), std::max(cluster.max_pos.y, max_pos.y));
+                cluster.block_count++;
+
+                block_clusters[code_block] = cluster_index->second;
+            }
+
+            std::unordered_set<unsigned long long> seen_edges;
+            for (const CodeBlock* code_block: code_blocks) {
+                for (const Import* import: code_block->file->imports) {
+                    CodeBlock* imported = find(import->file);
+                    if (imported == nullptr) continue;
+
+                    size_t from = block_clusters[code_block];
+                    size_t to = block_clusters[imported];
+                    if (from != to && seen_edges.insert(((unsigned long long) from << 32) | to).second) {
+                        cluster_edges.emplace_back(from, to);
+                    }
+                }
+            }
+        }
+
+        CodeBlock* find(const File* file) const {
+            auto code_block = file != nullptr ? blocks_by_file.find(file) : blocks_by_file.end();
+            return code_block != blocks_by_file.end() ? code_block->second : nullptr;
+        }
+
+        template<class Visit>
+        void forEachBlock(const ImVec2& min_pos, const ImVec2& max_pos, Visit visit) const {
+            /* Every block that overlaps the rectangle (on the grid), and possibly a few just outside of it. */
+
+            int min_x = getCell(min_pos.x - max_half_size.x), max_x = getCell(max_pos.x + max_half_size.x);
+            int min_y = getCell(min_pos.y - max_half_size.y), max_y = getCell(max_pos.y + max_half_size.y);
+
+            // Zoomed out over a sparse graph, walking the occupied cells beats walking the empty ones.
+            if ((long long) (max_x - min_x + 1) * (max_y - min_y + 1) > (long long) cells.size()) {
+                for (const auto& [key, cell_blocks]: cells) {
+                    int x = (int) (key >> 32), y = (int) (unsigned) key;
+                    if (x < min_x || x > max_x || y < min_y || y > max_y) continue;
+
+                    for (CodeBlock* code_block: cell_blocks) visit(code_block);
+                }
+                return;
+            }
+
+            for (int x = min_x; x <= max_x; x++) {
+                for (int y = min_y; y <= max_y; y++) {
+                    auto cell = cells.find(getCellKey(x, y));
+                    if (cell == cells.end()) continue;
+
+                    for (CodeBlock* code_block: cell->second) visit(code_block);
+                }
+            }
+        }
+
+    private:
+        static constexpr float cell_size = 512.0f;
+
+        std::unordered_map<long long, vector<CodeBlock*>> cells;
+        std::unordered_map<const File*, CodeBlock*> blocks_by_file;
+        ImVec2 max_half_size = ImVec2(0, 0);
+
+        static int getCell(float pos) {
+            return (int) std::floor(pos / cell_size);
+        }
+
+        static long long getCellKey(int x, int y) {
+            return ((long long) x << 32) | (unsigned) y;
+        }
+
+        static Name getPackage(const File& file) {
+            /* Modules at the top of the project have no package, each of them is a cluster of its own. Otherwise a
+             * flat project would end up as a single box. */
+            if (file.package) return file.file_name;
+
+            std::string_view module_name = file.file_name.view();
+            size_t last_dot = module_name.find_last_of('.');
+            return last_dot != string::npos ? Name(module_name.substr(0, last_dot)) : file.file_name;
+        }
+};
+
+class LoadJob {
+    /* Loads a project on a thread of its own. The open project stays up until the new one is done, then they're
+     * swapped in one go on the main thread. A rescan loads no project, it's applied to the open one instead. */
+
+    public:
+        using Load = std::function<std::unique_ptr<Project>(LoadProgress& progress)>;
+        using Finish = std::function<void(std::unique_ptr<Project> project)>;  // On the main thread, once loaded.
+
+        LoadProgress progress;
+        string name;  // What's loading, for the progress bar.
+        vector<string> parsed_files;  // So far, only touched by the main thread.
+        Finish finish;
+
+        LoadJob(const string& name, const Load& load, const Finish& finish) : name(name), finish(finish) {
+            thread = std::thread([this, load]() {
+                try {
+                    project = load(progress);
+                } catch (...) {
+                    error = std::current_exception();
+                }
+                done = true;
+                glfwPostEmptyEvent();  // Wake up the main loop to swap it in.
+            });
+        }
+
+        LoadJob(const LoadJob&) = delete;
+        LoadJob& operator=(const LoadJob&) = delete;
+
+        ~LoadJob() {
+            progress.cancelled = true;
+            thread.join();
+        }
+
+        bool isDone() const {
+            return done;
         }
+
+        std::unique_ptr<Project> takeProject() {
+            /* Once done. Throws whatever the load threw, LoadCancelled if it was cancelled. */
+
+            if (error) {
+                std::rethrow_exception(error);
+            }
+            return std::move(project);
+        }
+
+    private:
+        std::unique_ptr<Project> project;
+        std::exception_ptr error;
+        std::atomic<bool> done = false;
+        std::thread thread;
 };
 
 struct {  // TODO: Move from global scope. Use static?
-    vector<File*> files;  // Copy of files passed, to save temp changes.
+    vector<File*> files;  // Copy of the project's files.
     int selected_file_tab = 0;  // TODO: Change to pointer to file.
+    std::unique_ptr<Project> project;  // Owns all files, MenuState.files only points into it.
+    std::unique_ptr<ProjectWatcher> watcher;
+    std::unique_ptr<LoadJob> load_job;  // Project that's loading or rescanning, if any.
+    std::unique_ptr<EditJournal> journal;  // Edits since the project was last saved, null if it has nowhere to go.
+    std::unique_ptr<EditHistory> history;
+
+    // Built when a file's dependencies are first shown, dropped whenever the blocks are reloaded.
+    std::unique_ptr<DependencyIndex> dependency_index;
+    std::unique_ptr<SymbolIndex> symbol_index;
+    const File* queried_file = nullptr;  // The lists below are of this file.
+    vector<const File*> dependencies, dependents, cycle;
+    vector<string> imported_names;  // "name (module)"
+
+    // One line per loop of files that import each other. Set whenever the import levels are, until then found when
+    // they're first shown.
+    std::optional<vector<string>> import_cycles;
+
+    int dirty_frames = 0;  // Frames left to draw before the window can sleep until the next event.
+    bool show_profiler = false;  // Profiling is on while it's shown.
+    bool show_import_cycles = false;
+    bool full_scan = false;  // Projects opened from now on parse whole files, which the imported names need.
 
     int menu_width;
     int menu_height;
 
     vector<CodeBlock*> code_blocks;
+    BlockIndex block_index;
+
+    std::unique_ptr<LayoutEngine> layout_engine;
+    LayoutMode layout_mode = LayoutMode::Layered;
+    unsigned long long graph_version = 0;  // Goes up whenever the blocks are reloaded, the layout is cached until then.
 } MenuState;
 
-CodeBlock* getCodeBlockByFile(const File* file, vector<CodeBlock*> &code_blocks) {
-    for (CodeBlock* code_block: code_blocks) {
-        if (code_block->file == file) {
-            return code_block;
+void markDirty() {
+    /* ImGui takes a frame or two to catch up with input (hover, menus opening), so a few frames are drawn. */
+
+    MenuState.dirty_frames = 3;
+}
+
+vector<string> describeImportCycles(const vector<File*>& files, const ImportLayers& layers) {
+    /* "a, b, c" for every cycle. */
+
+    vector<string> cycles;
+    for (const vector<size_t>& cycle: layers.cycles) {
+        string description;
+        for (size_t i: cycle) {
+            description += (description.empty() ? "" : ", ") + files[i]->file_name.str();
         }
+        cycles.push_back(description);
     }
+    return cycles;
+}
 
-    return nullptr;
+ImportLayers setFileImportLevels(vector<CodeBlock*>& code_blocks) {
+    ProfileScope scope("set import levels");
+
+    vector<File*> files;
+    files.reserve(code_blocks.size());
+    for (CodeBlock* code_block: code_blocks) {
+        files.push_back(code_block->file);
+    }
+
+    ImportLayers layers = computeImportLevels(files);
+
+    for (size_t i = 0; i < code_blocks.size(); i++) {
+        code_blocks[i]->import_level = layers.levels[i];
+    }
+
+    MenuState.import_cycles = describeImportCycles(files, layers);
+
+    return layers;
 }
 
-void removeExistingElementInQueue(std::queue<std::pair<CodeBlock*, int>>* queue, CodeBlock* code_block) {
-    std::queue<std::pair<CodeBlock*, int>> new_queue;
+void placeCodeBlocks(vector<CodeBlock*>& code_blocks) {
+    /* One column per import level, in the order the files came in. Only a stand-in until the layout is done. */
+
+    const ImVec2 spacing = ImVec2(200, 130);
 
-    while (!queue->empty()) {
-        if (queue->front().first != code_block) {
-            new_queue.push(std::make_pair(queue->front().first, queue->front().second));
+    std::unordered_map<int, int> column_heights;
+    for (CodeBlock* code_block: code_blocks) {
+        int row = column_heights[code_block->import_level]++;
+        code_block->relative_pos = ImVec2(code_block->import_level * spacing.x, row * spacing.y);
+    }
+}
+
+void requestLayout(const vector<File*>& files, const ImportLayers& layers) {
+    if (MenuState.layout_engine == nullptr) {
+        MenuState.layout_engine = std::make_unique<LayoutEngine>([]() { glfwPostEmptyEvent(); });
+    }
+    MenuState.layout_engine->request(getLayoutGraph(files, layers), ++MenuState.graph_version, MenuState.layout_mode);
+}
+
+void setLayoutMode(LayoutMode layout_mode) {
+    if (layout_mode == MenuState.layout_mode) return;
+    MenuState.layout_mode = layout_mode;
+
+    vector<File*> files;
+    files.reserve(MenuState.code_blocks.size());
+    for (CodeBlock* code_block: MenuState.code_blocks) {
+        files.push_back(code_block->file);
+    }
+
+    requestLayout(files, computeImportLevels(files));
+}
+
+void loadCodeBlocks(const vector<File*>& files) {
+    /* Gives every file a code block, keeping the blocks of files that already had one. */
+
+    std::unordered_map<const File*, CodeBlock*> existing_blocks;
+    for (CodeBlock* code_block: MenuState.code_blocks) {
+        existing_blocks[code_block->file] = code_block;
+    }
+
+    vector<CodeBlock*> code_blocks;
+    code_blocks.reserve(files.size());
+
+    vector<CodeBlock*> new_blocks;
+
+    for (File* file: files) {
+        auto existing_block = existing_blocks.find(file);
+
+        if (existing_block != existing_blocks.end()) {
+            code_blocks.push_back(existing_block->second);
+            existing_blocks.erase(existing_block);
         } else {
-            std::cout << "Removing existing queue element: " << code_block->file->file_name << ", level: " << queue->front().second << "\n";
+            CodeBlock* code_block = new CodeBlock;
+            code_block->file = file;
+
+            code_blocks.push_back(code_block);
+            new_blocks.push_back(code_block);
         }
+    }
+
+    for (const auto& [file, code_block]: existing_blocks) {
+        delete code_block;
+    }
+
+    MenuState.code_blocks = code_blocks;
+    ImportLayers layers = setFileImportLevels(MenuState.code_blocks);
+    placeCodeBlocks(new_blocks);
+
+    MenuState.block_index.rebuild(MenuState.code_blocks);
+    MenuState.dependency_index.reset();
+    MenuState.symbol_index.reset();
+
+    requestLayout(files, layers);
+}
+
+void loadSavedCodeBlocks(Project& project) {
+    /* Puts the blocks where they were when the snapshot was saved, nothing gets laid out. The next change to the
+     * project lays it out as usual. */
+
+    for (size_t i = 0; i < project.files.size(); i++) {
+        CodeBlock* code_block = new CodeBlock;
+        code_block->file = project.files[i];
+        code_block->import_level = project.saved_levels[i];
+        code_block->relative_pos = ImVec2(project.saved_x[i], project.saved_y[i]);
 
-        queue->pop();
+        MenuState.code_blocks.push_back(code_block);
     }
 
-    *queue = new_queue;
+    project.saved_levels.clear();
+    project.saved_x.clear();
+    project.saved_y.clear();
+    MenuState.import_cycles.reset();  // The levels weren't computed.
+
+    MenuState.block_index.rebuild(MenuState.code_blocks);
+    MenuState.dependency_index.reset();
+    MenuState.symbol_index.reset();
+    MenuState.graph_version++;  // Drops whatever layout of the last project is still coming.
 }
 
-void setFileImportLevels(vector<CodeBlock*> code_blocks) {
-    std::queue<std::pair<CodeBlock*, int>> queue;
+void applyLayout() {
+    /* Moves the blocks once the layout of the current graph is done, or every now and then while a force directed
+     * layout is still moving. Layouts of older graphs are dropped. */
+
+    GraphLayout layout;
+    if (MenuState.layout_engine == nullptr || !MenuState.layout_engine->takeLayout(layout)) return;
+    if (layout.version != MenuState.graph_version) return;
+
+    markDirty();
+
+    for (size_t i = 0; i < MenuState.code_blocks.size(); i++) {
+        MenuState.code_blocks[i]->relative_pos = ImVec2(layout.x[i], layout.y[i]);
+    }
+
+    MenuState.block_index.rebuild(MenuState.code_blocks);
+}
+
+string getSavePath(const Project& project) {
+    /* Where the project is saved: wherever it was saved before, or next to the project. Projects from settings have no
+     * folder, they need to be saved somewhere first. So does a project next to a snapshot it wasn't opened from (one
+     * that couldn't be read), which is never overwritten without asking. */
+
+    if (!project.save_path.empty()) return project.save_path;
+    if (project.path.empty()) return "";
+
+    string snapshot_path = getSnapshotPath(project.path);
+    std::error_code error;
+    return std::filesystem::exists(snapshot_path, error) ? "" : snapshot_path;
+}
+
+void openJournal() {
+    /* Brings back the edits made since the last save, in case it wasn't closed properly, and keeps recording. */
+
+    string save_path = getSavePath(*MenuState.project);
+    if (save_path.empty()) return;
+
+    // The history already holds the saved state, so reverting drops the recovered edits again.
+    string journal_path = getJournalPath(save_path);
+    vector<File*> recovered_files = replayJournal(*MenuState.project, journal_path);
+    for (File* file: recovered_files) {
+        MenuState.history->recordEdit(file, EditKind::ToDos);  // Not merged like typing into the notes would be.
+    }
+    if (!recovered_files.empty()) {
+        std::cout << "Recovered unsaved edits of " << recovered_files.size() << " file(s).\n";
+    }
 
-    for(CodeBlock* code_block : code_blocks) {
-        if (isHeadFile(*code_block->file)) {
-            // std::cout << "Head file: "<< code_block->file->file_name << "\n";
-            queue.push(std::make_pair(code_block, 0));
+    try {
+        MenuState.journal = std::make_unique<EditJournal>(journal_path, MenuState.project->path);
+    } catch (const std::exception& error) {
+        std::cout << error.what() << '\n';  // Read only project, edits are only kept until closed.
+    }
+}
+
+void setProject(std::unique_ptr<Project> project) {
+    /* Swaps in a newly opened project. The old one, and every file in it, is freed here. */
+
+    for (CodeBlock* code_block: MenuState.code_blocks) {
+        delete code_block;
+    }
+    MenuState.code_blocks.clear();
+
+    MenuState.watcher.reset();
+    MenuState.journal.reset();
+    MenuState.history.reset();
+    if (MenuState.layout_engine != nullptr) {
+        MenuState.layout_engine->reset();
+    }
+    MenuState.project = std::move(project);
+    MenuState.files = MenuState.project->files;
+
+    MenuState.history = std::make_unique<EditHistory>(*MenuState.project);  // Saved as it was loaded.
+    openJournal();
+
+    if (!MenuState.project->path.empty()) {
+        MenuState.watcher = std::make_unique<ProjectWatcher>(MenuState.project->path);
+    }
+
+    if (MenuState.project->saved_x.size() == MenuState.files.size()) {
+        loadSavedCodeBlocks(*MenuState.project);
+    } else {
+        loadCodeBlocks(MenuState.files);
+    }
+    MenuState.selected_file_tab = 0;
+}
+
+void saveProject(const string& file_path) {
+    /* Snapshot of the project as it's shown, block positions included. */
+
+    Project& project = *MenuState.project;
+
+    ImportLayers layers;
+    GraphLayout layout;
+    for (const File* file: project.files) {
+        const CodeBlock* code_block = MenuState.block_index.find(file);
+
+        layers.levels.push_back(code_block != nullptr ? code_block->import_level : -1);
+        layout.x.push_back(code_block != nullptr ? code_block->relative_pos.x : 0.0f);
+        layout.y.push_back(code_block != nullptr ? code_block->relative_pos.y : 0.0f);
+    }
+
+    try {
+        saveSnapshot(project, layers, layout, file_path);
+        std::cout << "Saved snapshot to file: " << file_path << '\n';
+
+        // Everything in the journal is in the snapshot now, later edits go to the journal next to it.
+        bool moved = file_path != getSavePath(project);
+        project.save_path = file_path;
+        if (moved || MenuState.journal == nullptr) {
+            MenuState.journal.reset();
+            MenuState.journal = std::make_unique<EditJournal>(getJournalPath(file_path), project.path);
         }
+        MenuState.journal->clear();
+        MenuState.history->markSaved();
+    } catch (const std::exception& error) {
+        std::cout << "Failed to save " << file_path << ": " << error.what() << '\n';
     }
+}
 
-    while (!queue.empty()) {
-        auto item = queue.front();
-        queue.pop();
+void recordEdit(File* file, EditKind kind) {
+    /* After the notes or todos of a file were edited, so it can be undone and survives a crash. */
 
-        CodeBlock* code_block = item.first;
-        code_block->import_level = item.second;
+    MenuState.history->recordEdit(file, kind);
 
-        for (Import* import: code_block->file->imports) {
-            if (import->file == nullptr) { // Non-project import (e.g. "import os").
-                continue;
-            }
+    if (MenuState.journal != nullptr) {
+        if (kind == EditKind::Notes) {
+            MenuState.journal->recordNotes(*file);
+        } else {
+            MenuState.journal->recordToDos(*file);
+        }
+    }
+}
+
+void recordRestored(const vector<File*>& files) {
+    /* After an undo, redo or revert, which the history already knows about. */
+
+    if (MenuState.journal == nullptr) return;
 
-            removeExistingElementInQueue(&queue, code_block);
+    for (const File* file: files) {
+        MenuState.journal->recordNotes(*file);
+        MenuState.journal->recordToDos(*file);
+    }
+}
+
+void compactJournal() {
+    /* Folds the journal into the saved project once it has grown, so it never takes long to replay. */
 
-            CodeBlock* import_code_block = getCodeBlockByFile(import->file, code_blocks);
-            queue.push(std::make_pair(import_code_block, code_block->import_level + 1));
+    const size_t max_journal_size = 1 << 20;
+
+    string save_path = getSavePath(*MenuState.project);
+    if (MenuState.journal != nullptr && MenuState.journal->size() > max_journal_size && !save_path.empty()) {
+        saveProject(save_path);
+    }
+}
+
+void exportJSON(const string& file_path) {
+    try {
+        saveDataToJSON(MenuState.project->files, file_path);
+        std::cout << "Saved JSON to file: " << file_path << '\n';
+    } catch (const std::exception& error) {
+        std::cout << "Failed to export " << file_path << ": " << error.what() << '\n';
+    }
+}
+
+void startLoading(const string& name, const LoadJob::Load& load, const LoadJob::Finish& finish = setProject) {
+    MenuState.load_job.reset();  // Only one at a time, an earlier one is cancelled.
+    MenuState.load_job = std::make_unique<LoadJob>(name, load, finish);
+}
+
+void applyLoadJob() {
+    if (MenuState.load_job == nullptr) return;
+
+    markDirty();  // The progress bar moves.
+    MenuState.load_job->progress.takeParsedFiles(MenuState.load_job->parsed_files);
+    if (!MenuState.load_job->isDone()) return;
+
+    try {
+        MenuState.load_job->finish(MenuState.load_job->takeProject());
+    } catch (const LoadCancelled&) {
+        std::cout << "Loading cancelled.\n";
+    } catch (const std::exception& error) {
+        std::cout << "Failed to load " << MenuState.load_job->name << ": " << error.what() << '\n';
+    }
+
+    MenuState.load_job.reset();
+}
+
+void drawLoadProgress() {
+    /* Progress bar, cancel button and the files parsed so far. */
+
+    LoadJob& load_job = *MenuState.load_job;
+
+    size_t found_files = load_job.progress.found_files;
+    size_t parsed_files = load_job.progress.parsed_files;
+    float fraction = found_files > 0 ? std::min(1.0f, (float) parsed_files / (float) found_files) : 0.0f;
+
+    string overlay = std::to_string(parsed_files) + " / " + std::to_string(found_files);
+
+    ImGui::TextWrapped("Loading %s", load_job.name.c_str());
+    ImGui::ProgressBar(fraction, ImVec2(-1.0f, 0.0f), overlay.c_str());
+
+    if (load_job.progress.cancelled) {
+        ImGui::Text("Cancelling...");
+    } else if (ImGui::Button("Cancel")) {
+        load_job.progress.cancelled = true;
+    }
+
+    ImGui::BeginChild("Parsed files");
+
+    ImGuiListClipper clipper;  // Only the rows in view, the list can get long.
+    clipper.Begin((int) load_job.parsed_files.size());
+    while (clipper.Step()) {
+        for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; i++) {
+            ImGui::TextDisabled("%s", load_job.parsed_files[i].c_str());
         }
     }
+    clipper.End();
+
+    ImGui::EndChild();
+}
+
+void applyRescan(ProjectRescan& rescan) {
+    size_t parsed_count = rescan.apply(*MenuState.project);
+    std::cout << "Rescan: " << parsed_count << " file(s) changed.\n";
+
+    MenuState.files = MenuState.project->files;
+    MenuState.history->addFiles(MenuState.files);
+    loadCodeBlocks(MenuState.files);
+
+    MenuState.selected_file_tab = 0;
+}
+
+void applyWatchedChanges() {
+    /* Changes wait while something loads, a rescan would apply its files over them. */
+
+    if (MenuState.load_job != nullptr || MenuState.watcher == nullptr) return;
+
+    vector<string> changed_paths;
+    if (!MenuState.watcher->takeChanges(changed_paths)) return;
+
+    markDirty();
+
+    size_t parsed_count = updateProjectFiles(*MenuState.project, changed_paths);
+    std::cout << "Project changed: " << parsed_count << " file(s) parsed.\n";
+
+    MenuState.files = MenuState.project->files;
+    MenuState.history->addFiles(MenuState.files);
+    loadCodeBlocks(MenuState.files);
+
+    MenuState.selected_file_tab = std::min(MenuState.selected_file_tab, (int) MenuState.files.size() - 1);
 }
 
 void setStyle() {
@@ -138,12 +695,12 @@ string getProjectPath() {
         std::cout << "Error: %s\n" << NFD_GetError() << "\n";
     }
 
-    return path;
+    return result == NFD_OKAY ? path : "";
 }
 
-string getSettingsFile() {
+string getSettingsFile(const char* file_type = "json") {
     nfdchar_t *path = nullptr;
-    nfdresult_t result = NFD_OpenDialog("json", nullptr, &path);
+    nfdresult_t result = NFD_OpenDialog(file_type, nullptr, &path);
 
     if (result == NFD_OKAY) {
         std::cout << "Success!\n";
@@ -156,7 +713,18 @@ string getSettingsFile() {
         std::cout << "Error: %s\n" << NFD_GetError() << "\n";
     }
 
-    return path;
+    return result == NFD_OKAY ? path : "";
+}
+
+string getSaveFile(const char* file_type) {
+    nfdchar_t *path = nullptr;
+    nfdresult_t result = NFD_SaveDialog(file_type, nullptr, &path);
+
+    if (result == NFD_ERROR) {
+        std::cout << "Error: " << NFD_GetError() << "\n";
+    }
+
+    return result == NFD_OKAY ? path : "";
 }
 
 void moveGrid(ImVec2& grid_pos, ImVec2& grid_min_pos, ImVec2& grid_max_pos, bool recenter, float& zoom_level) {
@@ -193,85 +761,146 @@ void moveGrid(ImVec2& grid_pos, ImVec2& grid_min_pos, ImVec2& grid_max_pos, bool
     }
 }
 
-void drawBlocks(ImDrawList* draw_list, ImVec2& grid_pos, float zoom_level) {
-    for (CodeBlock* code_block : MenuState.code_blocks) {
-        code_block->drawBlock(draw_list, grid_pos, zoom_level);
-        return;
-    }
-}
+ImVec2 projectPosFromGrid(const ImVec2& pos_on_grid, const ImVec2& grid_pos, const ImVec2& grid_min_pos, float zoom_level) {
+    /* Grid coordinates to screen coordinates. The grid origin sits at the top left corner of the view, shifted by
+     * however far the grid has been dragged. */
 
-ImVec2 projectPosFromGrid(const ImVec2& pos_on_grid, const ImVec2& grid_pos, const ImVec2& grid_min_pos, float& margin, float& zoom_level) {
-    ImVec2 screen_pos;
-
-    
+    return ImVec2(grid_min_pos.x + grid_pos.x + pos_on_grid.x * zoom_level,
+                  grid_min_pos.y + grid_pos.y + pos_on_grid.y * zoom_level);
+}
 
-    return screen_pos;
+ImVec2 gridPosFromScreen(const ImVec2& screen_pos, const ImVec2& grid_pos, const ImVec2& grid_min_pos, float zoom_level) {
+    return ImVec2((screen_pos.x - grid_min_pos.x - grid_pos.x) / zoom_level,
+                  (screen_pos.y - grid_min_pos.y - grid_pos.y) / zoom_level);
 }
 
-void DrawGrid(float grid_step_size, ImU32 background_color, bool recenter) {
-    ImDrawList* draw_list = ImGui::GetWindowDrawList();
-    ImVec2 grid_min_pos = ImVec2(ImGui::GetColumnOffset(2) + 15, 65);
-    ImVec2 grid_max_pos = ImVec2(MenuState.menu_width - 25, MenuState.menu_height - 25);
+void drawClusters(ImDrawList* draw_list, const ImVec2& view_min, const ImVec2& view_max, const ImVec2& grid_pos,
+                  const ImVec2& grid_min_pos, float zoom_level) {
+    /* Zoomed out: a box per package and a line per pair of packages that import each other, no text. */
 
-    draw_list->PushClipRect(grid_min_pos, grid_max_pos);
-    draw_list->AddRectFilled(grid_min_pos,
-                             ImVec2(grid_min_pos.x + MenuState.menu_width,
-                                    grid_max_pos.y + MenuState.menu_height),
-                             background_color);
+    const BlockIndex& block_index = MenuState.block_index;
 
-    // Calculate the position of the grid based on the current mouse position
-    static ImVec2 grid_pos = ImVec2(0, 0);
+    auto getCenter = [&](const PackageCluster& cluster) {
+        return projectPosFromGrid(ImVec2((cluster.min_pos.x + cluster.max_pos.x) / 2,
+                                         (cluster.min_pos.y + cluster.max_pos.y) / 2),
+                                  grid_pos, grid_min_pos, zoom_level);
+    };
 
-    static float zoom_level = 1.0f;
-    moveGrid(grid_pos, grid_min_pos, grid_max_pos, recenter, zoom_level);
+    for (const auto& [from, to]: block_index.cluster_edges) {
+        ImVec2 from_pos = getCenter(block_index.clusters[from]);
+        ImVec2 to_pos = getCenter(block_index.clusters[to]);
 
-    grid_step_size = grid_step_size * zoom_level;
+        if (std::max(from_pos.x, to_pos.x) < view_min.x || std::min(from_pos.x, to_pos.x) > view_max.x ||
+            std::max(from_pos.y, to_pos.y) < view_min.y || std::min(from_pos.y, to_pos.y) > view_max.y) continue;
 
-    float margin = 2.5f * grid_step_size;  // 50.0f
+        draw_list->AddLine(from_pos, to_pos, IM_COL32(200, 200, 200, 90));
+    }
 
-    grid_min_pos.x = grid_min_pos.x - (margin * zoom_level);
-    grid_min_pos.y = grid_min_pos.y - (margin * zoom_level);
+    for (const PackageCluster& cluster: block_index.clusters) {
+        ImVec2 min_pos = projectPosFromGrid(cluster.min_pos, grid_pos, grid_min_pos, zoom_level);
+        ImVec2 max_pos = projectPosFromGrid(cluster.max_pos, grid_pos, grid_min_pos, zoom_level);
 
-    grid_max_pos.x = grid_max_pos.x + (margin * zoom_level);
-    grid_max_pos.y = grid_max_pos.y + (margin * zoom_level);
+        if (max_pos.x < view_min.x || min_pos.x > view_max.x || max_pos.y < view_min.y || min_pos.y > view_max.y) continue;
 
+        draw_list->AddRectFilled(min_pos, max_pos, IM_COL32(3, 83, 164, 160));
+        draw_list->AddRect(min_pos, max_pos, IM_COL32(3, 83, 164, 255));
+    }
+}
 
-    // Loop over grid 'point', from which to draw 2 lines, down and to the right, to form the grid.
-    for (int x = grid_min_pos.x; x < grid_max_pos.x; x += grid_step_size) {
-        for (int y = grid_min_pos.y; y < grid_max_pos.y; y += grid_step_size) {
-            // ImVec2 pos_on_grid = ImVec2(x * zoom_level - grid_pos.x, y * zoom_level - grid_pos.y);
-            ImVec2 pos_on_grid = ImVec2(x + grid_pos.x + (margin * zoom_level),
-                                        y + grid_pos.y + (margin * zoom_level));
+void drawBlocks(ImDrawList* draw_list, const ImVec2& view_min, const ImVec2& view_max, const ImVec2& grid_pos,
+                const ImVec2& grid_min_pos, float zoom_level) {
+    /* Only the blocks in view, and the imports that touch them, are drawn. Names are left out once they get too
+     * small to read, below that the packages are drawn instead of the blocks. */
 
-            // Only draw the cell if it's within the mask area
-            if (pos_on_grid.x >= grid_min_pos.x - margin && pos_on_grid.y >= grid_min_pos.y - zoom_level &&
-                pos_on_grid.x < grid_min_pos.x + MenuState.menu_width && pos_on_grid.y < grid_min_pos.y + MenuState.menu_height) {
+    const float cluster_zoom_level = 0.5f;
+    const float name_zoom_level = 0.75f;
 
-                draw_list->AddLine(pos_on_grid, ImVec2(pos_on_grid.x + grid_step_size, pos_on_grid.y), IM_COL32(255, 255, 255, 255));
-                draw_list->AddLine(pos_on_grid, ImVec2(pos_on_grid.x, pos_on_grid.y + grid_step_size), IM_COL32(255, 255, 255, 255));
-            }
+    if (zoom_level < cluster_zoom_level) {
+        drawClusters(draw_list, view_min, view_max, grid_pos, grid_min_pos, zoom_level);
+        return;
+    }
 
-            if (y > grid_min_pos.y) {
-                std::cout << "2 Pos x: " << pos_on_grid.x << ", y: " << pos_on_grid.y << "\n\n";
-                goto End;
+    const BlockIndex& block_index = MenuState.block_index;
+    int frame = ImGui::GetFrameCount();
+
+    vector<CodeBlock*> visible_blocks;
+    block_index.forEachBlock(gridPosFromScreen(view_min, grid_pos, grid_min_pos, zoom_level),
+                             gridPosFromScreen(view_max, grid_pos, grid_min_pos, zoom_level),
+                             [&](CodeBlock* code_block) {
+        code_block->drawn_frame = frame;
+        visible_blocks.push_back(code_block);
+    });
+
+    auto getCenter = [&](const CodeBlock* code_block) {
+        return projectPosFromGrid(code_block->relative_pos, grid_pos, grid_min_pos, zoom_level);
+    };
+
+    // Imports of visible blocks, and imports into them from blocks out of view. Edges between two blocks out of view
+    // that cross the view are skipped.
+    const ImU32 edge_color = IM_COL32(200, 200, 200, 120);
+    for (const CodeBlock* code_block: visible_blocks) {
+        for (const Import* import: code_block->file->imports) {
+            const CodeBlock* imported = block_index.find(import->file);
+            if (imported != nullptr) {
+                draw_list->AddLine(getCenter(code_block), getCenter(imported), edge_color);
             }
-            std::cout << "1 Grid x: " << pos_on_grid.x << ", y: " << pos_on_grid.y << "\n";
+        }
 
-            ImVec2 screen_pos = projectPosFromGrid();
-            std::cout << "1 Screen x: " <<  << ", y: " << pos_on_grid.y << "\n";
+        for (const File* importer_file: code_block->file->imported_by) {
+            const CodeBlock* importer = block_index.find(importer_file);
+            if (importer != nullptr && importer->drawn_frame != frame) {
+                draw_list->AddLine(getCenter(importer), getCenter(code_block), edge_color);
+            }
         }
     }
 
-    End:
+    for (CodeBlock* code_block: visible_blocks) {
+        code_block->drawBlock(draw_list, grid_pos, grid_min_pos, zoom_level, zoom_level >= name_zoom_level);
+    }
+}
+
+void DrawGrid(float grid_step_size, ImU32 background_color, bool recenter) {
+    /* Draws one line per visible row and column of the grid, so the cost only depends on the size of the view.
+     * Zoomed out far enough for the lines to crowd together, every other line is dropped (the step doubles). */
+
+    ImDrawList* draw_list = ImGui::GetWindowDrawList();
+    ImVec2 grid_min_pos = ImVec2(ImGui::GetColumnOffset(2) + 15, 65);
+    ImVec2 grid_max_pos = ImVec2(MenuState.menu_width - 25, MenuState.menu_height - 25);
+
+    draw_list->PushClipRect(grid_min_pos, grid_max_pos, true);
+    draw_list->AddRectFilled(grid_min_pos, grid_max_pos, background_color);
+
+    static ImVec2 grid_pos = ImVec2(0, 0);  // How far the grid has been dragged, in screen pixels.
+    static float zoom_level = 1.0f;
+    moveGrid(grid_pos, grid_min_pos, grid_max_pos, recenter, zoom_level);
+
+    const float min_line_spacing = 8.0f;  // Screen pixels.
+
+    float screen_step = grid_step_size * zoom_level;
+    while (screen_step < min_line_spacing) {
+        screen_step *= 2;
+    }
+
+    // Screen position of the grid line right before the view, in both directions.
+    ImVec2 origin = projectPosFromGrid(ImVec2(0, 0), grid_pos, grid_min_pos, zoom_level);
+    float first_x = origin.x + std::floor((grid_min_pos.x - origin.x) / screen_step) * screen_step;
+    float first_y = origin.y + std::floor((grid_min_pos.y - origin.y) / screen_step) * screen_step;
 
-    // std::cout << "\n          Min x: " << grid_min_pos.x - (margin * zoom_level) + grid_pos.x << ", Min y: " << grid_min_pos.y - (margin * zoom_level) + grid_pos.y << ", Max x: " << grid_max_pos.x - (margin * zoom_level) + grid_pos.x << ", Max y: " << grid_max_pos.y - (margin * zoom_level) + grid_pos.y << ".\n";
+    const ImU32 line_color = IM_COL32(255, 255, 255, 255);
+
+    for (float x = first_x; x < grid_max_pos.x; x += screen_step) {
+        draw_list->AddLine(ImVec2(x, grid_min_pos.y), ImVec2(x, grid_max_pos.y), line_color);
+    }
+    for (float y = first_y; y < grid_max_pos.y; y += screen_step) {
+        draw_list->AddLine(ImVec2(grid_min_pos.x, y), ImVec2(grid_max_pos.x, y), line_color);
+    }
 
-    drawBlocks(draw_list, grid_pos, zoom_level);
+    drawBlocks(draw_list, grid_min_pos, grid_max_pos, grid_pos, grid_min_pos, zoom_level);
 
     draw_list->PopClipRect();
 }
 
-void drawMenuBar(vector<File*>& original_files) {
+void drawMenuBar() {
     if (ImGui::BeginMainMenuBar()) {
         if (ImGui::BeginMenu("File")) {
             if (ImGui::MenuItem("Open new project", "Ctrl + O")) {
@@ -279,26 +908,86 @@ void drawMenuBar(vector<File*>& original_files) {
 
                 string project_path = getProjectPath();
 
-                // TODO: Delete old file objects.
-
-                original_files = openNewProject(project_path);
-                MenuState.files = original_files;
-
-                MenuState.selected_file_tab = 0;
+                if (!project_path.empty()) {
+                    ScanMode scan_mode = MenuState.full_scan ? ScanMode::Full : ScanMode::Header;
+                    startLoading(project_path, [project_path, scan_mode](LoadProgress& progress) {
+                        return openProject(project_path, scan_mode, &progress);
+                    });
+                }
+            } else if (ImGui::MenuItem("Rescan project", "Ctrl + R", false, !MenuState.project->path.empty())) {
+                auto rescan = std::make_shared<ProjectRescan>(*MenuState.project);
+                startLoading("changes in " + MenuState.project->path, [rescan](LoadProgress& progress) {
+                    rescan->scan(0, &progress);
+                    return std::unique_ptr<Project>();
+                }, [rescan](std::unique_ptr<Project>) {
+                    applyRescan(*rescan);
+                });
             } else if (ImGui::MenuItem("Open project settings", "Ctrl + O")) {
                 std::cout << "Open.\n";
 
                 string settings_file = getSettingsFile();
 
-                // TODO: Delete old file objects.
-
-                original_files = loadDataFromJSON(settings_file);
-                MenuState.files = original_files;
-
-                MenuState.selected_file_tab = 0;
+                if (!settings_file.empty()) {
+                    ScanMode scan_mode = MenuState.full_scan ? ScanMode::Full : ScanMode::Header;
+                    startLoading(settings_file, [settings_file, scan_mode](LoadProgress& progress) {
+                        return loadDataFromJSON(settings_file, scan_mode, &progress);
+                    });
+                }
+            } else if (ImGui::MenuItem("Open project snapshot")) {
+                string snapshot_file = getSettingsFile("snapshot");
+
+                if (!snapshot_file.empty()) {
+                    startLoading(snapshot_file, [snapshot_file](LoadProgress& progress) {
+                        return loadSnapshot(snapshot_file, &progress);
+                    });
+                }
             } else if (ImGui::MenuItem("Save changes", "Ctrl + S")) {
                 std::cout << "Save.\n";
-                saveDataToJSON(MenuState.files, getProjectPath(MenuState.files[0]->file_name));
+
+                string save_path = getSavePath(*MenuState.project);
+                if (save_path.empty()) {
+                    save_path = getSaveFile("snapshot");
+                }
+
+                if (!save_path.empty()) {
+                    saveProject(save_path);
+                }
+            } else if (ImGui::MenuItem("Export JSON")) {
+                string json_path = getSaveFile("json");
+
+                if (!json_path.empty()) {
+                    exportJSON(json_path);
+                }
+            }
+
+            // For the projects opened after. Header scans are much faster, but miss most definitions.
+            ImGui::Separator();
+            ImGui::MenuItem("Scan whole files", nullptr, &MenuState.full_scan);
+
+            ImGui::EndMenu();
+        }
+
+        if (ImGui::BeginMenu("Edit")) {
+            if (ImGui::MenuItem("Undo", "Ctrl + Z", false, MenuState.history->canUndo())) {
+                recordRestored(MenuState.history->undo());
+            } else if (ImGui::MenuItem("Redo", "Ctrl + Y", false, MenuState.history->canRedo())) {
+                recordRestored(MenuState.history->redo());
+            }
+
+            ImGui::EndMenu();
+        }
+
+        if (ImGui::BeginMenu("View")) {
+            if (ImGui::MenuItem("Layered layout", nullptr, MenuState.layout_mode == LayoutMode::Layered)) {
+                setLayoutMode(LayoutMode::Layered);
+            } else if (ImGui::MenuItem("Force directed layout", nullptr, MenuState.layout_mode == LayoutMode::Force)) {
+                setLayoutMode(LayoutMode::Force);
+            }
+
+            ImGui::Separator();
+            ImGui::MenuItem("Import cycles", nullptr, &MenuState.show_import_cycles);
+            if (ImGui::MenuItem("Profiler", nullptr, &MenuState.show_profiler)) {
+                setProfiling(MenuState.show_profiler);
             }
 
             ImGui::EndMenu();
@@ -308,14 +997,148 @@ void drawMenuBar(vector<File*>& original_files) {
     }
 }
 
-void drawBody(vector<File*>& original_files) {
+void drawToDos(File& file) {
+    /* A checkbox per todo, a button to remove it and a field to add new ones. */
+
+    bool changed = false;
+
+    ImGui::Dummy(ImVec2(0.0f, 10.0f));
+    ImGui::Text("To do");
+
+    for (size_t i = 0; i < file.to_dos.size(); i++) {
+        ToDo* to_do = file.to_dos[i];
+        ImGui::PushID((int) i);
+
+        changed |= ImGui::Checkbox("##done", &to_do->done);
+        ImGui::SameLine();
+        if (to_do->done) {
+            ImGui::TextDisabled("%s", to_do->content.c_str());
+        } else {
+            ImGui::Text("%s", to_do->content.c_str());
+        }
+        ImGui::SameLine();
+        if (ImGui::SmallButton("x")) {
+            file.to_dos.erase(file.to_dos.begin() + (long) i);
+            MenuState.project->arena.to_dos.destroy(to_do);
+            changed = true;
+        }
+
+        ImGui::PopID();
+        if (changed) break;  // The list changed under the loop.
+    }
+
+    static char new_to_do[256];
+    bool add = ImGui::InputText("##new to do", new_to_do, sizeof(new_to_do), ImGuiInputTextFlags_EnterReturnsTrue);
+    ImGui::SameLine();
+    add |= ImGui::Button("Add");
+
+    if (add && new_to_do[0] != '\0') {
+        ToDo* to_do = MenuState.project->arena.to_dos.create();
+        to_do->done = false;
+        to_do->content = new_to_do;
+        file.to_dos.push_back(to_do);
+
+        new_to_do[0] = '\0';
+        changed = true;
+    }
+
+    if (changed) {
+        recordEdit(&file, EditKind::ToDos);
+    }
+}
+
+void drawFileList(const char* label, const vector<const File*>& files) {
+    /* Collapsed by default, clicking a file selects it. */
+
+    string header = string(label) + " (" + std::to_string(files.size()) + ")###" + label;
+    if (!ImGui::CollapsingHeader(header.c_str())) return;
+
+    ImGui::PushID(label);
+    ImGuiListClipper clipper;  // Everything a file depends on can be most of the project.
+    clipper.Begin((int) files.size());
+    while (clipper.Step()) {
+        for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; i++) {
+            if (ImGui::Selectable(files[i]->file_name.c_str())) {
+                auto file = std::find(MenuState.files.begin(), MenuState.files.end(), files[i]);
+                if (file != MenuState.files.end()) {
+                    MenuState.selected_file_tab = (int) (file - MenuState.files.begin());
+                }
+            }
+        }
+    }
+    clipper.End();
+    ImGui::PopID();
+}
+
+void drawDependencies(const File& file) {
+    /* What the file imports and what imports it, directly or not, and the names it imports. Only asked again when
+     * the selection or the project changes. */
+
+    if (MenuState.dependency_index == nullptr) {
+        MenuState.dependency_index = std::make_unique<DependencyIndex>(MenuState.files);
+        if (MenuState.project->scan_mode == ScanMode::Full) {  // A header scan misses most definitions.
+            MenuState.symbol_index = std::make_unique<SymbolIndex>(MenuState.files);
+        }
+        MenuState.queried_file = nullptr;
+    }
+
+    if (MenuState.queried_file != &file) {
+        MenuState.queried_file = &file;
+        MenuState.dependencies = MenuState.dependency_index->getDependencies(&file);
+        MenuState.dependents = MenuState.dependency_index->getDependents(&file);
+        MenuState.cycle = MenuState.dependency_index->getCycle(&file);
+
+        MenuState.imported_names.clear();
+        for (const Import* import: file.imports) {
+            if (MenuState.symbol_index == nullptr) break;
+
+            const SymbolIndex& symbols = *MenuState.symbol_index;
+            for (const SymbolIndex::Symbol& symbol: symbols.getSymbols(import)) {
+                const File* defining_file = symbols.getFile(symbol);
+                if (defining_file == nullptr || symbol.name == SymbolIndex::whole_module) continue;
+
+                MenuState.imported_names.push_back(symbol.name.str() + " (" + defining_file->file_name.str() + ")");
+            }
+        }
+    }
+
+    ImGui::Dummy(ImVec2(0.0f, 10.0f));
+    drawFileList("Depends on", MenuState.dependencies);
+    drawFileList("Needed by", MenuState.dependents);
+    if (!MenuState.cycle.empty()) {
+        drawFileList("Import cycle", MenuState.cycle);
+    }
+
+    if (MenuState.symbol_index == nullptr) {
+        ImGui::TextDisabled("Imported names need a project opened with File > Scan whole files.");
+        return;
+    }
+
+    string header = "Imported names (" + std::to_string(MenuState.imported_names.size()) + ")###Imported names";
+    if (ImGui::CollapsingHeader(header.c_str())) {
+        ImGuiListClipper clipper;  // A star import can bring in hundreds.
+        clipper.Begin((int) MenuState.imported_names.size());
+        while (clipper.Step()) {
+            for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; i++) {
+                ImGui::TextUnformatted(MenuState.imported_names[i].c_str());
+            }
+        }
+        clipper.End();
+    }
+}
+
+void drawBody() {
     ImGui::Columns(3);
     ImGui::SetColumnOffset(1, 200); {
         // Left: file select
-        for(int i = 0; i < MenuState.files.size(); i++) {
-            // for(File file: MenuState.files) {
-            if (ImGui::MenuItem(MenuState.files[i]->file_name.c_str())) {
-                MenuState.selected_file_tab = i;
+        if (MenuState.load_job != nullptr) {
+            drawLoadProgress();
+        } else {
+            for(int i = 0; i < MenuState.files.size(); i++) {
+                // for(File file: MenuState.files) {
+                if (ImGui::MenuItem(MenuState.files[i]->file_name.c_str())) {
+                    MenuState.selected_file_tab = i;
+                }
             }
         }
     }
@@ -328,14 +1151,14 @@ void drawBody(vector<File*>& original_files) {
 
         if (MenuState.selected_file_tab == 0) {
             if (ImGui::Button("Revert all changes")) {
-                MenuState.files = original_files;
+                recordRestored(MenuState.history->revertAll());
             }
         } else {
             ImGui::Dummy(ImVec2(0.0f, 19.0f));
         }
 
-        if (ImGui::Button("Revert changes")) {
-            MenuState.files[MenuState.selected_file_tab] = original_files[MenuState.selected_file_tab];
+        if (ImGui::Button("Revert changes") && MenuState.history->revertFile(selected_file)) {
+            recordRestored({selected_file});
         }
 
         static char buffer[2048];
@@ -344,7 +1167,11 @@ void drawBody(vector<File*>& original_files) {
 
         if (string(buffer) != selected_file->notes) {
             MenuState.files[MenuState.selected_file_tab]->notes = buffer;
+            recordEdit(selected_file, EditKind::Notes);
         }
+
+        drawToDos(*selected_file);
+        drawDependencies(*selected_file);
     }
     ImGui::NextColumn(); {
         bool recenter = ImGui::Button("Recenter");
@@ -352,10 +1179,100 @@ void drawBody(vector<File*>& original_files) {
     }
 }
 
-void show(GLFWwindow* window, vector<File*>& original_files) {
+void drawImportCycles() {
+    ImGui::SetNextWindowSize(ImVec2(420, 300), ImGuiCond_FirstUseEver);
+    if (!ImGui::Begin("Import cycles", &MenuState.show_import_cycles)) {
+        ImGui::End();
+        return;
+    }
+
+    if (!MenuState.import_cycles) {
+        MenuState.import_cycles = describeImportCycles(MenuState.files, computeImportLevels(MenuState.files));
+    }
+
+    if (MenuState.import_cycles->empty()) {
+        ImGui::TextDisabled("No files import each other in a loop.");
+    }
+    for (const string& cycle: *MenuState.import_cycles) {
+        ImGui::TextWrapped("%s", cycle.c_str());
+    }
+
+    ImGui::End();
+}
+
+void drawProfiler() {
+    /* Frame times, the time spent in every stage and the counters, since the profile was last cleared. */
+
+    ImGui::SetNextWindowSize(ImVec2(480, 420), ImGuiCond_FirstUseEver);
+    if (!ImGui::Begin("Profiler", &MenuState.show_profiler)) {
+        ImGui::End();
+        return;
+    }
+
+    ProfileSummary summary = getProfileSummary();
+
+    // Scaled to a 60 fps frame at least, so short frames look short.
+    float max_milliseconds = 1000.0f / 60.0f;
+    for (float milliseconds: summary.frame_milliseconds) {
+        max_milliseconds = std::max(max_milliseconds, milliseconds);
+    }
+    char overlay[32] = "";
+    if (!summary.frame_milliseconds.empty()) {
+        snprintf(overlay, sizeof(overlay), "%.2f ms", summary.frame_milliseconds.back());
+    }
+    ImGui::PlotHistogram("##frame times", summary.frame_milliseconds.data(), (int) summary.frame_milliseconds.size(),
+                         0, overlay, 0.0f, max_milliseconds, ImVec2(-1.0f, 80.0f));
+
+    for (size_t i = 0; i < profile_counter_count; i++) {
+        ImGui::Text("%s: %lld last frame, %lld in total", getCounterName((ProfileCounter) i),
+                    summary.frame_counters[i], summary.counters[i]);
+    }
+
+    ImGui::Separator();
+    ImGui::BeginChild("Stages", ImVec2(0.0f, -30.0f));
+    ImGui::Columns(4, "stages");
+    for (const char* header: {"Stage", "Calls", "Total ms", "Max ms"}) {
+        ImGui::TextDisabled("%s", header);
+        ImGui::NextColumn();
+    }
+    for (const StageProfile& stage: summary.stages) {
+        ImGui::Text("%s", stage.name);
+        ImGui::NextColumn();
+        ImGui::Text("%zu", stage.calls);
+        ImGui::NextColumn();
+        ImGui::Text("%.2f", stage.total_milliseconds);
+        ImGui::NextColumn();
+        ImGui::Text("%.2f", stage.max_milliseconds);
+        ImGui::NextColumn();
+    }
+    ImGui::Columns(1);
+    ImGui::EndChild();
+
+    if (ImGui::Button("Clear")) {
+        clearProfile();
+    }
+    ImGui::SameLine();
+    if (ImGui::Button("Save trace")) {
+        string trace_path = getSaveFile("json");
+
+        if (!trace_path.empty()) {
+            try {
+                saveChromeTrace(trace_path);
+            } catch (const std::runtime_error& error) {
+                std::cout << "Failed to save trace " << trace_path << ": " << error.what() << '\n';
+            }
+        }
+    }
+    ImGui::SameLine();
+    ImGui::TextDisabled("%zu events, %zu dropped", summary.event_count, summary.dropped_event_count);
+
+    ImGui::End();
+}
+
+void show(GLFWwindow* window) {
     ImVec4 clear_color = ImVec4(0.125f, 0.00f, 0.25f, 0.00f);
 
-    glfwPollEvents();
+    beginProfileFrame();
 
     glfwGetWindowSize(window, &MenuState.menu_width, &MenuState.menu_height);
 
@@ -367,45 +1284,96 @@ void show(GLFWwindow* window, vector<File*>& original_files) {
         // ImFont *font = io.Fonts->AddFontFromFileTTF(R"(C:\Windows\Fonts\verdana.ttf)", 16.0f);
         // ImGui::PushFont(font);  // TODO: Font.
 
-        drawMenuBar(original_files);
+        ProfileScope scope("build ui");
+
+        drawMenuBar();
 
         ImGui::SetNextWindowSize(ImVec2(MenuState.menu_width, MenuState.menu_height - 18));  // , ImGuiCond_FirstUseEver);
         ImGui::SetNextWindowPos(ImVec2(0, 18));
 
         ImGui::Begin("Hello, world!", 0, ImGuiWindowFlags_NoTitleBar | ImGuiWindowFlags_NoResize | ImGuiWindowFlags_NoMove);
 
-        drawBody(original_files);
+        drawBody();
 
         ImGui::End();
+
+        if (MenuState.show_import_cycles) {
+            drawImportCycles();
+        }
+        if (MenuState.show_profiler) {
+            drawProfiler();
+            if (!MenuState.show_profiler) setProfiling(false);  // Closed with its own button.
+        }
     }
 
     // Rendering
-    ImGui::Render();
-    int display_w, display_h;
-    glfwGetFramebufferSize(window, &display_w, &display_h);
-    glViewport(0, 0, display_w, display_h);
-    glClearColor(clear_color.x, clear_color.y, clear_color.z, clear_color.w);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-    ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+    {
+        ProfileScope scope("render");
+
+        ImGui::Render();
+        countProfile(ProfileCounter::DrawVertices, ImGui::GetDrawData()->TotalVtxCount);
+
+        int display_w, display_h;
+        glfwGetFramebufferSize(window, &display_w, &display_h);
+        glViewport(0, 0, display_w, display_h);
+        glClearColor(clear_color.x, clear_color.y, clear_color.z, clear_color.w);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+    }
+
+    endProfileFrame();  // Without the wait for vsync in the swap.
 
     glfwSwapBuffers(window);
 }
 
-void createWindow(vector<File*>& original_files) {
-    static vector<CodeBlock*> code_blocks;
-    code_blocks.reserve(original_files.size());
+void setEventCallbacks(GLFWwindow* window) {
+    /* Any input redraws the window. Set before ImGui installs its own callbacks, which call these afterwards. */
+
+    glfwSetCursorPosCallback(window, [](GLFWwindow*, double, double) { markDirty(); });
+    glfwSetCursorEnterCallback(window, [](GLFWwindow*, int) { markDirty(); });
+    glfwSetMouseButtonCallback(window, [](GLFWwindow*, int, int, int) { markDirty(); });
+    glfwSetScrollCallback(window, [](GLFWwindow*, double, double) { markDirty(); });
+    glfwSetKeyCallback(window, [](GLFWwindow*, int, int, int, int) { markDirty(); });
+    glfwSetCharCallback(window, [](GLFWwindow*, unsigned int) { markDirty(); });
+    glfwSetWindowSizeCallback(window, [](GLFWwindow*, int, int) { markDirty(); });
+    glfwSetWindowFocusCallback(window, [](GLFWwindow*, int) { markDirty(); });
+    glfwSetWindowRefreshCallback(window, [](GLFWwindow*) { markDirty(); });
+}
 
-    for (File* file: original_files) {
-        CodeBlock* code_block = new CodeBlock;
-        code_block->file = file;
+void runMainLoop(GLFWwindow* window) {
+    /* Sleeps until there's input, a background job wakes it up (glfwPostEmptyEvent) or the timeout passes, and only
+     * draws a frame when something changed. The timeout is there for what doesn't wake the loop: the file watcher,
+     * load progress and the blinking text cursor. */
 
-        code_blocks.push_back(code_block);
-    }
+    const double idle_timeout = 0.5;  // Seconds.
+    const double busy_timeout = 0.1;  // While loading, for the progress bar.
 
-    setFileImportLevels(code_blocks);
+    markDirty();
 
-    MenuState.code_blocks = code_blocks;
+    while (!glfwWindowShouldClose(window)) {
+        if (MenuState.dirty_frames > 0) {
+            glfwPollEvents();
+        } else {
+            glfwWaitEventsTimeout(MenuState.load_job != nullptr ? busy_timeout : idle_timeout);
+
+            if (ImGui::GetIO().WantTextInput) {
+                markDirty();  // Keep the cursor blinking.
+            }
+        }
+
+        applyLoadJob();
+        applyWatchedChanges();
+        applyLayout();
+        compactJournal();
+
+        if (MenuState.dirty_frames > 0) {
+            show(window);
+            MenuState.dirty_frames--;
+        }
+    }
+}
 
+void createWindow(std::unique_ptr<Project> project) {
     glfwSetErrorCallback(glfw_error_callback);
     if (!glfwInit()) {
         return;
@@ -442,17 +1410,21 @@ void createWindow(vector<File*>& original_files) {
     setStyle();
 
     // Setup Platform/Renderer bindings
+    setEventCallbacks(window);
     ImGui_ImplGlfw_InitForOpenGL(window, true);
     ImGui_ImplOpenGL3_Init(glsl_version);
 
-    // Main loop
-    MenuState.files = original_files;  // TODO: Add reset option.
+    setProject(std::move(project));
 
-    while (!glfwWindowShouldClose(window)) {
-        show(window, original_files);
-    }
+    // Main loop
+    runMainLoop(window);
 
     // Cleanup
+    MenuState.load_job.reset();
+    MenuState.watcher.reset();
+    MenuState.layout_engine.reset();
+    MenuState.project.reset();
+
     ImGui_ImplOpenGL3_Shutdown();
     ImGui_ImplGlfw_Shutdown();
     ImGui::DestroyContext();
@@ -0,0 +1,273 @@
+#include <chrono>
+
+#include "common.h"
+
+namespace {
+    constexpr unsigned node_bits = 5;
+    constexpr size_t node_width = 1 << node_bits;
+    constexpr size_t node_mask = node_width - 1;
+
+    using Clock = std::chrono::steady_clock;
+}
+
+class DocumentVersion::Node {  // Never changed once shared, an edit copies the nodes on the way to the slot.
+    public:
+        vector<std::shared_ptr<const Node>> children;  // Inner nodes, node_width once used.
+        vector<std::shared_ptr<const FileState>> states;  // Leaves, node_width once used.
+};
+
+namespace {
+    using Node = DocumentVersion::Node;
+
+    const Node* getChild(const Node* node, size_t index) {
+        return node != nullptr && !node->children.empty() ? node->children[index].get() : nullptr;
+    }
+
+    const FileState* getState(const Node* node, size_t index) {
+        return node != nullptr && !node->states.empty() ? node->states[index].get() : nullptr;
+    }
+
+    std::shared_ptr<const Node> setInNode(const Node* node, unsigned level, size_t slot,
+                                          std::shared_ptr<const FileState> state) {
+        auto copy = node != nullptr ? std::make_shared<Node>(*node) : std::make_shared<Node>();
+        size_t index = (slot >> level) & node_mask;
+
+        if (level == 0) {
+            copy->states.resize(node_width);
+            copy->states[index] = std::move(state);
+        } else {
+            copy->children.resize(node_width);
+            copy->children[index] = setInNode(copy->children[index].get(), level - node_bits, slot, std::move(state));
+        }
+
+        return copy;
+    }
+
+    template<class OnDifference>
+    void diffNodes(const Node* a, const Node* b, unsigned level, size_t first_slot, size_t slot_count,
+                   OnDifference& on_difference) {
+        /* Subtrees both versions share are skipped whole, so this only visits what changed in between. */
+
+        if (a == b) return;
+
+        for (size_t i = 0; i < node_width; i++) {
+            size_t slot = first_slot + (i << level);
+            if (slot >= slot_count) return;
+
+            if (level == 0) {
+                if (getState(a, i) != getState(b, i)) on_difference(slot);
+            } else {
+                diffNodes(getChild(a, i), getChild(b, i), level - node_bits, slot, slot_count, on_difference);
+            }
+        }
+    }
+}
+
+const std::shared_ptr<const FileState>& DocumentVersion::get(size_t slot) const {
+    static const std::shared_ptr<const FileState> missing;
+    if (slot >= count) return missing;
+
+    const Node* node = root.get();
+    for (unsigned level = shift; level > 0; level -= node_bits) {
+        node = getChild(node, (slot >> level) & node_mask);
+    }
+    return node != nullptr && !node->states.empty() ? node->states[slot & node_mask] : missing;
+}
+
+DocumentVersion DocumentVersion::set(size_t slot, std::shared_ptr<const FileState> state) const {
+    /* slot == size() appends. */
+
+    DocumentVersion version = *this;
+
+    if (slot == count) {
+        version.count++;
+
+        // Full, another level on top.
+        if (count == (size_t) 1 << (shift + node_bits)) {
+            auto new_root = std::make_shared<Node>();
+            new_root->children.resize(node_width);
+            new_root->children[0] = root;
+
+            version.root = new_root;
+            version.shift += node_bits;
+        }
+    }
+
+    version.root = setInNode(version.root.get(), version.shift, slot, std::move(state));
+    return version;
+}
+
+void DocumentVersion::forEachDifference(const DocumentVersion& other, const std::function<void(size_t)>& on_difference) const {
+    /* Slots that are only in the longer version don't count. */
+
+    size_t slot_count = std::min(count, other.count);
+    if (slot_count == 0) return;
+
+    // The shorter version is the first child (all the way down) of the root of the longer one.
+    const Node* a = root.get();
+    const Node* b = other.root.get();
+    unsigned a_shift = shift, b_shift = other.shift;
+    while (a_shift > b_shift) {
+        a = getChild(a, 0);
+        a_shift -= node_bits;
+    }
+    while (b_shift > a_shift) {
+        b = getChild(b, 0);
+        b_shift -= node_bits;
+    }
+
+    diffNodes(a, b, a_shift, 0, slot_count, on_difference);
+}
+
+EditHistory::EditHistory(Project& project) : project(project) {
+    versions.emplace_back();
+    addFiles(project.files);
+    saved = versions.back();
+}
+
+void EditHistory::addFiles(const vector<File*>& files) {
+    /* Files that showed up since, e.g. in a rescan. They're added to the current version, older ones never knew them. */
+
+    DocumentVersion& version = versions[current];
+    for (File* file: files) {
+        if (slots.count(file)) continue;
+
+        slots[file] = files_by_slot.size();
+        files_by_slot.push_back(file);
+        version = version.set(version.size(), getState(*file));
+    }
+}
+
+void EditHistory::recordEdit(File* file, EditKind kind) {
+    /* After the notes or todos of a file changed. Typing into the notes of the same file keeps adding to the last
+     * edit for a moment, so undo doesn't go a letter at a time. */
+
+    const auto merge_time = std::chrono::milliseconds(1000);
+
+    auto slot = slots.find(file);
+    if (slot == slots.end()) {
+        addFiles({file});  // Unknown until now, there's no earlier state to go back to.
+        return;
+    }
+
+    long long now = Clock::now().time_since_epoch().count();
+    bool merge = kind == EditKind::Notes && last_kind == EditKind::Notes && last_slot == slot->second &&
+                 current + 1 == versions.size() && current > 0 &&
+                 now - last_edit_time < std::chrono::duration_cast<Clock::duration>(merge_time).count();
+
+    DocumentVersion version = versions[current].set(slot->second, getState(*file));
+    if (merge) {
+        versions[current] = version;
+    } else {
+        pushVersion(version);
+    }
+
+    last_kind = kind;
+    last_slot = slot->second;
+    last_edit_time = now;
+}
+
+vector<File*> EditHistory::undo() {
+    if (!canUndo()) return {};
+    return moveTo(current - 1);
+}
+
+vector<File*> EditHistory::redo() {
+    if (!canRedo()) return {};
+    return moveTo(current + 1);
+}
+
+bool EditHistory::canUndo() const {
+    return current > 0;
+}
+
+bool EditHistory::canRedo() const {
+    return current + 1 < versions.size();
+}
+
+void EditHistory::markSaved() {
+    saved = versions[current];
+}
+
+bool EditHistory::revertFile(File* file) {
+    /* Back to how the file was when last saved, as an edit of its own that can be undone. */
+
+    auto slot = slots.find(file);
+    if (slot == slots.end()) return false;
+
+    const std::shared_ptr<const FileState>& saved_state = saved.get(slot->second);
+    if (saved_state == nullptr || saved_state == versions[current].get(slot->second)) return false;
+
+    setState(*file, *saved_state);
+    pushVersion(versions[current].set(slot->second, saved_state));  // Shares the saved state, it's unchanged again.
+    return true;
+}
+
+vector<File*> EditHistory::revertAll() {
+    vector<File*> changed_files;
+    saved.forEachDifference(versions[current], [&](size_t slot) {
+        changed_files.push_back(files_by_slot[slot]);
+    });
+    if (changed_files.empty()) return changed_files;
+
+    DocumentVersion version = versions[current];
+    for (File* file: changed_files) {
+        size_t slot = slots[file];
+        setState(*file, *saved.get(slot));
+        version = version.set(slot, saved.get(slot));
+    }
+    pushVersion(version);  // One edit for all of them.
+
+    return changed_files;
+}
+
+vector<File*> EditHistory::moveTo(size_t version_index) {
+    /* Only the files that differ between the two versions are touched. */
+
+    vector<File*> changed_files;
+    versions[current].forEachDifference(versions[version_index], [&](size_t slot) {
+        changed_files.push_back(files_by_slot[slot]);
+    });
+
+    for (File* file: changed_files) {
+        const std::shared_ptr<const FileState>& state = versions[version_index].get(slots[file]);
+        if (state != nullptr) setState(*file, *state);
+    }
+
+    current = version_index;
+    last_kind = EditKind::Revert;  // Nothing to merge into.
+    return changed_files;
+}
+
+void EditHistory::pushVersion(const DocumentVersion& version) {
+    versions.resize(current + 1);  // Drops what could be redone.
+    versions.push_back(version);
+    current++;
+
+    if (versions.size() > max_versions) {
+        versions.erase(versions.begin());
+        current--;
+    }
+
+    last_kind = EditKind::Revert;  // Only typing merges, set again by recordEdit.
+}
+
+std::shared_ptr<const FileState> EditHistory::getState(const File& file) const {
+    auto state = std::make_shared<FileState>();
+    state->notes = file.notes;
+    state->to_dos.reserve(file.to_dos.size());
+    for (const ToDo* to_do: file.to_dos) {
+        state->to_dos.push_back(*to_do);
+    }
+    return state;
+}
+
+void EditHistory::setState(File& file, const FileState& state) {
+    /* The todos are new objects, the ones they replace go back to the arena. */
+
+    file.notes = state.notes;
+    project.arena.destroyToDos(&file);
+    for (const ToDo& to_do: state.to_dos) {
+        file.to_dos.push_back(project.arena.to_dos.create(to_do));
+    }
+}
@@ -0,0 +1,376 @@
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+
+#include "common.h"
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#include <sys/stat.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace {
+    /* A journal is a run of records, each one the whole notes or the whole todo list of one file as of an edit:
+     *
+     *     uint32_t payload size, uint64_t checksum of the payload (hashContent), payload
+     *
+     * The payload is a kind byte and the file's key (getRecordKey), then the notes, or the todo count and every todo
+     * as a done byte and its content. Strings are a uint32_t size followed by the bytes. A record that was cut short
+     * by a crash fails its checksum, it and anything after it is dropped. Replaying a record twice does no harm. */
+
+    enum class RecordKind : uint8_t {
+        ModuleNotes = 1,  // Keyed by module name, only read from journals of older versions.
+        ModuleToDos = 2,
+        Notes = 3,
+        ToDos = 4,
+    };
+
+    string getRecordKey(const string& project_path, const File& file) {
+        /* The file's path, relative to the project folder if it's in it, so a moved project still finds its edits.
+         * Module names can be shared, by "General" and a top level file or by modules under different source roots.
+         * Only files without a path ("General") go by module name. */
+
+        if (file.file_path.empty()) return file.file_name.str();
+
+        string root = project_path;
+        while (root.size() > 1 && (root.back() == '/' || root.back() == '\\')) root.pop_back();
+
+        string path = file.file_path.str();
+        if (!root.empty() && startsWith(path, root + "/")) return path.substr(root.size() + 1);
+        return path;
+    }
+
+    constexpr size_t record_header_size = sizeof(uint32_t) + sizeof(uint64_t);
+
+    void appendValue(string& bytes, const void* value, size_t size) {
+        bytes.append(static_cast<const char*>(value), size);
+    }
+
+    void appendString(string& bytes, const string& text) {
+        uint32_t size = (uint32_t) text.size();
+        appendValue(bytes, &size, sizeof(size));
+        bytes += text;
+    }
+
+    class RecordReader {  // Bounds checked, a record that runs out of bytes is as bad as one with a wrong checksum.
+        public:
+            explicit RecordReader(std::string_view bytes) : bytes(bytes) {}
+
+            bool failed = false;
+
+            template<typename T>
+            T read() {
+                T value{};
+                if (bytes.size() - position < sizeof(T)) {
+                    failed = true;
+                    return value;
+                }
+                std::memcpy(&value, bytes.data() + position, sizeof(T));
+                position += sizeof(T);
+                return value;
+            }
+
+            string readString() {
+                uint32_t size = read<uint32_t>();
+                if (failed || bytes.size() - position < size) {
+                    failed = true;
+                    return "";
+                }
+                position += size;
+                return string(bytes.data() + position - size, size);
+            }
+
+        private:
+            std::string_view bytes;
+            size_t position = 0;
+    };
+
+    template<class OnRecord>
+    size_t readJournal(std::string_view journal, OnRecord on_record) {
+        /* Calls on_record(payload) for every intact record, returns how many bytes they take up. */
+
+        size_t position = 0;
+        while (journal.size() - position >= record_header_size) {
+            uint32_t payload_size;
+            uint64_t checksum;
+            std::memcpy(&payload_size, journal.data() + position, sizeof(payload_size));
+            std::memcpy(&checksum, journal.data() + position + sizeof(payload_size), sizeof(checksum));
+
+            if (journal.size() - position - record_header_size < payload_size) break;
+            std::string_view payload = journal.substr(position + record_header_size, payload_size);
+            if (hashContent(payload) != checksum) break;
+
+            on_record(payload);
+            position += record_header_size + payload_size;
+        }
+        return position;
+    }
+
+#ifdef _WIN32
+    int openForAppending(const string& file_path) {
+        return _open(file_path.c_str(), _O_WRONLY | _O_CREAT | _O_APPEND | _O_BINARY, _S_IREAD | _S_IWRITE);
+    }
+
+    bool writeAll(int file, const char* data, size_t size) {
+        while (size > 0) {
+            int written = _write(file, data, (unsigned) std::min(size, (size_t) INT32_MAX));
+            if (written <= 0) return false;
+            data += written;
+            size -= (size_t) written;
+        }
+        return true;
+    }
+
+    void syncToDisk(int file) { _commit(file); }
+    void truncateTo(int file, size_t size) { _chsize_s(file, (long long) size); }
+    void closeFile(int file) { _close(file); }
+#else
+    int openForAppending(const string& file_path) {
+        return open(file_path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    }
+
+    bool writeAll(int file, const char* data, size_t size) {
+        while (size > 0) {
+            ssize_t written = write(file, data, size);
+            if (written <= 0) return false;
+            data += written;
+            size -= (size_t) written;
+        }
+        return true;
+    }
+
+    void syncToDisk(int file) { fsync(file); }
+    void truncateTo(int file, size_t size) { (void) ftruncate(file, (off_t) size); }
+    void closeFile(int file) { close(file); }
+#endif
+}
+
+class EditJournal::Implementation {
+    /* Edits are queued in memory and written out and synced to disk on a thread of its own, so typing never waits for
+     * the disk. A batch of edits that come in while the last one is syncing is written in one go. */
+
+    public:
+        explicit Implementation(const string& file_path) : file_path(file_path) {
+            size_t journal_size, intact_size;
+            {
+                MappedFile mapped_file(file_path);
+                journal_size = mapped_file.content().size();
+                intact_size = readJournal(mapped_file.content(), [](std::string_view) {});
+            }
+
+            file = openForAppending(file_path);
+            if (file < 0) {
+                throw std::runtime_error("Failed to open journal: " + file_path);
+            }
+
+            // Appending after a torn record would hide every later one.
+            if (intact_size != journal_size) {
+                truncateTo(file, intact_size);
+            }
+            written_size = intact_size;
+
+            thread = std::thread(&Implementation::run, this);
+        }
+
+        ~Implementation() {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+            }
+            edited.notify_one();
+            thread.join();  // Everything that was recorded is on disk once it returns.
+
+            closeFile(file);
+        }
+
+        void append(const string& payload) {
+            uint32_t payload_size = (uint32_t) payload.size();
+            uint64_t checksum = hashContent(payload);
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                appendValue(pending, &payload_size, sizeof(payload_size));
+                appendValue(pending, &checksum, sizeof(checksum));
+                pending += payload;
+                pending_size = pending.size();
+            }
+            edited.notify_one();
+        }
+
+        size_t size() const {
+            return written_size + pending_size;
+        }
+
+        void clear() {
+            std::lock_guard<std::mutex> file_lock(file_mutex);
+            std::lock_guard<std::mutex> lock(mutex);
+
+            pending.clear();
+            pending_size = 0;
+            truncateTo(file, 0);
+            syncToDisk(file);
+            written_size = 0;
+        }
+
+    private:
+        string file_path;
+        int file = -1;
+
+        std::mutex file_mutex;  // Held while writing. Always taken before mutex.
+        std::mutex mutex;
+        std::condition_variable edited;
+
+        string pending;  // Records not written yet.
+        bool stopping = false;
+        bool failed = false;  // Reported once, the journal is only a safety net.
+
+        std::atomic<size_t> written_size = 0;
+        std::atomic<size_t> pending_size = 0;
+
+        std::thread thread;
+
+        void run() {
+            string batch;
+
+            while (true) {
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    edited.wait(lock, [this]() { return stopping || !pending.empty(); });
+                    if (pending.empty()) return;  // Stopping, and all written.
+                }
+
+                std::lock_guard<std::mutex> file_lock(file_mutex);
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    batch.swap(pending);
+                    pending.clear();
+                    pending_size = 0;
+                }
+                if (batch.empty()) continue;  // Cleared in the meantime.
+
+                if (writeAll(file, batch.data(), batch.size())) {
+                    syncToDisk(file);
+                    written_size += batch.size();
+                } else if (!failed) {
+                    failed = true;
+                    std::cout << "Failed to write journal: " << file_path << '\n';
+                }
+                batch.clear();
+            }
+        }
+};
+
+EditJournal::EditJournal(const string& file_path, const string& project_path)
+    : project_path(project_path), implementation(new Implementation(file_path)) {}
+
+EditJournal::~EditJournal() {
+    delete implementation;
+}
+
+void EditJournal::recordNotes(const File& file) {
+    string payload;
+    payload += (char) RecordKind::Notes;
+    appendString(payload, getRecordKey(project_path, file));
+    appendString(payload, file.notes);
+
+    implementation->append(payload);
+}
+
+void EditJournal::recordToDos(const File& file) {
+    string payload;
+    payload += (char) RecordKind::ToDos;
+    appendString(payload, getRecordKey(project_path, file));
+
+    uint32_t to_do_count = (uint32_t) file.to_dos.size();
+    appendValue(payload, &to_do_count, sizeof(to_do_count));
+    for (const ToDo* to_do: file.to_dos) {
+        payload += (char) to_do->done;
+        appendString(payload, to_do->content);
+    }
+
+    implementation->append(payload);
+}
+
+size_t EditJournal::size() const {
+    return implementation->size();
+}
+
+void EditJournal::clear() {
+    implementation->clear();
+}
+
+vector<File*> replayJournal(Project& project, const string& file_path) {
+    /* Applies the edits in a journal to the files they were made to, files that are gone are skipped. Returns the
+     * files that were changed, each once. */
+
+    MappedFile mapped_file(file_path);
+
+    std::unordered_map<string, File*> files_by_key;
+    std::unordered_map<std::string_view, File*> files_by_name;  // First one of a name, for older journals.
+    for (File* file: project.files) {
+        files_by_key.emplace(getRecordKey(project.path, *file), file);
+        files_by_name.emplace(file->file_name.view(), file);
+    }
+
+    vector<File*> changed_files;
+    std::unordered_set<const File*> changed;
+    readJournal(mapped_file.content(), [&](std::string_view payload) {
+        RecordReader reader(payload);
+        auto kind = (RecordKind) reader.read<uint8_t>();
+        string key = reader.readString();
+
+        bool by_module = kind == RecordKind::ModuleNotes || kind == RecordKind::ModuleToDos;
+        bool is_notes = kind == RecordKind::Notes || kind == RecordKind::ModuleNotes;
+        bool is_to_dos = kind == RecordKind::ToDos || kind == RecordKind::ModuleToDos;
+
+        string notes;
+        vector<ToDo*> to_dos;
+        if (is_notes) {
+            notes = reader.readString();
+        } else if (is_to_dos) {
+            uint32_t to_do_count = reader.read<uint32_t>();
+            for (uint32_t i = 0; i < to_do_count && !reader.failed; i++) {
+                ToDo* to_do = project.arena.to_dos.create();
+                to_do->done = reader.read<uint8_t>() != 0;
+                to_do->content = reader.readString();
+                to_dos.push_back(to_do);
+            }
+        } else {
+            return;  // From a newer version.
+        }
+
+        File* file = nullptr;
+        if (by_module) {
+            auto found = files_by_name.find(key);
+            if (found != files_by_name.end()) file = found->second;
+        } else {
+            auto found = files_by_key.find(key);
+            if (found != files_by_key.end()) file = found->second;
+        }
+
+        if (reader.failed || file == nullptr) {
+            for (ToDo* to_do: to_dos) project.arena.to_dos.destroy(to_do);
+            return;
+        }
+
+        if (is_notes) {
+            file->notes = std::move(notes);
+        } else {
+            project.arena.destroyToDos(file);
+            file->to_dos = std::move(to_dos);
+        }
+        if (changed.insert(file).second) changed_files.push_back(file);
+    });
+
+    return changed_files;
+}
+
+string getJournalPath(const string& save_path) {
+    return save_path + ".journal";
+}
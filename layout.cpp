@@ -0,0 +1,667 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <limits>
+#include <mutex>
+#include <thread>
+
+#include "common.h"
+
+LayoutGraph getLayoutGraph(const vector<File*>& files, const ImportLayers& layers) {
+    LayoutGraph graph;
+    graph.files.assign(files.begin(), files.end());
+    graph.levels = layers.levels;
+    graph.imports.resize(files.size());
+
+    std::unordered_map<const File*, size_t> file_indices;
+    file_indices.reserve(files.size());
+    for (size_t i = 0; i < files.size(); i++) {
+        file_indices.emplace(files[i], i);
+    }
+
+    for (size_t i = 0; i < files.size(); i++) {
+        for (const Import* import: files[i]->imports) {
+            auto imported = import->file != nullptr ? file_indices.find(import->file) : file_indices.end();
+            if (imported != file_indices.end()) {
+                graph.imports[i].push_back(imported->second);
+            }
+        }
+
+        std::sort(graph.imports[i].begin(), graph.imports[i].end());
+        graph.imports[i].erase(std::unique(graph.imports[i].begin(), graph.imports[i].end()), graph.imports[i].end());
+    }
+
+    return graph;
+}
+
+LayeredLayout::LayeredLayout(float layer_spacing, float node_spacing)
+    : layer_spacing(layer_spacing), node_spacing(node_spacing) {}
+
+void LayeredLayout::clear() {
+    placements.clear();
+}
+
+GraphLayout LayeredLayout::compute(const LayoutGraph& graph) {
+    /* Sugiyama style: the import levels are the layers, the order within every layer is found with barycenter sweeps
+     * to keep imports from crossing, then every file is pulled towards its neighbors as far as spacing allows.
+     * Imports that skip layers pull on both of their ends directly instead of through dummy nodes.
+     *
+     * Layers that didn't change since the last layout keep their order and positions. A layer changes when a file
+     * joins or leaves it, or when the imports of one of its files change, which also changes the layers of the
+     * files imported before and after. */
+
+    ProfileScope scope("layered layout");
+
+    const size_t file_count = graph.files.size();
+
+    GraphLayout layout;
+    layout.x.assign(file_count, 0.0f);
+    layout.y.assign(file_count, 0.0f);
+
+    int layer_count = 0;
+    for (int level: graph.levels) layer_count = std::max(layer_count, level + 1);
+
+    vector<bool> dirty_layers(layer_count, placements.empty());
+    auto markDirty = [&](int level) {
+        if (level >= 0 && level < layer_count) dirty_layers[level] = true;
+    };
+
+    auto importsChanged = [&](size_t i, const Placement& placement) {
+        if (graph.imports[i].size() != placement.imported_files.size()) return true;
+
+        for (size_t j = 0; j < graph.imports[i].size(); j++) {
+            if (graph.files[graph.imports[i][j]] != placement.imported_files[j]) return true;
+        }
+        return false;
+    };
+
+    vector<bool> changed(file_count, false);  // New, moved to another layer or imports something else.
+    vector<Placement*> last_placements(file_count, nullptr);
+    generation++;
+
+    for (size_t i = 0; i < file_count; i++) {
+        auto placement = placements.find(graph.files[i]);
+        if (placement == placements.end()) {
+            markDirty(graph.levels[i]);
+            changed[i] = true;
+            continue;
+        }
+
+        last_placements[i] = &placement->second;
+        placement->second.generation = generation;
+
+        if (placement->second.level != graph.levels[i]) {
+            markDirty(placement->second.level);
+            markDirty(graph.levels[i]);
+            changed[i] = true;
+        }
+
+        if (importsChanged(i, placement->second)) {
+            changed[i] = true;
+            markDirty(graph.levels[i]);
+            for (const File* imported: placement->second.imported_files) {
+                auto old_placement = placements.find(imported);
+                if (old_placement != placements.end()) markDirty(old_placement->second.level);
+            }
+            for (size_t imported: graph.imports[i]) markDirty(graph.levels[imported]);
+        }
+    }
+
+    vector<const File*> removed_files;
+    for (const auto& [file, placement]: placements) {
+        if (placement.generation != generation) {
+            markDirty(placement.level);
+            removed_files.push_back(file);
+        }
+    }
+
+    // Importers of every file. Imports within a layer (import cycles) don't take part in the layout.
+    vector<vector<size_t>> importers(file_count);
+    for (size_t i = 0; i < file_count; i++) {
+        for (size_t imported: graph.imports[i]) {
+            if (graph.levels[i] >= 0 && graph.levels[imported] > graph.levels[i]) importers[imported].push_back(i);
+        }
+    }
+
+    // Layers in their last order, new files last.
+    vector<vector<size_t>> layers(layer_count);
+    for (size_t i = 0; i < file_count; i++) {
+        if (graph.levels[i] >= 0) layers[graph.levels[i]].push_back(i);
+    }
+
+    const float unplaced = std::numeric_limits<float>::max();
+    for (size_t i = 0; i < file_count; i++) {
+        layout.y[i] = last_placements[i] != nullptr && last_placements[i]->level == graph.levels[i]
+                      ? last_placements[i]->y : unplaced;
+    }
+    for (vector<size_t>& layer: layers) {
+        std::stable_sort(layer.begin(), layer.end(), [&](size_t a, size_t b) { return layout.y[a] < layout.y[b]; });
+    }
+
+    for (int level = 0; level < layer_count; level++) {
+        if (!dirty_layers[level]) continue;
+
+        layout.relaid_layers++;
+        for (size_t i = 0; i < layers[level].size(); i++) {
+            layout.y[layers[level][i]] = (float) i * node_spacing;
+        }
+    }
+
+    // Crossing minimization, down the layers by importers and back up by imports.
+    auto sortByBarycenter = [&](vector<size_t>& layer, bool by_importers) {
+        vector<std::pair<float, size_t>> barycenters;
+        barycenters.reserve(layer.size());
+
+        for (size_t i: layer) {
+            const vector<size_t>& neighbors = by_importers ? importers[i] : graph.imports[i];
+
+            float sum = 0.0f;
+            int count = 0;
+            for (size_t neighbor: neighbors) {
+                if (graph.levels[neighbor] == graph.levels[i] || graph.levels[neighbor] < 0) continue;
+                sum += layout.y[neighbor];
+                count++;
+            }
+            barycenters.emplace_back(count > 0 ? sum / (float) count : layout.y[i], i);
+        }
+
+        std::stable_sort(barycenters.begin(), barycenters.end(),
+                         [](const auto& a, const auto& b) { return a.first < b.first; });
+
+        for (size_t i = 0; i < layer.size(); i++) {
+            layer[i] = barycenters[i].second;
+            layout.y[layer[i]] = (float) i * node_spacing;
+        }
+    };
+
+    const int sweeps = 4;
+    for (int sweep = 0; sweep < sweeps; sweep++) {
+        for (int level = 1; level < layer_count; level++) {
+            if (dirty_layers[level]) sortByBarycenter(layers[level], true);
+        }
+        for (int level = layer_count - 2; level >= 0; level--) {
+            if (dirty_layers[level]) sortByBarycenter(layers[level], false);
+        }
+    }
+
+    // Positions: every file wants to sit at the average of its neighbors. Packing the layer towards those positions
+    // from the top and from the bottom, and taking the average of both, keeps the order and the spacing.
+    for (int level = 0; level < layer_count; level++) {
+        if (!dirty_layers[level]) continue;
+
+        vector<size_t>& layer = layers[level];
+        if (layer.empty()) continue;
+
+        vector<float> wanted(layer.size());
+        for (size_t i = 0; i < layer.size(); i++) {
+            float sum = 0.0f;
+            int count = 0;
+            for (size_t importer: importers[layer[i]]) {
+                sum += layout.y[importer];
+                count++;
+            }
+            wanted[i] = count > 0 ? sum / (float) count : layout.y[layer[i]];
+        }
+
+        vector<float> from_top(layer.size()), from_bottom(layer.size());
+        for (size_t i = 0; i < layer.size(); i++) {
+            from_top[i] = i == 0 ? wanted[i] : std::max(wanted[i], from_top[i - 1] + node_spacing);
+        }
+        for (size_t i = layer.size(); i-- > 0;) {
+            from_bottom[i] = i + 1 == layer.size() ? wanted[i] : std::min(wanted[i], from_bottom[i + 1] - node_spacing);
+        }
+
+        for (size_t i = 0; i < layer.size(); i++) {
+            layout.y[layer[i]] = (from_top[i] + from_bottom[i]) / 2;
+        }
+    }
+
+    for (const File* file: removed_files) {
+        placements.erase(file);
+    }
+
+    for (size_t i = 0; i < file_count; i++) {
+        if (graph.levels[i] < 0) {  // "General" sits on its own, left of everything.
+            layout.x[i] = -layer_spacing;
+            layout.y[i] = 0.0f;
+            continue;
+        }
+
+        layout.x[i] = (float) graph.levels[i] * layer_spacing;
+
+        Placement& placement = last_placements[i] != nullptr ? *last_placements[i] : placements[graph.files[i]];
+        placement.level = graph.levels[i];
+        placement.y = layout.y[i];
+        placement.generation = generation;
+
+        if (changed[i]) {
+            placement.imported_files.clear();
+            for (size_t imported: graph.imports[i]) placement.imported_files.push_back(graph.files[imported]);
+        }
+    }
+
+    return layout;
+}
+
+ForceLayout::ForceLayout(const LayoutGraph& graph, float edge_length)
+    : edge_length(edge_length), temperature(edge_length / 2) {
+    /* Files start out on a sunflower spiral, evenly spread over a disc about as big as the layout will end up.
+     * Starting from the layered layout instead folds flat projects into a line that never unfolds. Files without a
+     * level ("General") are left out. */
+
+    vector<int> body_indices(graph.files.size(), -1);
+    for (size_t i = 0; i < graph.files.size(); i++) {
+        if (graph.levels[i] < 0) continue;
+
+        body_indices[i] = (int) bodies.size();
+        bodies.push_back(i);
+    }
+
+    size_t body_count = bodies.size();
+    x.resize(body_count);
+    y.resize(body_count);
+    velocity_x.assign(body_count, 0.0f);
+    velocity_y.assign(body_count, 0.0f);
+    force_x.assign(body_count, 0.0f);
+    force_y.assign(body_count, 0.0f);
+
+    const float golden_angle = 2.39996323f;
+    for (size_t body = 0; body < body_count; body++) {
+        float radius = edge_length * std::sqrt((float) body + 0.5f);
+        float angle = golden_angle * (float) body;
+
+        x[body] = radius * std::cos(angle);
+        y[body] = radius * std::sin(angle);
+    }
+
+    for (size_t i = 0; i < graph.files.size(); i++) {
+        if (body_indices[i] < 0) continue;
+
+        for (size_t imported: graph.imports[i]) {
+            if (body_indices[imported] < 0 || imported == i) continue;
+
+            edge_from.push_back((unsigned) body_indices[i]);
+            edge_to.push_back((unsigned) body_indices[imported]);
+        }
+    }
+    edge_force_x.resize(edge_from.size());
+    edge_force_y.resize(edge_from.size());
+}
+
+void ForceLayout::buildTree() {
+    /* Quadtree over the bodies. Every node keeps the sum of the positions below it, so the center of mass of any
+     * node is one division away. Bodies closer together than the smallest cell share a leaf. */
+
+    tree.clear();
+    if (bodies.empty()) return;
+
+    float min_x = x[0], max_x = x[0], min_y = y[0], max_y = y[0];
+    for (size_t body = 1; body < bodies.size(); body++) {
+        min_x = std::min(min_x, x[body]);
+        max_x = std::max(max_x, x[body]);
+        min_y = std::min(min_y, y[body]);
+        max_y = std::max(max_y, y[body]);
+    }
+
+    QuadNode root;
+    root.min_x = min_x;
+    root.min_y = min_y;
+    root.size = std::max(max_x - min_x, max_y - min_y) + 1.0f;
+    tree.push_back(root);
+
+    const int max_depth = 24;
+
+    auto addToNode = [this](int node, int body) {
+        tree[node].mass += 1.0f;
+        tree[node].sum_x += x[body];
+        tree[node].sum_y += y[body];
+    };
+
+    auto getChild = [this](int node, float body_x, float body_y) {
+        /* Index of the quadrant of node the position falls in, the quadrant is created if needed. */
+
+        float half = tree[node].size / 2;
+        int quadrant = (body_x >= tree[node].min_x + half ? 1 : 0) + (body_y >= tree[node].min_y + half ? 2 : 0);
+
+        if (tree[node].children[quadrant] < 0) {
+            QuadNode child;
+            child.min_x = tree[node].min_x + (quadrant & 1 ? half : 0.0f);
+            child.min_y = tree[node].min_y + (quadrant & 2 ? half : 0.0f);
+            child.size = half;
+
+            tree[node].children[quadrant] = (int) tree.size();
+            tree.push_back(child);
+        }
+        return tree[node].children[quadrant];
+    };
+
+    for (int body = 0; body < (int) bodies.size(); body++) {
+        int node = 0;
+        int depth = 0;
+
+        while (true) {
+            bool leaf = tree[node].children[0] < 0 && tree[node].children[1] < 0 &&
+                        tree[node].children[2] < 0 && tree[node].children[3] < 0;
+
+            if (leaf && tree[node].mass == 0.0f) {  // Empty leaf, the body goes here.
+                addToNode(node, body);
+                tree[node].body = body;
+                break;
+            }
+
+            if (leaf && depth >= max_depth) {  // As small as cells get, bodies share it.
+                addToNode(node, body);
+                break;
+            }
+
+            if (leaf) {  // Split the leaf, its body moves one level down.
+                int resident = tree[node].body;
+                tree[node].body = -1;
+
+                int child = getChild(node, x[resident], y[resident]);
+                addToNode(child, resident);
+                tree[child].body = resident;
+            }
+
+            addToNode(node, body);
+            node = getChild(node, x[body], y[body]);
+            depth++;
+        }
+    }
+}
+
+void ForceLayout::addRepulsion() {
+    /* Every pair of files pushes each other apart with edge_length^2 / distance. Far away groups of files push as one
+     * body at their center of mass (Barnes-Hut), which brings this down from O(n^2) to O(n log n). */
+
+    const float theta = 0.9f;
+    const float strength = edge_length * edge_length;
+
+    vector<int> stack;
+    stack.reserve(64);
+
+    for (size_t body = 0; body < bodies.size(); body++) {
+        float body_x = x[body], body_y = y[body];
+        float total_x = 0.0f, total_y = 0.0f;
+
+        stack.clear();
+        stack.push_back(0);
+
+        while (!stack.empty()) {
+            const QuadNode& node = tree[stack.back()];
+            stack.pop_back();
+
+            if (node.body == (int) body && node.mass == 1.0f) continue;
+
+            float center_x = node.sum_x / node.mass, center_y = node.sum_y / node.mass;
+            float dx = body_x - center_x, dy = body_y - center_y;
+            float distance_squared = dx * dx + dy * dy;
+
+            bool leaf = node.children[0] < 0 && node.children[1] < 0 && node.children[2] < 0 && node.children[3] < 0;
+            if (leaf || node.size * node.size < theta * theta * distance_squared) {
+                if (distance_squared < 0.01f) continue;  // The body itself, or one right on top of it.
+
+                float push = strength * node.mass / distance_squared;
+                total_x += dx * push;
+                total_y += dy * push;
+                continue;
+            }
+
+            for (int child: node.children) {
+                if (child >= 0) stack.push_back(child);
+            }
+        }
+
+        force_x[body] = total_x;
+        force_y[body] = total_y;
+    }
+}
+
+void ForceLayout::addSprings() {
+    /* Imports pull with distance^2 / edge_length. The forces are worked out for all imports at once over flat arrays,
+     * which the compiler vectorizes, and only then added to the files. */
+
+    const size_t edge_count = edge_from.size();
+    const unsigned* __restrict from = edge_from.data();
+    const unsigned* __restrict to = edge_to.data();
+    const float* __restrict pos_x = x.data();
+    const float* __restrict pos_y = y.data();
+    float* __restrict pull_x = edge_force_x.data();
+    float* __restrict pull_y = edge_force_y.data();
+    const float inverse_length = 1.0f / edge_length;
+
+    for (size_t edge = 0; edge < edge_count; edge++) {  // Gather, doesn't vectorize without AVX2.
+        pull_x[edge] = pos_x[to[edge]] - pos_x[from[edge]];
+        pull_y[edge] = pos_y[to[edge]] - pos_y[from[edge]];
+    }
+
+    for (size_t edge = 0; edge < edge_count; edge++) {
+        float dx = pull_x[edge], dy = pull_y[edge];
+        float distance = std::sqrt(dx * dx + dy * dy);
+
+        pull_x[edge] = dx * distance * inverse_length;
+        pull_y[edge] = dy * distance * inverse_length;
+    }
+
+    for (size_t edge = 0; edge < edge_count; edge++) {
+        force_x[edge_from[edge]] += pull_x[edge];
+        force_y[edge_from[edge]] += pull_y[edge];
+        force_x[edge_to[edge]] -= pull_x[edge];
+        force_y[edge_to[edge]] -= pull_y[edge];
+    }
+}
+
+namespace {
+    void integrateBodies(size_t body_count, float* __restrict pos_x, float* __restrict pos_y,
+                         float* __restrict speed_x, float* __restrict speed_y,
+                         const float* __restrict push_x, const float* __restrict push_y, float max_step) {
+        /* Restrict only reliably reaches the vectorizer through parameters, hence a function of its own. */
+
+        const float time_step = 0.1f;
+        const float damping = 0.5f;
+        const float gravity = 1.0f;  // Towards the origin, keeps loose parts from drifting off.
+
+        for (size_t body = 0; body < body_count; body++) {
+            float vx = (speed_x[body] + (push_x[body] - gravity * pos_x[body]) * time_step) * damping;
+            float vy = (speed_y[body] + (push_y[body] - gravity * pos_y[body]) * time_step) * damping;
+
+            vx = vx < -max_step ? -max_step : vx > max_step ? max_step : vx;
+            vy = vy < -max_step ? -max_step : vy > max_step ? max_step : vy;
+
+            speed_x[body] = vx;
+            speed_y[body] = vy;
+            pos_x[body] += vx;
+            pos_y[body] += vy;
+        }
+    }
+}
+
+void ForceLayout::integrate() {
+    /* A plain loop over the SoA buffers, so it vectorizes. No file moves further than the temperature, which cools
+     * down every step so the layout settles. */
+
+    integrateBodies(bodies.size(), x.data(), y.data(), velocity_x.data(), velocity_y.data(), force_x.data(),
+                    force_y.data(), temperature);
+}
+
+float ForceLayout::step() {
+    buildTree();
+    addRepulsion();
+    addSprings();
+
+    integrate();
+    temperature *= cooling;
+
+    // Apart from the loop above, a max over floats keeps it from vectorizing.
+    float largest_step = 0.0f;
+    for (size_t body = 0; body < bodies.size(); body++) {
+        largest_step = std::max(largest_step, std::max(std::abs(velocity_x[body]), std::abs(velocity_y[body])));
+    }
+    return largest_step;
+}
+
+void ForceLayout::getPositions(GraphLayout& layout) const {
+    for (size_t body = 0; body < bodies.size(); body++) {
+        layout.x[bodies[body]] = x[body];
+        layout.y[bodies[body]] = y[body];
+    }
+}
+
+class LayoutEngine::Implementation {
+    /* Runs the layout on a thread of its own. Only the latest request counts, requests that come in while a layout is
+     * running replace each other and the one that's left runs next. A force directed layout keeps stepping until it
+     * settles or another request comes in, handing out a snapshot now and then. */
+
+    public:
+        explicit Implementation(std::function<void()> on_layout)
+            : on_layout(std::move(on_layout)), thread(&Implementation::run, this) {}
+
+        ~Implementation() {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+            }
+            requested.notify_one();
+            thread.join();
+        }
+
+        void request(LayoutGraph graph, unsigned long long version, LayoutMode mode) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                pending_graph = std::move(graph);
+                pending_version = version;
+                pending_mode = mode;
+                has_request = true;
+            }
+            requested.notify_one();
+        }
+
+        bool takeLayout(GraphLayout& layout) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!has_layout) return false;
+
+            layout = std::move(finished_layout);
+            has_layout = false;
+            return true;
+        }
+
+        void reset() {
+            std::lock_guard<std::mutex> lock(mutex);
+            clear_history = true;
+        }
+
+    private:
+        std::mutex mutex;
+        std::condition_variable requested;
+
+        static constexpr std::chrono::milliseconds snapshot_interval{50};
+        static constexpr int max_force_steps = 2000;
+        static constexpr float settled_step = 0.05f;  // Grid units per step.
+
+        LayoutGraph pending_graph;
+        unsigned long long pending_version = 0;
+        LayoutMode pending_mode = LayoutMode::Layered;
+        bool has_request = false;
+        bool clear_history = false;
+        bool stopping = false;
+
+        GraphLayout finished_layout;
+        bool has_layout = false;
+
+        std::function<void()> on_layout;
+        LayeredLayout layered_layout;  // Only used by the layout thread.
+        std::thread thread;  // Last, so everything above exists when it starts.
+
+        void run() {
+            while (true) {
+                LayoutGraph graph;
+                unsigned long long version;
+                LayoutMode mode;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    requested.wait(lock, [this]() { return has_request || stopping; });
+                    if (stopping) return;
+
+                    graph = std::move(pending_graph);
+                    version = pending_version;
+                    mode = pending_mode;
+                    has_request = false;
+
+                    if (clear_history) {
+                        layered_layout.clear();
+                        clear_history = false;
+                    }
+                }
+
+                GraphLayout layout = layered_layout.compute(graph);
+                layout.version = version;
+
+                if (mode == LayoutMode::Force) {
+                    runForceLayout(graph, layout);
+                } else {
+                    publish(layout);
+                }
+            }
+        }
+
+        void publish(const GraphLayout& layout) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                finished_layout = layout;
+                has_layout = true;
+            }
+
+            if (on_layout) {
+                on_layout();
+            }
+        }
+
+        bool isInterrupted() {
+            std::lock_guard<std::mutex> lock(mutex);
+            return has_request || stopping;
+        }
+
+        void runForceLayout(const LayoutGraph& graph, GraphLayout& layout) {
+            ProfileScope scope("force layout");
+
+            ForceLayout force_layout(graph);
+            layout.settled = false;
+
+            auto last_snapshot = std::chrono::steady_clock::now();
+            for (int step = 0; step < max_force_steps; step++) {
+                if (isInterrupted()) return;
+
+                if (force_layout.step() < settled_step) break;
+
+                if (std::chrono::steady_clock::now() - last_snapshot > snapshot_interval) {
+                    force_layout.getPositions(layout);
+                    publish(layout);
+                    last_snapshot = std::chrono::steady_clock::now();
+                }
+            }
+
+            force_layout.getPositions(layout);
+            layout.settled = true;
+            publish(layout);
+        }
+};
+
+LayoutEngine::LayoutEngine(std::function<void()> on_layout)
+    : implementation(new Implementation(std::move(on_layout))) {}
+
+LayoutEngine::~LayoutEngine() {
+    delete implementation;
+}
+
+void LayoutEngine::request(LayoutGraph graph, unsigned long long version, LayoutMode mode) {
+    implementation->request(std::move(graph), version, mode);
+}
+
+bool LayoutEngine::takeLayout(GraphLayout& layout) {
+    return implementation->takeLayout(layout);
+}
+
+void LayoutEngine::reset() {
+    implementation->reset();
+}
@@ -1,8 +1,20 @@
 #include "common.h"
 
 
-int main() {
-    vector<File*> files = openNewProject(R"(D:/Pycharm/Pie-Menus-Expanded)");
+int main(int argc, char** argv) {
+    if (argc == 1) {  // Nothing to open yet, the project comes from the "File" menu.
+        auto project = std::make_unique<Project>();
+        addGeneral(*project);
 
-    createWindow(files);
+        createWindow(std::move(project));
+        return 0;
+    }
+
+    string argument = argv[1];
+    if (argc == 2 && argument != "analyze" && argument != "query" && !startsWith(argument, "-")) {
+        createWindow(endsWith(argument, ".snapshot") ? loadSnapshot(argument) : openProject(argument));
+        return 0;
+    }
+
+    return runCommandLine(argc, argv);
 }
@@ -0,0 +1,354 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+
+#include "common.h"
+
+namespace {
+    constexpr size_t max_events = (size_t) 1 << 18;  // Per thread, 6 MiB of them.
+    constexpr size_t max_frames = (size_t) 1 << 16;
+    constexpr size_t frame_history = 240;  // Frames in the summary, 4 seconds at 60 fps.
+
+    // Constant initialized, so operator new can use them before anything else in the program is set up.
+    std::atomic<bool> profiling{false};
+    std::atomic<long long> counters[profile_counter_count] = {};
+
+    long long now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    class Event {
+        public:
+            const char* name;
+            long long start;  // Nanoseconds.
+            long long duration;
+    };
+
+    class Frame {
+        public:
+            uint32_t thread;
+            long long start;
+            long long duration;
+            long long counters[profile_counter_count];  // Counted during the frame.
+    };
+
+    class ThreadProfile {
+        /* The events of one thread. Its lock is only ever contended while the profile is being read. */
+
+        public:
+            std::mutex mutex;
+            uint32_t id;
+            bool in_use = true;  // Under the Profile's lock.
+
+            vector<Event> events;
+            size_t dropped_event_count = 0;
+            std::unordered_map<const char*, StageProfile> stages;  // By name, as given to ProfileScope.
+    };
+
+    class Profile {
+        public:
+            std::mutex mutex;
+            vector<std::unique_ptr<ThreadProfile>> threads;  // Never freed, an ended thread's goes to the next one.
+            long long start = now();  // Where the trace starts.
+
+            long long frame_start = -1;
+            long long frame_start_counters[profile_counter_count] = {};
+            vector<Frame> frames;
+    };
+
+    Profile& getProfile() {
+        static Profile* profile = new Profile();  // Never destroyed, threads may still end scopes while exiting.
+        return *profile;
+    }
+
+    class ThreadSlot {  // Gives the thread's profile back when the thread ends, for the next new thread to use.
+        public:
+            ThreadProfile* profile = nullptr;
+
+            ~ThreadSlot() {
+                if (profile == nullptr) return;
+
+                Profile& owner = getProfile();
+                std::lock_guard<std::mutex> lock(owner.mutex);
+                profile->in_use = false;
+            }
+    };
+
+    thread_local ThreadSlot thread_slot;
+
+    ThreadProfile& getThreadProfile() {
+        if (thread_slot.profile != nullptr) return *thread_slot.profile;
+
+        Profile& profile = getProfile();
+        std::lock_guard<std::mutex> lock(profile.mutex);
+
+        for (const auto& thread: profile.threads) {
+            if (!thread->in_use) {
+                thread->in_use = true;
+                thread_slot.profile = thread.get();
+                return *thread;
+            }
+        }
+
+        profile.threads.push_back(std::make_unique<ThreadProfile>());
+        profile.threads.back()->id = (uint32_t) profile.threads.size();
+        thread_slot.profile = profile.threads.back().get();
+        return *thread_slot.profile;
+    }
+
+    void writeQuoted(std::ostream& out, std::string_view text) {
+        out << '"';
+        for (char c: text) {
+            if (c == '"' || c == '\\') out << '\\';
+            out << c;
+        }
+        out << '"';
+    }
+
+    void writeMicroseconds(std::ostream& out, long long nanoseconds) {
+        out << nanoseconds / 1000 << '.' << std::setw(3) << std::setfill('0') << std::abs(nanoseconds % 1000);
+    }
+}
+
+void* operator new(std::size_t size) {
+    /* Replaces the global one, only to count allocations while profiling. */
+
+    if (profiling.load(std::memory_order_relaxed)) {
+        counters[(size_t) ProfileCounter::Allocations].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    if (size == 0) size = 1;
+    while (true) {
+        if (void* memory = std::malloc(size)) return memory;
+
+        std::new_handler handler = std::get_new_handler();
+        if (handler == nullptr) throw std::bad_alloc();
+        handler();
+    }
+}
+
+// GCC takes free() in here for a mismatch, once it inlines these into the new expressions of this file.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void operator delete(void* memory) noexcept {
+    std::free(memory);
+}
+
+void operator delete(void* memory, std::size_t) noexcept {
+    std::free(memory);
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+ProfileScope::ProfileScope(const char* name) : name(name) {
+    if (profiling.load(std::memory_order_relaxed)) {
+        start = now();
+    }
+}
+
+ProfileScope::~ProfileScope() {
+    if (start < 0) return;
+
+    long long duration = now() - start;
+    double milliseconds = duration / 1e6;
+
+    ThreadProfile& thread = getThreadProfile();
+    std::lock_guard<std::mutex> lock(thread.mutex);
+
+    StageProfile& stage = thread.stages.try_emplace(name).first->second;
+    stage.name = name;
+    stage.calls++;
+    stage.total_milliseconds += milliseconds;
+    stage.max_milliseconds = std::max(stage.max_milliseconds, milliseconds);
+
+    if (thread.events.size() < max_events) {
+        thread.events.push_back({name, start, duration});
+    } else {
+        thread.dropped_event_count++;
+    }
+}
+
+void setProfiling(bool enabled) {
+    profiling = enabled;
+}
+
+bool isProfiling() {
+    return profiling.load(std::memory_order_relaxed);
+}
+
+void clearProfile() {
+    Profile& profile = getProfile();
+    std::lock_guard<std::mutex> lock(profile.mutex);
+
+    for (const auto& thread: profile.threads) {
+        std::lock_guard<std::mutex> thread_lock(thread->mutex);
+        thread->events.clear();
+        thread->stages.clear();
+        thread->dropped_event_count = 0;
+    }
+
+    for (auto& counter: counters) {
+        counter = 0;
+    }
+
+    profile.frames.clear();
+    profile.frame_start = -1;
+    profile.start = now();
+}
+
+void countProfile(ProfileCounter counter, long long amount) {
+    if (profiling.load(std::memory_order_relaxed)) {
+        counters[(size_t) counter].fetch_add(amount, std::memory_order_relaxed);
+    }
+}
+
+const char* getCounterName(ProfileCounter counter) {
+    switch (counter) {
+        case ProfileCounter::FilesParsed: return "files parsed";
+        case ProfileCounter::BytesRead: return "bytes read";
+        case ProfileCounter::Allocations: return "allocations";
+        case ProfileCounter::DrawVertices: return "draw vertices";
+    }
+    return "";
+}
+
+void beginProfileFrame() {
+    if (!isProfiling()) return;
+
+    Profile& profile = getProfile();
+    std::lock_guard<std::mutex> lock(profile.mutex);
+
+    profile.frame_start = now();
+    for (size_t i = 0; i < profile_counter_count; i++) {
+        profile.frame_start_counters[i] = counters[i].load(std::memory_order_relaxed);
+    }
+}
+
+void endProfileFrame() {
+    if (!isProfiling()) return;
+
+    uint32_t thread = getThreadProfile().id;
+
+    Profile& profile = getProfile();
+    std::lock_guard<std::mutex> lock(profile.mutex);
+    if (profile.frame_start < 0) return;  // Turned on during the frame.
+
+    Frame frame{thread, profile.frame_start, now() - profile.frame_start, {}};
+    for (size_t i = 0; i < profile_counter_count; i++) {
+        frame.counters[i] = counters[i].load(std::memory_order_relaxed) - profile.frame_start_counters[i];
+    }
+    profile.frame_start = -1;
+
+    if (profile.frames.size() >= max_frames) {  // The oldest half goes, the histogram needs the latest.
+        profile.frames.erase(profile.frames.begin(), profile.frames.begin() + max_frames / 2);
+    }
+    profile.frames.push_back(frame);
+}
+
+ProfileSummary getProfileSummary() {
+    ProfileSummary summary;
+
+    Profile& profile = getProfile();
+    std::lock_guard<std::mutex> lock(profile.mutex);
+
+    // The same stage can be named by different copies of the same literal, on different threads.
+    std::unordered_map<std::string_view, size_t> stage_indices;
+    for (const auto& thread: profile.threads) {
+        std::lock_guard<std::mutex> thread_lock(thread->mutex);
+
+        for (const auto& [name, stage]: thread->stages) {
+            auto [index, added] = stage_indices.emplace(name, summary.stages.size());
+            if (added) {
+                summary.stages.push_back(stage);
+                continue;
+            }
+
+            StageProfile& merged = summary.stages[index->second];
+            merged.calls += stage.calls;
+            merged.total_milliseconds += stage.total_milliseconds;
+            merged.max_milliseconds = std::max(merged.max_milliseconds, stage.max_milliseconds);
+        }
+
+        summary.event_count += thread->events.size();
+        summary.dropped_event_count += thread->dropped_event_count;
+    }
+
+    std::sort(summary.stages.begin(), summary.stages.end(), [](const StageProfile& a, const StageProfile& b) {
+        return a.total_milliseconds > b.total_milliseconds;
+    });
+
+    for (size_t i = 0; i < profile_counter_count; i++) {
+        summary.counters[i] = counters[i].load(std::memory_order_relaxed);
+    }
+
+    size_t first_frame = profile.frames.size() - std::min(profile.frames.size(), frame_history);
+    for (size_t i = first_frame; i < profile.frames.size(); i++) {
+        summary.frame_milliseconds.push_back((float) (profile.frames[i].duration / 1e6));
+    }
+    if (!profile.frames.empty()) {
+        std::copy(profile.frames.back().counters, profile.frames.back().counters + profile_counter_count,
+                  summary.frame_counters);
+    }
+
+    return summary;
+}
+
+void saveChromeTrace(const string& file_path) {
+    /* Complete ("X") events per thread, a counter ("C") event per frame and the totals under "otherData".
+     * Written while the profile is locked, the threads being profiled wait until it's done. */
+
+    Profile& profile = getProfile();
+    std::lock_guard<std::mutex> lock(profile.mutex);
+
+    writeFileAtomically(file_path, [&profile](std::ostream& out) {
+        bool first = true;
+        auto beginEvent = [&](const char* phase, std::string_view name, uint32_t thread, long long time) {
+            out << (first ? "\n" : ",\n") << "{\"ph\": \"" << phase << "\", \"name\": ";
+            writeQuoted(out, name);
+            out << ", \"pid\": 1, \"tid\": " << thread << ", \"ts\": ";
+            writeMicroseconds(out, std::max(time - profile.start, 0LL));  // Started before the profile was cleared.
+            first = false;
+        };
+
+        out << "{\"traceEvents\": [";
+
+        for (const auto& thread: profile.threads) {
+            std::lock_guard<std::mutex> thread_lock(thread->mutex);
+
+            for (const Event& event: thread->events) {
+                beginEvent("X", event.name, thread->id, event.start);
+                out << ", \"dur\": ";
+                writeMicroseconds(out, event.duration);
+                out << '}';
+            }
+        }
+
+        for (const Frame& frame: profile.frames) {
+            beginEvent("X", "frame", frame.thread, frame.start);
+            out << ", \"dur\": ";
+            writeMicroseconds(out, frame.duration);
+            out << '}';
+
+            beginEvent("C", "frame counters", frame.thread, frame.start + frame.duration);
+            out << ", \"args\": {";
+            for (size_t i = 0; i < profile_counter_count; i++) {
+                out << (i == 0 ? "" : ", ") << '"' << getCounterName((ProfileCounter) i) << "\": " << frame.counters[i];
+            }
+            out << "}}";
+        }
+
+        out << "\n], \"displayTimeUnit\": \"ms\", \"otherData\": {";
+        for (size_t i = 0; i < profile_counter_count; i++) {
+            out << (i == 0 ? "" : ", ") << '"' << getCounterName((ProfileCounter) i) << "\": "
+                << counters[i].load(std::memory_order_relaxed);
+        }
+        out << "}}\n";
+    });
+}
@@ -0,0 +1,216 @@
+#include <algorithm>
+#include <deque>
+
+#include "common.h"
+
+namespace {
+    constexpr size_t no_file = SIZE_MAX;
+
+    bool testBit(const vector<uint64_t>& bits, size_t index) {
+        return (bits[index / 64] >> (index % 64)) & 1;
+    }
+
+    void setBit(vector<uint64_t>& bits, size_t index) {
+        bits[index / 64] |= (uint64_t) 1 << (index % 64);
+    }
+
+    void buildAdjacency(size_t node_count, const vector<std::pair<size_t, size_t>>& node_edges,
+                        vector<size_t>& starts, vector<size_t>& targets) {
+        /* Flat adjacency list out of (from, to) pairs, as in ImportComponents. */
+
+        starts.assign(node_count + 1, 0);
+        for (const auto& [from, to]: node_edges) starts[from + 1]++;
+        for (size_t i = 0; i < node_count; i++) starts[i + 1] += starts[i];
+
+        targets.resize(node_edges.size());
+        vector<size_t> next = starts;
+        for (const auto& [from, to]: node_edges) targets[next[from]++] = to;
+    }
+}
+
+DependencyIndex::DependencyIndex(const vector<File*>& files) : files(files.begin(), files.end()) {
+    ProfileScope scope("dependency index");
+
+    graph = findImportComponents(files);
+
+    file_indices.reserve(files.size());
+    for (size_t i = 0; i < files.size(); i++) {
+        if (graph.components[i] != no_file) {
+            file_indices.emplace(files[i], i);
+        }
+    }
+
+    // Members of every component, in file order.
+    vector<std::pair<size_t, size_t>> component_members;
+    for (size_t i = 0; i < files.size(); i++) {
+        if (graph.components[i] != no_file) component_members.emplace_back(graph.components[i], i);
+    }
+    buildAdjacency(graph.component_count, component_members, member_starts, members);
+
+    // The condensed graph both ways, once per pair of components.
+    vector<std::pair<size_t, size_t>> imports, imported_by;
+    for (size_t i = 0; i < files.size(); i++) {
+        for (size_t e = graph.edge_starts[i]; e < graph.edge_starts[i + 1]; e++) {
+            size_t from = graph.components[i], to = graph.components[graph.edges[e]];
+            if (from != to) {
+                imports.emplace_back(from, to);
+                imported_by.emplace_back(to, from);
+            }
+        }
+    }
+    for (auto* pairs: {&imports, &imported_by}) {
+        std::sort(pairs->begin(), pairs->end());
+        pairs->erase(std::unique(pairs->begin(), pairs->end()), pairs->end());
+    }
+    buildAdjacency(graph.component_count, imports, import_starts, component_imports);
+    buildAdjacency(graph.component_count, imported_by, imported_by_starts, component_imported_by);
+}
+
+size_t DependencyIndex::getComponent(const File* file) const {
+    auto index = file_indices.find(file);
+    return index != file_indices.end() ? graph.components[index->second] : no_file;
+}
+
+bool DependencyIndex::isInCycle(size_t component) const {
+    return member_starts[component + 1] - member_starts[component] > 1;
+}
+
+const vector<uint64_t>& DependencyIndex::getReachable(size_t component, bool reverse) const {
+    /* Every component reachable from this one over imports (or over imported_by in reverse), itself left out. Worked
+     * out on first use and kept, so repeated questions about the same file are a lookup. */
+
+    const size_t max_cached = 256;  // A bit per component each, 6 KiB for 50k files.
+
+    auto& cache = reverse ? reverse_reachable : reachable;
+    auto cached = cache.find(component);
+    if (cached != cache.end()) return cached->second;
+
+    if (cache.size() >= max_cached) cache.clear();
+
+    const vector<size_t>& starts = reverse ? imported_by_starts : import_starts;
+    const vector<size_t>& targets = reverse ? component_imported_by : component_imports;
+
+    vector<uint64_t> bits((graph.component_count + 63) / 64, 0);
+    vector<size_t> stack = {component};
+    while (!stack.empty()) {
+        size_t node = stack.back();
+        stack.pop_back();
+
+        for (size_t e = starts[node]; e < starts[node + 1]; e++) {
+            size_t target = targets[e];
+            if (testBit(bits, target)) continue;
+
+            // Whatever is already known about the target saves walking below it again.
+            auto known = cache.find(target);
+            if (known != cache.end()) {
+                for (size_t i = 0; i < bits.size(); i++) bits[i] |= known->second[i];
+                setBit(bits, target);
+                continue;
+            }
+
+            setBit(bits, target);
+            stack.push_back(target);
+        }
+    }
+
+    return cache.emplace(component, std::move(bits)).first->second;
+}
+
+vector<const File*> DependencyIndex::getFiles(const vector<uint64_t>& components, size_t own_component) const {
+    vector<const File*> found_files;
+
+    for (size_t word = 0; word < components.size(); word++) {
+        for (uint64_t bits = components[word]; bits != 0; bits &= bits - 1) {
+            size_t component = word * 64 + (size_t) __builtin_ctzll(bits);
+            for (size_t m = member_starts[component]; m < member_starts[component + 1]; m++) {
+                found_files.push_back(files[members[m]]);
+            }
+        }
+    }
+
+    // The rest of its own loop, which it reaches too.
+    if (own_component != no_file && isInCycle(own_component)) {
+        for (size_t m = member_starts[own_component]; m < member_starts[own_component + 1]; m++) {
+            found_files.push_back(files[members[m]]);
+        }
+    }
+
+    return found_files;
+}
+
+bool DependencyIndex::dependsOn(const File* importer, const File* imported) const {
+    size_t from = getComponent(importer), to = getComponent(imported);
+    if (from == no_file || to == no_file) return false;
+
+    if (from == to) return isInCycle(from);
+    if (to > from) return false;  // Imports only go to lower numbers, no need to look.
+
+    return testBit(getReachable(from, false), to);
+}
+
+vector<const File*> DependencyIndex::getDependencies(const File* file) const {
+    size_t component = getComponent(file);
+    if (component == no_file) return {};
+
+    return getFiles(getReachable(component, false), component);
+}
+
+vector<const File*> DependencyIndex::getDependents(const File* file) const {
+    size_t component = getComponent(file);
+    if (component == no_file) return {};
+
+    return getFiles(getReachable(component, true), component);
+}
+
+vector<const File*> DependencyIndex::getImportPath(const File* from, const File* to) const {
+    /* Breadth first over the imports, only through files that can still get to the target. */
+
+    size_t from_component = getComponent(from), to_component = getComponent(to);
+    if (from_component == no_file || to_component == no_file) return {};
+    if (from == to) return {from};
+    if (!dependsOn(from, to)) return {};
+
+    const vector<uint64_t>& leads_to_target = getReachable(to_component, true);
+    auto canReachTarget = [&](size_t file_index) {
+        size_t component = graph.components[file_index];
+        return component == to_component || testBit(leads_to_target, component);
+    };
+
+    size_t start = file_indices.at(from), target = file_indices.at(to);
+    std::unordered_map<size_t, size_t> previous = {{start, no_file}};
+    std::deque<size_t> queue = {start};
+
+    while (!queue.empty()) {
+        size_t node = queue.front();
+        queue.pop_front();
+
+        if (node == target) {
+            vector<const File*> path;
+            for (size_t step = target; step != no_file; step = previous[step]) {
+                path.push_back(files[step]);
+            }
+            std::reverse(path.begin(), path.end());
+            return path;
+        }
+
+        for (size_t e = graph.edge_starts[node]; e < graph.edge_starts[node + 1]; e++) {
+            size_t imported = graph.edges[e];
+            if (canReachTarget(imported) && previous.emplace(imported, node).second) {
+                queue.push_back(imported);
+            }
+        }
+    }
+
+    return {};
+}
+
+vector<const File*> DependencyIndex::getCycle(const File* file) const {
+    size_t component = getComponent(file);
+    if (component == no_file || !isInCycle(component)) return {};
+
+    vector<const File*> cycle;
+    for (size_t m = member_starts[component]; m < member_starts[component + 1]; m++) {
+        cycle.push_back(files[members[m]]);
+    }
+    return cycle;
+}
@@ -0,0 +1,451 @@
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <type_traits>
+
+#include "common.h"
+
+namespace {
+    /* A snapshot is the whole graph of a project in one file, read straight from a memory mapping:
+     *
+     *     SnapshotHeader
+     *     SnapshotFile[file_count]
+     *     SnapshotImport[import_count]
+     *     SnapshotString[content_count]  Imported objects of the imports, definitions and exports of the files.
+     *     SnapshotToDo[to_do_count]
+     *     char[string_bytes]             String table, every distinct string once, not null terminated.
+     *
+     * Records are fixed size, in native byte order, and every section starts at a multiple of 8 bytes. Bump
+     * snapshot_version whenever a record changes, older snapshots are then refused rather than misread. */
+
+    constexpr char snapshot_magic[8] = {'P', 'Y', 'P', 'S', 'N', 'A', 'P', '\0'};
+    constexpr uint32_t snapshot_version = 2;
+    constexpr uint32_t byte_order_mark = 0x01020304;
+
+    struct SnapshotString {
+        uint32_t offset;  // In the string table.
+        uint32_t size;
+    };
+
+    struct SnapshotHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t byte_order;
+        uint32_t file_count;
+        uint32_t import_count;
+        uint32_t content_count;
+        uint32_t to_do_count;
+        uint64_t string_bytes;
+        SnapshotString project_path;
+        uint32_t full_scan;
+        uint32_t has_layout;  // Otherwise the positions are all 0.
+    };
+
+    struct SnapshotFile {
+        SnapshotString name;
+        SnapshotString path;
+        SnapshotString notes;
+        int32_t level;
+        float x, y;
+        uint32_t first_import, import_count;
+        uint32_t first_to_do, to_do_count;
+        uint32_t package;
+        uint32_t first_symbol, definition_count, export_count;  // Exports follow the definitions.
+        uint32_t has_exports;
+    };
+
+    struct SnapshotImport {
+        SnapshotString name;
+        int32_t file;  // Index of the imported project file, -1 if it isn't one.
+        uint32_t first_content, content_count;
+        uint32_t entire_file;
+    };
+
+    struct SnapshotToDo {
+        SnapshotString content;
+        uint32_t done;
+    };
+
+    static_assert(std::is_trivially_copyable_v<SnapshotHeader> && sizeof(SnapshotHeader) == 56);
+    static_assert(std::is_trivially_copyable_v<SnapshotFile> && sizeof(SnapshotFile) == 72);
+    static_assert(std::is_trivially_copyable_v<SnapshotImport> && sizeof(SnapshotImport) == 24);
+    static_assert(std::is_trivially_copyable_v<SnapshotToDo> && sizeof(SnapshotToDo) == 12);
+
+    constexpr uint64_t section_alignment = 8;
+
+    uint64_t alignSection(uint64_t offset) {
+        return (offset + section_alignment - 1) / section_alignment * section_alignment;
+    }
+
+    class StringTable {  // Module names repeat in every import of them, so each string is stored once.
+        public:
+            string bytes;
+
+            SnapshotString add(const string& text) {
+                /* Keyed by views into the project's strings, which outlive the table. */
+
+                auto [entry, added] = offsets.emplace(text, (uint32_t) bytes.size());
+                if (added) {
+                    if (bytes.size() + text.size() > UINT32_MAX) {
+                        throw std::runtime_error("Project too large for a snapshot.");
+                    }
+                    bytes += text;
+                }
+                return {entry->second, (uint32_t) text.size()};
+            }
+
+            SnapshotString add(Name name) {
+                return add(name.str());
+            }
+
+        private:
+            std::unordered_map<std::string_view, uint32_t> offsets;
+    };
+
+    template<typename T>
+    void writeSection(std::ostream& output_file_stream, const vector<T>& records) {
+        /* The records, then zeros up to the start of the next section. */
+
+        uint64_t size = records.size() * sizeof(T);
+        output_file_stream.write(reinterpret_cast<const char*>(records.data()), (std::streamsize) size);
+
+        const char padding[section_alignment] = {};
+        output_file_stream.write(padding, (std::streamsize) (alignSection(size) - size));
+    }
+
+    template<typename T>
+    const T* getSection(std::string_view data, uint64_t& offset, uint64_t count) {
+        /* Records at offset, moves offset past the section. Null if the file is too short for them. */
+
+        uint64_t size = count * sizeof(T);
+        if (offset > data.size() || size > data.size() - offset) return nullptr;
+
+        const T* records = reinterpret_cast<const T*>(data.data() + offset);
+        offset += alignSection(size);
+        return records;
+    }
+}
+
+void saveSnapshot(const Project& project, const ImportLayers& layers, const GraphLayout& layout,
+                  const string& file_path) {
+    /* layers and layout are per file of the project, the layout may be left empty. */
+
+    ProfileScope scope("save snapshot");
+
+    const vector<File*>& files = project.files;
+    bool has_layout = layout.x.size() == files.size() && layout.y.size() == files.size();
+
+    std::unordered_map<const File*, int32_t> file_indices;
+    for (size_t i = 0; i < files.size(); i++) {
+        file_indices[files[i]] = (int32_t) i;
+    }
+
+    StringTable strings;
+    vector<SnapshotFile> snapshot_files;
+    vector<SnapshotImport> snapshot_imports;
+    vector<SnapshotString> snapshot_contents;
+    vector<SnapshotToDo> snapshot_to_dos;
+    snapshot_files.reserve(files.size());
+
+    for (size_t i = 0; i < files.size(); i++) {
+        const File* file = files[i];
+
+        SnapshotFile snapshot_file{};
+        snapshot_file.name = strings.add(file->file_name);
+        snapshot_file.path = strings.add(file->file_path);
+        snapshot_file.notes = strings.add(file->notes);
+        snapshot_file.level = i < layers.levels.size() ? layers.levels[i] : -1;
+        snapshot_file.x = has_layout ? layout.x[i] : 0.0f;
+        snapshot_file.y = has_layout ? layout.y[i] : 0.0f;
+        snapshot_file.package = file->package;
+
+        snapshot_file.first_import = (uint32_t) snapshot_imports.size();
+        snapshot_file.import_count = (uint32_t) file->imports.size();
+        for (const Import* import: file->imports) {
+            auto imported_file = file_indices.find(import->file);
+
+            SnapshotImport snapshot_import{};
+            snapshot_import.name = strings.add(import->file_name);
+            snapshot_import.file = imported_file != file_indices.end() ? imported_file->second : -1;
+            snapshot_import.entire_file = import->entire_file;
+            snapshot_import.first_content = (uint32_t) snapshot_contents.size();
+            snapshot_import.content_count = (uint32_t) import->imported_content.size();
+            for (Name imported_object: import->imported_content) {
+                snapshot_contents.push_back(strings.add(imported_object));
+            }
+
+            snapshot_imports.push_back(snapshot_import);
+        }
+
+        snapshot_file.first_symbol = (uint32_t) snapshot_contents.size();
+        snapshot_file.definition_count = (uint32_t) file->symbols.definitions.size();
+        snapshot_file.export_count = (uint32_t) file->symbols.exports.size();
+        snapshot_file.has_exports = file->symbols.has_exports;
+        for (const vector<Name>* names: {&file->symbols.definitions, &file->symbols.exports}) {
+            for (Name name: *names) {
+                snapshot_contents.push_back(strings.add(name));
+            }
+        }
+
+        snapshot_file.first_to_do = (uint32_t) snapshot_to_dos.size();
+        snapshot_file.to_do_count = (uint32_t) file->to_dos.size();
+        for (const ToDo* to_do: file->to_dos) {
+            snapshot_to_dos.push_back({strings.add(to_do->content), to_do->done});
+        }
+
+        snapshot_files.push_back(snapshot_file);
+    }
+
+    SnapshotHeader header{};
+    std::memcpy(header.magic, snapshot_magic, sizeof(header.magic));
+    header.version = snapshot_version;
+    header.byte_order = byte_order_mark;
+    header.file_count = (uint32_t) snapshot_files.size();
+    header.import_count = (uint32_t) snapshot_imports.size();
+    header.content_count = (uint32_t) snapshot_contents.size();
+    header.to_do_count = (uint32_t) snapshot_to_dos.size();
+    header.project_path = strings.add(project.path);
+    header.full_scan = project.scan_mode == ScanMode::Full;
+    header.has_layout = has_layout;
+    header.string_bytes = strings.bytes.size();
+
+    writeFileAtomically(file_path, [&](std::ostream& out) {
+        writeSection(out, vector<SnapshotHeader>{header});
+        writeSection(out, snapshot_files);
+        writeSection(out, snapshot_imports);
+        writeSection(out, snapshot_contents);
+        writeSection(out, snapshot_to_dos);
+        out.write(strings.bytes.data(), (std::streamsize) strings.bytes.size());
+    });
+}
+
+std::unique_ptr<Project> loadSnapshot(const string& file_path, LoadProgress* progress) {
+    /* No source file is read and nothing is parsed or linked, the graph is rebuilt as it was saved. Changes made to
+     * the sources since then only show up after a rescan. */
+
+    ProfileScope scope("load snapshot");
+
+    MappedFile mapped_file(file_path);
+    std::string_view data = mapped_file.content();
+
+    auto fail = [&file_path](const string& reason) {
+        return std::runtime_error(reason + ": " + file_path);
+    };
+
+    if (data.empty()) {
+        throw fail("Failed to read snapshot");
+    }
+
+    uint64_t offset = 0;
+    const SnapshotHeader* header = getSection<SnapshotHeader>(data, offset, 1);
+    if (header == nullptr || std::memcmp(header->magic, snapshot_magic, sizeof(snapshot_magic)) != 0 ||
+        header->byte_order != byte_order_mark) {
+        throw fail("Not a snapshot");
+    }
+    if (header->version != snapshot_version) {
+        throw fail("Unsupported snapshot version " + std::to_string(header->version));
+    }
+
+    const SnapshotFile* snapshot_files = getSection<SnapshotFile>(data, offset, header->file_count);
+    const SnapshotImport* snapshot_imports = getSection<SnapshotImport>(data, offset, header->import_count);
+    const SnapshotString* snapshot_contents = getSection<SnapshotString>(data, offset, header->content_count);
+    const SnapshotToDo* snapshot_to_dos = getSection<SnapshotToDo>(data, offset, header->to_do_count);
+    const char* string_table = getSection<char>(data, offset, header->string_bytes);
+    if (snapshot_files == nullptr || snapshot_imports == nullptr || snapshot_contents == nullptr ||
+        snapshot_to_dos == nullptr || string_table == nullptr) {
+        throw fail("Truncated snapshot");
+    }
+
+    auto getString = [&](const SnapshotString& snapshot_string) {
+        if ((uint64_t) snapshot_string.offset + snapshot_string.size > header->string_bytes) {
+            throw fail("Corrupt snapshot");
+        }
+        return string(string_table + snapshot_string.offset, snapshot_string.size);
+    };
+
+    auto getName = [&](const SnapshotString& snapshot_string) {
+        if ((uint64_t) snapshot_string.offset + snapshot_string.size > header->string_bytes) {
+            throw fail("Corrupt snapshot");
+        }
+        return Name(std::string_view(string_table + snapshot_string.offset, snapshot_string.size));
+    };
+
+    auto checkRange = [&](uint32_t first, uint32_t count, uint32_t total) {
+        if ((uint64_t) first + count > total) {
+            throw fail("Corrupt snapshot");
+        }
+    };
+
+    auto project = std::make_unique<Project>();
+    project->path = getString(header->project_path);
+    project->scan_mode = header->full_scan ? ScanMode::Full : ScanMode::Header;
+
+    if (progress != nullptr) {
+        progress->found_files = header->file_count;
+    }
+
+    // All files first, imports can point forward.
+    vector<File*>& files = project->files;
+    files.reserve(header->file_count);
+    for (uint32_t i = 0; i < header->file_count; i++) {
+        files.push_back(project->arena.files.create());
+    }
+
+    if (header->has_layout) {
+        project->saved_levels.resize(header->file_count);
+        project->saved_x.resize(header->file_count);
+        project->saved_y.resize(header->file_count);
+    }
+
+    for (uint32_t i = 0; i < header->file_count; i++) {
+        if (progress != nullptr && i % 1024 == 0) {
+            progress->checkCancelled();
+        }
+
+        const SnapshotFile& snapshot_file = snapshot_files[i];
+        File* file = files[i];
+
+        file->file_name = getName(snapshot_file.name);
+        file->file_path = getName(snapshot_file.path);
+        file->notes = getString(snapshot_file.notes);
+        file->non_project = file->file_path.empty();  // Only "General" has no path.
+        file->package = snapshot_file.package != 0;
+
+        if (header->has_layout) {
+            project->saved_levels[i] = snapshot_file.level;
+            project->saved_x[i] = snapshot_file.x;
+            project->saved_y[i] = snapshot_file.y;
+        }
+
+        checkRange(snapshot_file.first_import, snapshot_file.import_count, header->import_count);
+        file->imports.reserve(snapshot_file.import_count);
+        for (uint32_t j = 0; j < snapshot_file.import_count; j++) {
+            const SnapshotImport& snapshot_import = snapshot_imports[snapshot_file.first_import + j];
+            if (snapshot_import.file < -1 || snapshot_import.file >= (int32_t) header->file_count) {
+                throw fail("Corrupt snapshot");
+            }
+
+            Import* import = project->arena.imports.create();
+            import->file_name = getName(snapshot_import.name);
+            import->file = snapshot_import.file >= 0 ? files[snapshot_import.file] : nullptr;
+            import->entire_file = snapshot_import.entire_file != 0;
+
+            checkRange(snapshot_import.first_content, snapshot_import.content_count, header->content_count);
+            import->imported_content.reserve(snapshot_import.content_count);
+            for (uint32_t k = 0; k < snapshot_import.content_count; k++) {
+                import->imported_content.push_back(getName(snapshot_contents[snapshot_import.first_content + k]));
+            }
+
+            // Same as linkImports, once per importing file.
+            File* imported_file = import->file;
+            if (imported_file != nullptr &&
+                (imported_file->imported_by.empty() || imported_file->imported_by.back() != file)) {
+                imported_file->imported_by.push_back(file);
+            }
+
+            file->imports.push_back(import);
+        }
+
+        checkRange(snapshot_file.first_symbol, snapshot_file.definition_count, header->content_count);
+        checkRange(snapshot_file.first_symbol + snapshot_file.definition_count, snapshot_file.export_count,
+                   header->content_count);
+        const SnapshotString* symbols = snapshot_contents + snapshot_file.first_symbol;
+        for (uint32_t j = 0; j < snapshot_file.definition_count; j++) {
+            file->symbols.definitions.push_back(getName(symbols[j]));
+        }
+        for (uint32_t j = 0; j < snapshot_file.export_count; j++) {
+            file->symbols.exports.push_back(getName(symbols[snapshot_file.definition_count + j]));
+        }
+        file->symbols.has_exports = snapshot_file.has_exports != 0;
+
+        checkRange(snapshot_file.first_to_do, snapshot_file.to_do_count, header->to_do_count);
+        file->to_dos.reserve(snapshot_file.to_do_count);
+        for (uint32_t j = 0; j < snapshot_file.to_do_count; j++) {
+            const SnapshotToDo& snapshot_to_do = snapshot_to_dos[snapshot_file.first_to_do + j];
+
+            ToDo* to_do = project->arena.to_dos.create();
+            to_do->content = getString(snapshot_to_do.content);
+            to_do->done = snapshot_to_do.done != 0;
+            file->to_dos.push_back(to_do);
+        }
+
+        if (progress != nullptr) {
+            progress->addParsedFile(file->file_name.str());
+        }
+    }
+
+    project->save_path = file_path;
+    return project;
+}
+
+string getSnapshotPath(const string& folder_path) {
+    return (std::filesystem::path(folder_path) / ".pypeline.snapshot").generic_string();
+}
+
+std::unique_ptr<Project> openProject(const string& project_path, ScanMode mode, LoadProgress* progress) {
+    /* Opens a project folder from its snapshot if it was saved before, so its notes and todos come back, and rescans
+     * it for what changed since. Without a snapshot, or one that can't be read, it's parsed from scratch. */
+
+    string snapshot_path = getSnapshotPath(project_path);
+    std::error_code error;
+    if (!std::filesystem::exists(snapshot_path, error)) {
+        return openNewProject(project_path, 0, mode, progress);
+    }
+
+    std::unique_ptr<Project> project;
+    try {
+        project = loadSnapshot(snapshot_path, progress);
+    } catch (const LoadCancelled&) {
+        throw;
+    } catch (const std::runtime_error& load_error) {
+        std::cout << load_error.what() << ", parsing the project instead.\n";
+        return openNewProject(project_path, 0, mode, progress);
+    }
+
+    // Saved somewhere else, the folder was moved since. Paths are the folder's followed by the file's.
+    auto trimSeparators = [](string path) {
+        while (path.size() > 1 && (path.back() == '/' || path.back() == '\\')) path.pop_back();
+        return path;
+    };
+    string saved_path = trimSeparators(project->path);
+    string new_path = trimSeparators(project_path);
+    if (!saved_path.empty() && saved_path != new_path) {
+        for (File* file: project->files) {
+            string file_path = file->file_path.str();
+            if (!file->non_project && startsWith(file_path, saved_path + "/")) {
+                file->file_path = Name(new_path + file_path.substr(saved_path.size()));
+            }
+        }
+    }
+
+    project->path = project_path;
+    project->scan_mode = mode;
+
+    std::unordered_map<const File*, size_t> saved_indices;  // The saved layout goes by position in files.
+    for (size_t i = 0; i < project->files.size(); i++) {
+        saved_indices.emplace(project->files[i], i);
+    }
+
+    rescanProject(*project, 0, progress);
+
+    if (!project->saved_levels.empty()) {  // Kept if all files are still there, otherwise it's laid out again.
+        vector<int> levels;
+        vector<float> x, y;
+        for (const File* file: project->files) {
+            auto saved_index = saved_indices.find(file);
+            if (saved_index == saved_indices.end()) break;
+
+            levels.push_back(project->saved_levels[saved_index->second]);
+            x.push_back(project->saved_x[saved_index->second]);
+            y.push_back(project->saved_y[saved_index->second]);
+        }
+
+        bool complete = levels.size() == project->files.size();
+        project->saved_levels = complete ? levels : vector<int>();
+        project->saved_x = complete ? x : vector<float>();
+        project->saved_y = complete ? y : vector<float>();
+    }
+
+    return project;
+}
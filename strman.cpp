@@ -1,4 +1,5 @@
-#include <regex>
+
+#include <cstdint>
 
 #include "common.h"
 
@@ -13,9 +14,127 @@ bool startsWith(string const & value, string const & start) {
 }
 
 string trim(const string& input) {
-    return regex_replace(input, std::regex(R"((^(^\s+|\s+$)|\r))"), "");
+    /* Strips leading and trailing whitespace, "\r" included. */
+
+    size_t start = input.find_first_not_of(" \t\n\r\f\v");
+    if (start == string::npos) return "";
+
+    size_t end = input.find_last_not_of(" \t\n\r\f\v");
+    return input.substr(start, end - start + 1);
 }
 
-string getProjectPath(const string& file_path) {
-    return regex_replace(file_path, std::regex("[a-zA-Z0-9]+\\.py"), "test.json");
-}
\ No newline at end of file
+unsigned long long hashContent(std::string_view content) {
+    /* 64 bit FNV-1a. */
+
+    unsigned long long hash = 14695981039346656037ULL;
+    for (char c: content) {
+        hash = (hash ^ (unsigned char) c) * 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+namespace {
+    class NameTable {
+        /* Split into shards by hash, so parser threads rarely wait for each other. The strings are in blocks that
+         * never move, so looking one up by id takes no lock: whoever has an id got it after it was stored. */
+
+        public:
+            NameTable() {
+                intern("");  // Id 0, what Name() is.
+            }
+
+            uint32_t intern(std::string_view text) {
+                Shard& shard = getShard(text);
+                std::lock_guard<std::mutex> lock(shard.mutex);
+
+                auto entry = shard.ids.find(text);
+                if (entry != shard.ids.end()) return entry->second;
+
+                uint32_t id = next_id++;
+                if (id == UINT32_MAX) {
+                    throw std::runtime_error("Too many names.");
+                }
+
+                string& stored = getBlock(id >> block_bits)[id & block_mask];
+                stored = text;
+                shard.ids.emplace(stored, id);
+                return id;
+            }
+
+            bool find(std::string_view text, uint32_t& id) {
+                Shard& shard = getShard(text);
+                std::lock_guard<std::mutex> lock(shard.mutex);
+
+                auto entry = shard.ids.find(text);
+                if (entry == shard.ids.end()) return false;
+
+                id = entry->second;
+                return true;
+            }
+
+            const string& get(uint32_t id) const {
+                return blocks[id >> block_bits].load(std::memory_order_acquire)[id & block_mask];
+            }
+
+            size_t count() const {
+                return next_id;
+            }
+
+        private:
+            static constexpr unsigned block_bits = 14;
+            static constexpr uint32_t block_mask = (1u << block_bits) - 1;
+            static constexpr size_t shard_count = 64;
+
+            struct Shard {
+                std::mutex mutex;
+                std::unordered_map<std::string_view, uint32_t> ids;  // Views into the blocks.
+            };
+
+            Shard shards[shard_count];
+            std::atomic<uint32_t> next_id = 0;
+
+            std::mutex block_mutex;
+            std::atomic<string*> blocks[(size_t) 1 << (32 - block_bits)] = {};
+
+            Shard& getShard(std::string_view text) {
+                return shards[std::hash<std::string_view>()(text) % shard_count];
+            }
+
+            string* getBlock(size_t index) {
+                string* block = blocks[index].load(std::memory_order_acquire);
+                if (block != nullptr) return block;
+
+                std::lock_guard<std::mutex> lock(block_mutex);
+                block = blocks[index].load(std::memory_order_relaxed);
+                if (block == nullptr) {
+                    block = new string[(size_t) 1 << block_bits];
+                    blocks[index].store(block, std::memory_order_release);
+                }
+                return block;
+            }
+    };
+
+    NameTable& getNameTable() {
+        static NameTable* table = new NameTable();  // Never destroyed, names may still be used while exiting.
+        return *table;
+    }
+}
+
+Name::Name(std::string_view text) : id(getNameTable().intern(text)) {}
+
+bool Name::find(std::string_view text, Name& name) {
+    return getNameTable().find(text, name.id);
+}
+
+size_t Name::count() {
+    return getNameTable().count();
+}
+
+const string& Name::str() const {
+    return getNameTable().get(id);
+}
+
+std::ostream& operator<<(std::ostream& out, Name name) {
+    return out << name.str();
+}
@@ -0,0 +1,318 @@
+#include <algorithm>
+#include <tuple>
+#include <unordered_set>
+
+#include "common.h"
+
+namespace {
+    constexpr uint32_t no_file = UINT32_MAX;
+    constexpr uint32_t computing = UINT32_MAX - 1;  // Star names of a file that are still being worked out.
+    constexpr size_t max_depth = 64;  // Re-exports followed at most, deeper chains stay with the last module.
+
+    bool isPublic(std::string_view name) {
+        return !name.empty() && name[0] != '_';
+    }
+}
+
+SymbolIndex::SymbolIndex(const vector<File*>& files) : files(files.begin(), files.end()), star_name("*") {
+    /* Lays out the names of every file and import, then resolves the names of every import, in file order. */
+
+    ProfileScope scope("symbol index");
+
+    file_indices.reserve(files.size());
+    for (size_t i = 0; i < files.size(); i++) {
+        file_indices.emplace(files[i], (uint32_t) i);
+    }
+
+    ModuleIndex module_index(files);
+
+    // Modules with submodules, only imports from those need a lookup per name.
+    std::unordered_set<Name> packages;
+    for (const File* file: files) {
+        std::string_view module_name = file->file_name.view();
+        size_t last_dot = module_name.find_last_of('.');
+        if (last_dot != std::string_view::npos) packages.insert(Name(module_name.substr(0, last_dot)));
+    }
+
+    definition_starts.reserve(files.size() + 1);
+    export_starts.reserve(files.size() + 1);
+    for (const File* file: files) {
+        definition_starts.push_back((uint32_t) definitions.size());
+        definitions.insert(definitions.end(), file->symbols.definitions.begin(), file->symbols.definitions.end());
+        // Sorted, for lookups. A name assigned twice is defined once.
+        auto first = definitions.begin() + definition_starts.back();
+        std::sort(first, definitions.end());
+        definitions.erase(std::unique(first, definitions.end()), definitions.end());
+
+        export_starts.push_back((uint32_t) exports.size());
+        exports.insert(exports.end(), file->symbols.exports.begin(), file->symbols.exports.end());
+    }
+    definition_starts.push_back((uint32_t) definitions.size());
+    export_starts.push_back((uint32_t) exports.size());
+
+    // What every import comes from, and the names it brings in.
+    import_starts.reserve(files.size() + 1);
+    import_indices.reserve(files.size() * 8);
+    for (size_t i = 0; i < files.size(); i++) {
+        import_starts.push_back((uint32_t) import_sources.size());
+
+        for (const Import* import: files[i]->imports) {
+            import_indices.emplace(import, (uint32_t) import_sources.size());
+
+            // Usually linked to the module already, unless it's linked to a submodule or not at all.
+            Name module_name = resolveModuleName(*files[i], import->file_name);
+            const File* source = import->file;
+            if (source == nullptr || source->file_name != module_name) {
+                source = module_name.empty() ? nullptr : module_index.find(*files[i], module_name);
+            }
+            import_sources.push_back(source != nullptr ? file_indices.at(source) : no_file);
+
+            import_name_starts.push_back((uint32_t) import_names.size());
+            if (import->entire_file) continue;
+
+            bool package = packages.count(module_name) != 0;
+            for (Name imported_object: import->imported_content) {
+                // "from pkg import mod" is about the submodule, if there is one.
+                const File* submodule = package ? module_index.find(*files[i], module_name.str() + "." +
+                                                                                   imported_object.str())
+                                                : nullptr;
+                import_names.push_back({imported_object, submodule != nullptr ? file_indices.at(submodule) : no_file});
+            }
+        }
+    }
+    import_starts.push_back((uint32_t) import_sources.size());
+    import_name_starts.push_back((uint32_t) import_names.size());
+
+    star_starts.assign(files.size(), no_file);
+    star_counts.assign(files.size(), 0);
+
+    // Resolved once, the per import symbols only point into here.
+    import_symbol_starts.reserve(import_sources.size() + 1);
+    for (size_t i = 0; i < files.size(); i++) {
+        for (uint32_t import = import_starts[i]; import < import_starts[i + 1]; import++) {
+            import_symbol_starts.push_back((uint32_t) import_symbols.size());
+
+            uint32_t source = import_sources[import];
+            if (!files[i]->imports[import - import_starts[i]]->entire_file) {
+                appendImportedSymbols(import, import_symbols, 0);
+            } else if (source != no_file) {
+                import_symbols.push_back({source, whole_module});
+            }
+        }
+    }
+    import_symbol_starts.push_back((uint32_t) import_symbols.size());
+
+    // Who imports what, per file they're defined in, then sorted by name.
+    importer_starts.assign(files.size() + 1, 0);
+    for (const Symbol& symbol: import_symbols) {
+        if (symbol.file != no_file) importer_starts[symbol.file + 1]++;
+    }
+    for (size_t i = 0; i < files.size(); i++) importer_starts[i + 1] += importer_starts[i];
+
+    importers.resize(importer_starts.back());
+    vector<uint32_t> next = importer_starts;
+    for (uint32_t i = 0; i < (uint32_t) files.size(); i++) {
+        for (uint32_t s = import_symbol_starts[import_starts[i]]; s < import_symbol_starts[import_starts[i + 1]]; s++) {
+            const Symbol& symbol = import_symbols[s];
+            if (symbol.file != no_file) importers[next[symbol.file]++] = {symbol.name, i};
+        }
+    }
+    for (size_t i = 0; i < files.size(); i++) {
+        std::sort(importers.begin() + importer_starts[i], importers.begin() + importer_starts[i + 1],
+                  [](const Importer& a, const Importer& b) {
+                      return std::tie(a.name, a.file) < std::tie(b.name, b.file);
+                  });
+    }
+
+    // Only needed while resolving.
+    resolved = {};
+    star_symbols = {};
+    star_starts = {};
+    star_counts = {};
+    seen_names = {};
+}
+
+bool SymbolIndex::defines(uint32_t file, Name name) const {
+    return std::binary_search(definitions.begin() + definition_starts[file],
+                              definitions.begin() + definition_starts[file + 1], name);
+}
+
+SymbolIndex::Symbol SymbolIndex::resolve(uint32_t file, Name name, size_t depth) {
+    /* Where name, as seen from file, is defined: in the file itself, or wherever the file imported it from.
+     * Names that can't be found anywhere are taken to be the file's own. */
+
+    if (defines(file, name) || depth >= max_depth) return {file, name};
+
+    auto cached = resolved.find(((uint64_t) file << 32) | name.getId());
+    if (cached != resolved.end()) return cached->second;
+
+    Symbol symbol = {file, name};
+    bool found = false;
+
+    // Re-exported by name, "from .mod import name".
+    for (uint32_t import = import_starts[file]; import < import_starts[file + 1] && !found; import++) {
+        for (uint32_t n = import_name_starts[import]; n < import_name_starts[import + 1]; n++) {
+            if (import_names[n].name != name) continue;
+
+            if (import_names[n].submodule != no_file) {
+                symbol = {import_names[n].submodule, whole_module};
+            } else if (import_sources[import] != no_file) {
+                symbol = resolve(import_sources[import], name, depth + 1);
+            } else {
+                symbol = {no_file, name};  // From outside the project.
+            }
+            found = true;
+            break;
+        }
+    }
+
+    // Or through a star import.
+    for (uint32_t import = import_starts[file]; import < import_starts[file + 1] && !found; import++) {
+        uint32_t source = import_sources[import];
+        if (source == no_file || !isStarImport(import)) continue;
+
+        const Symbol* first = getStarSymbols(source, depth + 1);
+        const Symbol* last = first + star_counts[source];
+        auto star_symbol = std::find_if(first, last, [&](const Symbol& s) { return getStarName(s) == name; });
+        if (star_symbol != last) {
+            symbol = *star_symbol;
+            found = true;
+        }
+    }
+
+    resolved.emplace(((uint64_t) file << 32) | name.getId(), symbol);
+    return symbol;
+}
+
+bool SymbolIndex::isStarImport(uint32_t import) const {
+    for (uint32_t n = import_name_starts[import]; n < import_name_starts[import + 1]; n++) {
+        if (import_names[n].name == star_name) return true;
+    }
+    return false;
+}
+
+Name SymbolIndex::getStarName(const Symbol& symbol) const {
+    /* The name a star imported symbol goes by, a submodule by its last part. */
+
+    if (symbol.name != whole_module) return symbol.name;
+
+    std::string_view module_name = files[symbol.file]->file_name.view();
+    Name name;
+    return Name::find(module_name.substr(module_name.find_last_of('.') + 1), name) ? name : whole_module;
+}
+
+const SymbolIndex::Symbol* SymbolIndex::getStarSymbols(uint32_t file, size_t depth) {
+    /* What "from file import *" brings in: what __all__ lists, or every public name the file defines or imports by
+     * name or through stars of its own. star_counts[file] of them. A star import that comes back around to a file
+     * still being worked out gets nothing from it. */
+
+    if (star_starts[file] == computing) return star_symbols.data();  // With star_counts[file] still 0.
+    if (star_starts[file] != no_file) return star_symbols.data() + star_starts[file];
+
+    star_starts[file] = computing;
+
+    vector<Symbol> file_symbols;
+    if (files[file]->symbols.has_exports) {
+        for (uint32_t e = export_starts[file]; e < export_starts[file + 1]; e++) {
+            file_symbols.push_back(resolve(file, exports[e], depth));
+        }
+    } else {
+        for (uint32_t d = definition_starts[file]; d < definition_starts[file + 1]; d++) {
+            if (isPublic(definitions[d].view())) file_symbols.push_back({file, definitions[d]});
+        }
+        for (uint32_t import = import_starts[file]; import < import_starts[file + 1]; import++) {
+            if (isStarImport(import)) {
+                uint32_t source = import_sources[import];
+                if (source == no_file || depth >= max_depth) continue;
+
+                const Symbol* first = getStarSymbols(source, depth + 1);
+                file_symbols.insert(file_symbols.end(), first, first + star_counts[source]);
+            } else {
+                for (uint32_t n = import_name_starts[import]; n < import_name_starts[import + 1]; n++) {
+                    if (isPublic(import_names[n].name.view())) {
+                        file_symbols.push_back(resolve(file, import_names[n].name, depth));
+                    }
+                }
+            }
+        }
+    }
+
+    // Once per name, the first one wins.
+    vector<Symbol> unique_symbols;
+    seen_names.resize(Name::count(), 0);
+    star_pass++;
+    for (const Symbol& symbol: file_symbols) {
+        uint32_t name = getStarName(symbol).getId();
+        if (seen_names[name] != star_pass) {
+            seen_names[name] = star_pass;
+            unique_symbols.push_back(symbol);
+        }
+    }
+
+    star_starts[file] = (uint32_t) star_symbols.size();
+    star_counts[file] = (uint32_t) unique_symbols.size();
+    star_symbols.insert(star_symbols.end(), unique_symbols.begin(), unique_symbols.end());
+    return star_symbols.data() + star_starts[file];
+}
+
+void SymbolIndex::appendImportedSymbols(uint32_t import, vector<Symbol>& imported, size_t depth) {
+    uint32_t source = import_sources[import];
+
+    for (uint32_t n = import_name_starts[import]; n < import_name_starts[import + 1]; n++) {
+        const ImportName& import_name = import_names[n];
+
+        if (import_name.submodule != no_file) {
+            imported.push_back({import_name.submodule, whole_module});
+        } else if (source == no_file) {
+            continue;  // Not a project module, nothing to point to.
+        } else if (import_name.name == star_name) {
+            const Symbol* first = getStarSymbols(source, depth + 1);
+            imported.insert(imported.end(), first, first + star_counts[source]);
+        } else {
+            imported.push_back(resolve(source, import_name.name, depth + 1));
+        }
+    }
+}
+
+const File* SymbolIndex::getFile(const Symbol& symbol) const {
+    return symbol.file != no_file ? files[symbol.file] : nullptr;
+}
+
+vector<SymbolIndex::Symbol> SymbolIndex::getSymbols(const Import* import) const {
+    auto index = import_indices.find(import);
+    if (index == import_indices.end()) return {};
+
+    return vector<Symbol>(import_symbols.begin() + import_symbol_starts[index->second],
+                          import_symbols.begin() + import_symbol_starts[index->second + 1]);
+}
+
+vector<SymbolIndex::Symbol> SymbolIndex::getDefinitions(const File* file) const {
+    auto index = file_indices.find(file);
+    if (index == file_indices.end()) return {};
+
+    vector<Symbol> file_definitions;
+    for (uint32_t d = definition_starts[index->second]; d < definition_starts[index->second + 1]; d++) {
+        file_definitions.push_back({index->second, definitions[d]});
+    }
+    return file_definitions;
+}
+
+vector<const File*> SymbolIndex::getImporters(const File* file, std::string_view name) const {
+    /* An empty name asks who imports the module itself. */
+
+    auto index = file_indices.find(file);
+    Name imported_name;
+    if (index == file_indices.end() || !Name::find(name, imported_name)) return {};
+
+    auto last = importers.begin() + importer_starts[index->second + 1];
+    auto first = std::lower_bound(importers.begin() + importer_starts[index->second], last, imported_name,
+                                  [](const Importer& importer, Name name) { return importer.name < name; });
+
+    vector<const File*> importing_files;
+    for (auto importer = first; importer != last && importer->name == imported_name; importer++) {
+        if (importing_files.empty() || importing_files.back() != files[importer->file]) {
+            importing_files.push_back(files[importer->file]);  // Once, even if it imports the name twice.
+        }
+    }
+    return importing_files;
+}
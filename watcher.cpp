@@ -0,0 +1,171 @@
+#include <atomic>
+#include <chrono>
+#include <set>
+#include <thread>
+
+#include "common.h"
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+using Clock = std::chrono::steady_clock;
+
+class ProjectWatcher::Implementation {
+    /* Collects the paths of changed python files (and of created or deleted folders) from inotify on a background
+     * thread. Changes are only handed out once the project has been quiet for a moment, so a burst of events like
+     * a git checkout ends up as a single batch. */
+
+    public:
+        explicit Implementation(const string& project_path) : project_path(project_path) {
+            inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+            if (inotify_fd < 0) {
+                std::cout << "Failed to start watching " << project_path << ".\n";
+                return;
+            }
+
+            crawlProject(project_path, [](const string&, const string&) {},
+                         [this](const string& folder_path) { watchFolder(folder_path); });
+
+            thread = std::thread(&Implementation::run, this);
+        }
+
+        ~Implementation() {
+            stopping = true;
+            if (thread.joinable()) {
+                thread.join();
+            }
+            if (inotify_fd >= 0) {
+                close(inotify_fd);
+            }
+        }
+
+        bool takeChanges(vector<string>& changed_paths) {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            bool settled = Clock::now() - last_event_time > quiet_time || Clock::now() - first_event_time > max_delay;
+            if (pending_paths.empty() || !settled) return false;
+
+            changed_paths.assign(pending_paths.begin(), pending_paths.end());
+            pending_paths.clear();
+            return true;
+        }
+
+    private:
+        static constexpr std::chrono::milliseconds quiet_time{250};
+        static constexpr std::chrono::milliseconds max_delay{2000};  // Keep up during a long stream of events.
+
+        string project_path;
+        int inotify_fd = -1;
+        std::unordered_map<int, string> folders;  // By watch descriptor. Only used by the watcher thread.
+
+        std::thread thread;
+        std::atomic<bool> stopping = false;
+
+        std::mutex mutex;
+        std::set<string> pending_paths;
+        Clock::time_point first_event_time;
+        Clock::time_point last_event_time;
+
+        void watchFolder(const string& folder_path) {
+            const uint32_t mask = IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR;
+
+            int watch = inotify_add_watch(inotify_fd, folder_path.c_str(), mask);
+            if (watch >= 0) {
+                folders[watch] = folder_path;
+            }
+        }
+
+        void addChange(const string& path) {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            if (pending_paths.empty()) {
+                first_event_time = Clock::now();
+            }
+            last_event_time = Clock::now();
+            pending_paths.insert(path);
+        }
+
+        void handleEvent(const inotify_event& event) {
+            if (event.mask & IN_Q_OVERFLOW) {  // Events were lost, report every watched folder.
+                for (const auto& [watch, folder_path]: folders) {
+                    addChange(folder_path);
+                }
+                return;
+            }
+
+            if (event.mask & IN_IGNORED) {  // The folder itself is gone.
+                folders.erase(event.wd);
+                return;
+            }
+
+            auto folder = folders.find(event.wd);
+            if (folder == folders.end() || event.len == 0) return;
+
+            string name = event.name;
+            string path = folder->second + "/" + name;
+
+            if (event.mask & IN_ISDIR) {
+                if (name == "__pycache__" || startsWith(name, ".")) return;
+
+                if (event.mask & (IN_CREATE | IN_MOVED_TO)) {
+                    // Watch the new folder and everything in it, unless the crawler skips it (a new virtual
+                    // environment or an ignored build folder). It may already be gone again.
+                    bool crawled = false;
+                    try {
+                        crawled = crawlProjectFolder(project_path, path, [](const string&, const string&) {},
+                                                     [this](const string& folder_path) { watchFolder(folder_path); });
+                    } catch (const std::exception&) {}
+                    if (!crawled) return;
+                }
+                addChange(path);  // The files that were in it, or that showed up before the watch did.
+            } else if (endsWith(name, ".py")) {
+                addChange(path);
+            }
+        }
+
+        void run() {
+            alignas(inotify_event) char buffer[16 * 1024];
+            pollfd poll_fd = {inotify_fd, POLLIN, 0};
+
+            while (!stopping) {
+                if (poll(&poll_fd, 1, 100) <= 0) continue;  // Wakes up now and then to check for stopping.
+
+                ssize_t length;
+                while ((length = read(inotify_fd, buffer, sizeof(buffer))) > 0) {
+                    for (char* event = buffer; event < buffer + length;
+                         event += sizeof(inotify_event) + ((inotify_event*) event)->len) {
+                        handleEvent(*(inotify_event*) event);
+                    }
+                }
+            }
+        }
+};
+
+#else
+
+class ProjectWatcher::Implementation {
+    public:
+        explicit Implementation(const string&) {}
+
+        bool takeChanges(vector<string>&) {
+            return false;
+        }
+};
+
+#endif
+
+ProjectWatcher::ProjectWatcher(const string& project_path)
+    : implementation(new Implementation(project_path)) {}
+
+ProjectWatcher::~ProjectWatcher() {
+    delete implementation;
+}
+
+bool ProjectWatcher::takeChanges(vector<string>& changed_paths) {
+    /* Non blocking. Returns true and the changed paths once a batch of changes has settled. Paths can be files or
+     * folders, and may no longer exist. */
+
+    return implementation->takeChanges(changed_paths);
+}